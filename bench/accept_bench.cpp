@@ -0,0 +1,173 @@
+// Accept-to-first-byte latency against a running server: holds N keep-alive
+// connections open (each has served one request and sits idle), then times
+// fresh connections from connect() to the first byte of the response.
+// The server must be started with an fd limit above N.
+//
+// usage: ./accept_bench [idle connections] [samples] [port] [path]
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t raiseFdLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return 1024;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    return limit.rlim_cur;
+}
+
+static int connectTo(const struct sockaddr_in& addr) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    if (connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+// Reads one whole response (head and Content-Length body), true on a 200
+static bool readResponse(int fd) {
+    std::string response;
+    char buffer[16384];
+    size_t head_end = std::string::npos;
+    size_t length = 0;
+
+    while (true) {
+        if (head_end != std::string::npos && response.size() >= head_end + 4 + length) {
+            return response.compare(0, 12, "HTTP/1.1 200") == 0;
+        }
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            return false;
+        }
+        response.append(buffer, n);
+        if (head_end == std::string::npos && (head_end = response.find("\r\n\r\n")) != std::string::npos) {
+            std::string head = response.substr(0, head_end);
+            for (size_t i = 0; i < head.size(); ++i) {
+                head[i] = static_cast<char>(tolower(head[i]));
+            }
+            size_t field = head.find("\r\ncontent-length:");
+            if (field != std::string::npos) {
+                length = strtoul(head.c_str() + field + 17, NULL, 10);
+            }
+        }
+    }
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    size_t index = static_cast<size_t>(sorted.size() * p);
+    return sorted[index < sorted.size() ? index : sorted.size() - 1];
+}
+
+int main(int argc, char** argv) {
+    int idle = argc > 1 ? atoi(argv[1]) : 10000;
+    int samples = argc > 2 ? atoi(argv[2]) : 3000;
+    int port = argc > 3 ? atoi(argv[3]) : 8080;
+    std::string path = argc > 4 ? argv[4] : "/";
+
+    size_t limit = raiseFdLimit();
+    if (static_cast<size_t>(idle) + 64 > limit) {
+        fprintf(stderr, "%d idle connections need an fd limit above %d (have %lu)\n", idle, idle + 64,
+                static_cast<unsigned long>(limit));
+        return 1;
+    }
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // Every held connection serves one request first, so the server has
+    // gone through a full lifecycle for each before it turns idle
+    std::string keep_alive = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    std::vector<int> held;
+    held.reserve(idle);
+    for (int i = 0; i < idle; ++i) {
+        int fd = connectTo(addr);
+        if (fd == -1 || !sendAll(fd, keep_alive)) {
+            fprintf(stderr, "connection %d: %s\n", i, strerror(errno));
+            return 1;
+        }
+        held.push_back(fd);
+    }
+    int failed = 0;
+    for (size_t i = 0; i < held.size(); ++i) {
+        failed += !readResponse(held[i]);
+    }
+    usleep(500000);
+
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    std::vector<double> latencies;
+    latencies.reserve(samples);
+    for (int i = 0; i < samples; ++i) {
+        double start = nowSeconds();
+        int fd = connectTo(addr);
+        char byte;
+        if (fd == -1 || !sendAll(fd, request) || recv(fd, &byte, 1, 0) != 1) {
+            ++failed;
+        } else {
+            latencies.push_back((nowSeconds() - start) * 1e6);
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    // The held connections must still be open: the server kept them all
+    int dropped = 0;
+    for (size_t i = 0; i < held.size(); ++i) {
+        char byte;
+        dropped += recv(held[i], &byte, 1, MSG_DONTWAIT) != -1 || errno != EAGAIN;
+        close(held[i]);
+    }
+
+    printf("Accept to first byte, %d idle keep-alive connections (%d dropped), %lu samples, %d failed\n", idle,
+           dropped, static_cast<unsigned long>(latencies.size()), failed);
+    if (latencies.empty()) {
+        return 1;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("p50 %8.1f us  p90 %8.1f us  p99 %8.1f us  max %8.1f us\n", percentile(latencies, 0.5),
+           percentile(latencies, 0.9), percentile(latencies, 0.99), latencies.back());
+    return failed || dropped ? 1 : 0;
+}
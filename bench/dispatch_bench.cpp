@@ -0,0 +1,136 @@
+// Event dispatch cost: registers N always-readable eventfds with the event
+// manager and reports the time per dispatched event, from the wait syscall
+// to the callback, at 1k and 50k registered fds by default.
+//
+// Each backend the kernel supports is measured (io_uring falls back to
+// epoll where it is not available). The fd limit is raised to its hard
+// maximum; a count above it is capped and reported as such.
+//
+// usage: ./dispatch_bench [rounds] [fds...]
+
+#include "EventManager.hpp"
+#include "Logger.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+static unsigned long g_dispatched = 0;
+
+static void onReadable(int fd, void* context) {
+    (void)fd;
+    (void)context;
+    ++g_dispatched;
+}
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Room for the eventfds, the event manager and stdio
+static size_t raiseFdLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return 1024;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    return limit.rlim_cur;
+}
+
+// Every fd stays readable (its counter is never read), so each wait returns
+// a full batch of events
+static bool run(const std::string& backend, size_t count, int rounds) {
+    EventManager* events = EventManager::create(backend);
+    if (events->failed) {
+        fprintf(stderr, "%s: could not create the event manager\n", backend.c_str());
+        delete events;
+        return false;
+    }
+    if (backend != events->name()) {
+        delete events;
+        return true;    // fell back to epoll, measured already
+    }
+
+    std::vector<int> fds;
+    bool ok = true;
+    for (size_t i = 0; i < count && ok; ++i) {
+        int fd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "eventfd: %s\n", strerror(errno));
+            ok = false;
+            break;
+        }
+        fds.push_back(fd);
+        ok = events->bindToFd(fd, EVENT_READ, onReadable);
+    }
+
+    if (ok) {
+        // Warm up: the first waits also arm the fds (io_uring polls)
+        for (int i = 0; i < 3; ++i) {
+            events->watchForEvents(NULL, 0);
+        }
+        g_dispatched = 0;
+        double start = nowSeconds();
+        for (int i = 0; i < rounds; ++i) {
+            if (events->watchForEvents(NULL, 0) < 0) {
+                ok = false;
+                break;
+            }
+        }
+        double elapsed = nowSeconds() - start;
+        if (ok) {
+            printf("%-9s %6lu fds  %8.1f ns/event  %10.0f events/s\n", events->name(),
+                   static_cast<unsigned long>(count),
+                   g_dispatched ? elapsed * 1e9 / g_dispatched : 0.0, g_dispatched / elapsed);
+        }
+    }
+
+    for (size_t i = 0; i < fds.size(); ++i) {
+        events->unbindFd(fds[i], -1);
+        close(fds[i]);
+    }
+    delete events;
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    std::vector<size_t> counts;
+    for (int i = 2; i < argc; ++i) {
+        counts.push_back(atoi(argv[i]));
+    }
+    if (counts.empty()) {
+        counts.push_back(1000);
+        counts.push_back(50000);
+    }
+    Logger::setLevel(WARNING);
+
+    size_t limit = raiseFdLimit();
+    size_t available = limit > 64 ? limit - 64 : 0;
+    printf("Event dispatch, %d waits per case, fd limit %lu\n", rounds, static_cast<unsigned long>(limit));
+
+    const char* backends[] = { "epoll", "io_uring" };
+    bool ok = true;
+    for (size_t b = 0; b < 2 && ok; ++b) {
+        for (size_t i = 0; i < counts.size() && ok; ++i) {
+            size_t count = counts[i];
+            if (count > available) {
+                printf("(%lu fds capped at %lu by the fd limit)\n", static_cast<unsigned long>(count),
+                       static_cast<unsigned long>(available));
+                count = available;
+            }
+            ok = run(backends[b], count, rounds);
+        }
+    }
+    return ok ? 0 : 1;
+}
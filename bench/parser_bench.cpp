@@ -0,0 +1,208 @@
+// Parser throughput: feeds a request stream to HTTPParser through a
+// ChainBuffer, in reads of a fixed size like the socket would, and reports
+// MB/s and heap allocations per request for a few typical shapes of
+// traffic, then the cost of reading headers back from a parsed request.
+//
+// Each case runs with every scanning level the CPU supports, best first.
+//
+// usage: ./parser_bench [MB per case] [read size]
+
+#include "HTTPParser.hpp"
+#include "HTTPRequest.hpp"
+#include "ChainBuffer.hpp"
+#include "Logger.hpp"
+#include "Scanner.hpp"
+#include "Utils.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+
+// Every operator new of the process is counted
+static unsigned long g_allocations = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc) {
+    ++g_allocations;
+    void* memory = malloc(size ? size : 1);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) throw() {
+    free(memory);
+}
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// What a browser sends for a page
+static std::string browserRequest() {
+    return "GET /index.html HTTP/1.1\r\n"
+           "Host: localhost:8080\r\n"
+           "Connection: keep-alive\r\n"
+           "sec-ch-ua: \"Chromium\";v=\"120\", \"Not?A_Brand\";v=\"8\"\r\n"
+           "sec-ch-ua-mobile: ?0\r\n"
+           "sec-ch-ua-platform: \"Linux\"\r\n"
+           "Upgrade-Insecure-Requests: 1\r\n"
+           "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+           "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+           "Sec-Fetch-Site: none\r\n"
+           "Sec-Fetch-Mode: navigate\r\n"
+           "Sec-Fetch-User: ?1\r\n"
+           "Sec-Fetch-Dest: document\r\n"
+           "Accept-Encoding: gzip, deflate, br\r\n"
+           "Accept-Language: fr-FR,fr;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+           "\r\n";
+}
+
+// A GET with 50 header lines
+static std::string manyHeadersRequest() {
+    std::string request = "GET /static/index.html?lang=fr&page=2 HTTP/1.1\r\n"
+                          "Host: localhost:8080\r\n"
+                          "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n"
+                          "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+                          "Accept-Language: fr-FR,fr;q=0.8,en-US;q=0.5,en;q=0.3\r\n"
+                          "Accept-Encoding: gzip, deflate, br\r\n"
+                          "Connection: keep-alive\r\n"
+                          "Cookie: session=4f2a9c1e7b3d5a6f8e0c2b4d6a8f0e1c; theme=dark\r\n";
+    for (int i = 0; request.size() < 2048 && i < 43; ++i) {
+        request += "X-Custom-Header-" + Utils::intToString(i) + ": value-" + Utils::intToString(i * 7919) + "\r\n";
+    }
+    return request + "\r\n";
+}
+
+static std::string contentLengthRequest(size_t body_size) {
+    return "POST /upload HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/octet-stream\r\n"
+           "Content-Length: " + Utils::intToString(body_size) + "\r\n\r\n" + std::string(body_size, 'x');
+}
+
+static std::string chunkedRequest(size_t body_size, size_t chunk_size) {
+    std::string request = "POST /upload HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n";
+    char size_line[32];
+    for (size_t sent = 0; sent < body_size; sent += chunk_size) {
+        snprintf(size_line, sizeof(size_line), "%lx\r\n", static_cast<unsigned long>(chunk_size));
+        request += size_line;
+        request.append(chunk_size, 'x');
+        request += "\r\n";
+    }
+    return request + "0\r\n\r\n";
+}
+
+// Parses stream over and over until total bytes went through; false if the
+// parser rejected a request
+static bool run(const char* label, const std::string& stream, size_t total, size_t read_size) {
+    SegmentPool pool;
+    ChainBuffer input;
+    HTTPParser parser;
+    HTTPRequest request;
+    input.setPool(&pool);
+    parser.setInput(&input);
+
+    size_t offset = 0;
+    size_t fed = 0;
+    size_t requests = 0;
+    unsigned long allocations = g_allocations;
+    double start = nowSeconds();
+    while (fed < total) {
+        struct iovec iov[2];
+        int count = input.prepareRead(iov);
+        size_t length = 0;
+        for (int i = 0; i < count && length < read_size; ++i) {
+            size_t room = iov[i].iov_len < read_size - length ? iov[i].iov_len : read_size - length;
+            size_t copied = 0;
+            while (copied < room) {
+                size_t taken = stream.size() - offset < room - copied ? stream.size() - offset : room - copied;
+                memcpy(static_cast<char*>(iov[i].iov_base) + copied, stream.data() + offset, taken);
+                copied += taken;
+                offset = (offset + taken) % stream.size();
+            }
+            length += room;
+        }
+        input.commitRead(length);
+        fed += length;
+
+        while (parser.parse(request) && parser.isComplete()) {
+            ++requests;
+            parser.next();
+            std::string().swap(request.getBodyRef());
+            request.clear();
+        }
+        if (parser.hasError()) {
+            fprintf(stderr, "%s: parse error after %lu requests\n", label, static_cast<unsigned long>(requests));
+            return false;
+        }
+    }
+    double elapsed = nowSeconds() - start;
+    allocations = g_allocations - allocations;
+    printf("%-36s %8.1f MB/s  %10.0f requests/s  %8.2f allocations/request\n", label,
+           fed / elapsed / (1024 * 1024), requests / elapsed,
+           requests ? static_cast<double>(allocations) / requests : 0.0);
+    return true;
+}
+
+// The lookups the server makes on every request, by name and by id
+static bool lookups(size_t rounds) {
+    SegmentPool pool;
+    ChainBuffer input;
+    HTTPParser parser;
+    HTTPRequest request;
+    input.setPool(&pool);
+    parser.setInput(&input);
+    std::string stream = browserRequest();
+    input.append(stream.data(), stream.size());
+    if (!parser.parse(request) || !parser.isComplete()) {
+        fprintf(stderr, "lookups: parse error\n");
+        return false;
+    }
+
+    static const char* const names[] = { "content-length", "transfer-encoding", "host", "content-type", "cookie" };
+    static const HeaderId ids[] = { HEADER_CONTENT_LENGTH, HEADER_TRANSFER_ENCODING, HEADER_HOST, HEADER_CONTENT_TYPE, HEADER_COOKIE };
+    const char* value;
+    size_t length;
+    size_t found = 0;
+
+    double start = nowSeconds();
+    for (size_t i = 0; i < rounds; ++i) {
+        for (size_t j = 0; j < 5; ++j) {
+            found += request.findHeader(names[j], value, length);
+        }
+    }
+    double by_name = nowSeconds() - start;
+    start = nowSeconds();
+    for (size_t i = 0; i < rounds; ++i) {
+        for (size_t j = 0; j < 5; ++j) {
+            found += request.findHeader(ids[j], value, length);
+        }
+    }
+    double by_id = nowSeconds() - start;
+    printf("%-36s %8.1f ns by name  %8.1f ns by id  (%lu found)\n", "Header lookup, browser headers",
+           by_name * 1e9 / (rounds * 5), by_id * 1e9 / (rounds * 5), static_cast<unsigned long>(found));
+    return true;
+}
+
+int main(int argc, char** argv) {
+    size_t total = (argc > 1 ? atoi(argv[1]) : 256) * 1024UL * 1024;
+    size_t read_size = argc > 2 ? atoi(argv[2]) : 1460;
+    Logger::setLevel(WARNING);
+
+    bool ok = true;
+    for (int level = Scanner::level(); ok && level >= SCAN_SCALAR; --level) {
+        Scanner::setLevel(static_cast<ScanLevel>(level));
+        printf("Parser throughput, %lu-byte reads, %s scanning\n", static_cast<unsigned long>(read_size),
+               Scanner::levelName(Scanner::level()));
+        ok = run("GET, browser headers", browserRequest(), total, read_size)
+            && run("GET, 50 headers", manyHeadersRequest(), total, read_size)
+            && run("POST, 1 MB Content-Length body", contentLengthRequest(1024 * 1024), total, read_size)
+            && run("POST, 1 MB chunked, 4 KB chunks", chunkedRequest(1024 * 1024, 4096), total, read_size)
+            && run("POST, 1 MB chunked, 16-byte chunks", chunkedRequest(1024 * 1024, 16), total, read_size);
+    }
+    ok = ok && lookups(1000000);
+    return ok ? 0 : 1;
+}
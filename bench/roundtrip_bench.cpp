@@ -0,0 +1,214 @@
+// Request round-trip latency against a running server: N connections each
+// send a GET, wait for the whole response and send the next one. With
+// "close" every request gets a fresh connection (Connection: close) and the
+// connect is part of its time. Paired with the server's loop stats by
+// uring_benchmark.sh.
+//
+// usage: ./roundtrip_bench [connections] [requests] [port] [path] [keepalive|close]
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+struct Connection {
+    int fd;
+    std::string response;
+    size_t head_end;
+    size_t length;
+    bool closing;  // the server announced it closes after this response
+    double start;
+};
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void raiseFdLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+static int connectTo(const struct sockaddr_in& addr) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    if (connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Requests are a few dozen bytes: one send always takes them whole
+static bool sendRequest(Connection& conn, const std::string& request) {
+    conn.response.clear();
+    conn.head_end = std::string::npos;
+    conn.length = 0;
+    conn.closing = false;
+    return send(conn.fd, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size());
+}
+
+// Reads what is available; 1 once the response (head and Content-Length
+// body) is complete, 0 if more is to come, -1 on an error or early close
+static int readResponse(Connection& conn) {
+    char buffer[16384];
+
+    while (true) {
+        ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (n == 0) {
+            return -1;
+        }
+        if (n < 0) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        conn.response.append(buffer, n);
+        if (conn.head_end == std::string::npos
+            && (conn.head_end = conn.response.find("\r\n\r\n")) != std::string::npos) {
+            std::string head = conn.response.substr(0, conn.head_end);
+            for (size_t i = 0; i < head.size(); ++i) {
+                head[i] = static_cast<char>(tolower(head[i]));
+            }
+            size_t field = head.find("\r\ncontent-length:");
+            if (field != std::string::npos) {
+                conn.length = strtoul(head.c_str() + field + 17, NULL, 10);
+            }
+            conn.closing = head.find("\r\nconnection: close") != std::string::npos;
+        }
+        if (conn.head_end != std::string::npos && conn.response.size() >= conn.head_end + 4 + conn.length) {
+            return conn.response.compare(0, 12, "HTTP/1.1 200") == 0 ? 1 : -1;
+        }
+    }
+}
+
+static bool openConnection(int epfd, const struct sockaddr_in& addr, Connection& conn, size_t index) {
+    conn.fd = connectTo(addr);
+    if (conn.fd == -1) {
+        return false;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = index;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, conn.fd, &event) == 0;
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    size_t index = static_cast<size_t>(sorted.size() * p);
+    return sorted[index < sorted.size() ? index : sorted.size() - 1];
+}
+
+int main(int argc, char** argv) {
+    int connections = argc > 1 ? atoi(argv[1]) : 50;
+    int requests = argc > 2 ? atoi(argv[2]) : 50000;
+    int port = argc > 3 ? atoi(argv[3]) : 8080;
+    std::string path = argc > 4 ? argv[4] : "/";
+    bool keep_alive = argc <= 5 || std::strcmp(argv[5], "close") != 0;
+
+    if (connections <= 0 || requests < connections) {
+        fprintf(stderr, "need at least one connection and one request per connection\n");
+        return 1;
+    }
+    raiseFdLimit();
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n"
+                          + (keep_alive ? "" : "Connection: close\r\n") + "\r\n";
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<Connection> conns(connections);
+    std::vector<double> latencies;
+    latencies.reserve(requests);
+    int started = 0;
+    int failed = 0;
+    int active = 0;
+
+    double begin = nowSeconds();
+    for (int i = 0; i < connections; ++i) {
+        conns[i].start = nowSeconds();
+        if (!openConnection(epfd, addr, conns[i], i) || !sendRequest(conns[i], request)) {
+            fprintf(stderr, "connection %d: %s\n", i, strerror(errno));
+            return 1;
+        }
+        ++started;
+        ++active;
+    }
+
+    std::vector<struct epoll_event> events(connections);
+    while (active > 0) {
+        int ready = epoll_wait(epfd, &events[0], connections, 5000);
+        if (ready <= 0) {
+            fprintf(stderr, "no response for 5 s, %d request(s) left\n", active);
+            failed += active;
+            break;
+        }
+        for (int i = 0; i < ready; ++i) {
+            size_t index = events[i].data.u64;
+            Connection& conn = conns[index];
+            int state = readResponse(conn);
+            if (state == 0) {
+                continue;
+            }
+            if (state == 1) {
+                latencies.push_back((nowSeconds() - conn.start) * 1e6);
+            } else {
+                ++failed;
+            }
+            if (state == -1 || conn.closing) {
+                close(conn.fd);
+                conn.fd = -1;
+            }
+            if (started == requests) {
+                if (conn.fd != -1) {
+                    close(conn.fd);
+                }
+                --active;
+                continue;
+            }
+            ++started;
+            conn.start = nowSeconds();
+            if ((conn.fd == -1 && !openConnection(epfd, addr, conn, index)) || !sendRequest(conn, request)) {
+                ++failed;
+                --active;
+            }
+        }
+    }
+    double elapsed = nowSeconds() - begin;
+    close(epfd);
+
+    printf("%lu requests over %d %s connections, %d failed, %.0f requests/s\n",
+           static_cast<unsigned long>(latencies.size()), connections, keep_alive ? "keep-alive" : "one-shot", failed,
+           latencies.size() / elapsed);
+    if (latencies.empty()) {
+        return 1;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("p50 %8.1f us  p90 %8.1f us  p99 %8.1f us  max %8.1f us\n", percentile(latencies, 0.5),
+           percentile(latencies, 0.9), percentile(latencies, 0.99), latencies.back());
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,93 @@
+// Client table cost: with N connections held open, measures one connection
+// lifecycle as the event loop sees it (open, a lookup per event, release)
+// and a lookup alone, at 10k live connections by default.
+//
+// The table never touches a client's socket but to close it on release:
+// fd numbers are used without opening them, from a range checked to be
+// free, so close() only fails with EBADF. That syscall is part of the
+// lifecycle time, as it is in the server.
+//
+// usage: ./table_bench [live connections] [lifecycles] [events per lifecycle]
+
+#include "ClientTable.hpp"
+#include "Logger.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+static const int FIRST_FD = 64;
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The table is sized from the fd limit, raise it first
+static size_t raiseFdLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return 1024;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    return limit.rlim_cur;
+}
+
+int main(int argc, char** argv) {
+    int live = argc > 1 ? atoi(argv[1]) : 10000;
+    int lifecycles = argc > 2 ? atoi(argv[2]) : 1000000;
+    int events = argc > 3 ? atoi(argv[3]) : 4;
+    Logger::setLevel(WARNING);
+
+    size_t limit = raiseFdLimit();
+    if (static_cast<size_t>(FIRST_FD + live + 1) > limit) {
+        fprintf(stderr, "%d live connections need an fd limit above %d (have %lu)\n", live,
+                FIRST_FD + live + 1, static_cast<unsigned long>(limit));
+        return 1;
+    }
+    for (int fd = FIRST_FD; fd <= FIRST_FD + live; ++fd) {
+        if (fcntl(fd, F_GETFD) != -1) {
+            fprintf(stderr, "fd %d is open, the bench needs the range free\n", fd);
+            return 1;
+        }
+    }
+
+    ClientTable table;
+    for (int i = 0; i < live; ++i) {
+        table.open(FIRST_FD + i, NULL, NULL);
+    }
+
+    // Connections come and go on the fd past the live ones, while every
+    // live one stays in the table
+    int churn_fd = FIRST_FD + live;
+    unsigned long found = 0;
+    double start = nowSeconds();
+    for (int i = 0; i < lifecycles; ++i) {
+        table.open(churn_fd, NULL, NULL);
+        for (int j = 0; j < events; ++j) {
+            found += table.find(churn_fd) != NULL;
+        }
+        table.release(churn_fd);
+    }
+    double lifecycle = (nowSeconds() - start) / lifecycles;
+
+    // Lookups spread over the live connections, as ready events are
+    unsigned int index = 0;
+    int lookups = lifecycles * events;
+    start = nowSeconds();
+    for (int i = 0; i < lookups; ++i) {
+        index = index * 1103515245u + 12345u;
+        found += table.find(FIRST_FD + static_cast<int>(index % live)) != NULL;
+    }
+    double lookup = (nowSeconds() - start) / lookups;
+
+    printf("Client table, %d live connections, sizeof(Client) %lu, sizeof(ClientBuffers) %lu\n", live,
+           static_cast<unsigned long>(sizeof(Client)), static_cast<unsigned long>(sizeof(ClientBuffers)));
+    printf("open + %d lookups + release  %8.1f ns\n", events, lifecycle * 1e9);
+    printf("lookup                       %8.1f ns  (%lu found)\n", lookup * 1e9, found);
+    return 0;
+}
@@ -0,0 +1,138 @@
+#!/bin/bash
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+YELLOW='\033[1;33m'
+NC='\033[0m'
+
+PORT=8080
+HOST="127.0.0.1"
+URL_PATH="/"
+GETS=${1:-1000}
+GET_CONCURRENT=${2:-20}
+POSTS=${3:-80}
+POST_KB=${4:-300}
+POST_CONCURRENT=${5:-4}
+
+# Lance le serveur lui-meme, une fois en level-triggered et une fois en
+# edge-triggered: les compteurs viennent de la ligne "loop stats" que le
+# worker ecrit a l'arret
+CONFIG_FILE=$(mktemp)
+LOG_FILE=$(mktemp)
+trap 'rm -f "$CONFIG_FILE" "$LOG_FILE"' EXIT
+
+if [ ! -x ./webserv ]; then
+    echo -e "${RED}✗ ./webserv not found, run make first${NC}"
+    exit 1
+fi
+if [ -n "$(pgrep -x webserv)" ]; then
+    echo -e "${RED}✗ webserv is already running, stop it first${NC}"
+    exit 1
+fi
+
+# $1: on/off
+write_config() {
+    cat > "$CONFIG_FILE" <<EOF
+events {
+    edge_triggered $1;
+}
+
+server {
+    listen $PORT;
+    host $HOST;
+    client_max_body_size 52428800;
+
+    location / {
+        root ./static;
+        index index.html;
+        methods GET POST;
+    }
+}
+EOF
+}
+
+# Une requete par connexion, fermee par le serveur apres la reponse.
+# $1: GET/POST, $2: requetes, $3: connexions en parallele, $4: body (KB)
+load() {
+    python3 - "$HOST" "$PORT" "$URL_PATH" "$@" <<'PYTHON'
+import socket, sys, threading
+host, port, path, method = sys.argv[1], int(sys.argv[2]), sys.argv[3], sys.argv[4]
+count, concurrent, body_kb = int(sys.argv[5]), int(sys.argv[6]), int(sys.argv[7])
+if method == 'POST':
+    body = b'x' * (body_kb * 1024)
+    request = ('POST %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n'
+               'Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %d\r\n\r\n'
+               % (path, host, len(body))).encode() + body
+else:
+    request = ('GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n' % (path, host)).encode()
+failed = [0]
+lock = threading.Lock()
+def worker(n):
+    for i in range(n):
+        try:
+            s = socket.create_connection((host, port))
+            s.sendall(request)
+            response = b''
+            while True:
+                data = s.recv(65536)
+                if not data:
+                    break
+                response += data
+            s.close()
+            ok = response.startswith(b'HTTP/1.1 200')
+        except Exception:
+            ok = False
+        if not ok:
+            with lock:
+                failed[0] += 1
+threads = [threading.Thread(target=worker, args=(count // concurrent + (i < count % concurrent),))
+           for i in range(concurrent)]
+for t in threads:
+    t.start()
+for t in threads:
+    t.join()
+if failed[0]:
+    sys.stderr.write('%d request(s) did not get a 200\n' % failed[0])
+PYTHON
+}
+
+# $1: label, $2: on/off, remaining args: load()
+run_test() {
+    local label=$1
+    write_config "$2"
+    shift 2
+
+    ./webserv "$CONFIG_FILE" > "$LOG_FILE" 2>&1 &
+    local pid=$!
+    sleep 0.5
+    load "$@"
+    kill -INT $pid
+    wait $pid
+
+    local stats=$(sed 's/\x1b\[[0-9;]*m//g' "$LOG_FILE" | grep 'loop stats' | tail -1)
+    if [ -z "$stats" ]; then
+        echo -e "${RED}✗ no loop stats from the server (see its log)${NC}"
+        return
+    fi
+    echo "$stats" | awk -v l="$label" '{
+        for (i = 1; i <= NF; ++i) { split($i, kv, "="); v[kv[1]] = kv[2] }
+        r = v["requests"] ? v["requests"] : 1
+        printf "%-6s requests %5d  iterations %6d  events %6d  wait %6d  recv %6d  send %6d  (%.2f wakeups/request)\n",
+            l, v["requests"], v["iterations"], v["events"], v["wait"], v["recv"], v["send"], v["iterations"] / r
+    }'
+}
+
+echo -e "${YELLOW}=== Webserv Edge-Triggered Benchmark ===${NC}"
+echo "Target: http://$HOST:$PORT$URL_PATH"
+echo ""
+
+echo -e "${YELLOW}[1/2] $GETS GETs over $GET_CONCURRENT connections${NC}"
+run_test "level" off GET $GETS $GET_CONCURRENT 0
+run_test "edge" on GET $GETS $GET_CONCURRENT 0
+
+echo -e "${YELLOW}[2/2] $POSTS POSTs of ${POST_KB} KB over $POST_CONCURRENT connections${NC}"
+run_test "level" off POST $POSTS $POST_CONCURRENT $POST_KB
+run_test "edge" on POST $POSTS $POST_CONCURRENT $POST_KB
+
+echo ""
+echo -e "${GREEN}=== Benchmark completed ===${NC}"
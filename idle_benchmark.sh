@@ -0,0 +1,92 @@
+#!/bin/bash
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+YELLOW='\033[1;33m'
+NC='\033[0m'
+
+PORT=8080
+HOST="127.0.0.1"
+URL_PATH="/"
+CONNECTIONS=${1:-10000}
+
+# Le client a besoin d'un fd par connexion (le serveur aussi: lancer
+# webserv avec un ulimit -n suffisant)
+ulimit -n $((CONNECTIONS + 256)) 2>/dev/null || {
+    echo -e "${RED}✗ Cannot raise the fd limit to $((CONNECTIONS + 256))${NC}"
+    exit 1
+}
+
+# RSS (kB) de tous les process webserv
+server_rss() {
+    local total=0
+    for pid in $(pgrep -x webserv); do
+        total=$((total + $(awk '/^VmRSS:/ { print $2 }' /proc/$pid/status 2>/dev/null || echo 0)))
+    done
+    echo $total
+}
+
+echo -e "${YELLOW}=== Webserv Idle Keep-Alive Memory Benchmark ===${NC}"
+echo "Target: http://$HOST:$PORT$URL_PATH"
+echo "Idle keep-alive connections: $CONNECTIONS"
+echo ""
+
+if [ -z "$(pgrep -x webserv)" ]; then
+    echo -e "${RED}✗ webserv is not running${NC}"
+    exit 1
+fi
+
+RSS_BEFORE=$(server_rss)
+echo "Server RSS before: ${RSS_BEFORE} kB"
+
+# Chaque connexion fait une requete puis reste ouverte sans rien envoyer;
+# le RSS est mesure pendant que toutes sont inactives
+RSS_IDLE=$(python3 - "$HOST" "$PORT" "$URL_PATH" "$CONNECTIONS" $(pgrep -x webserv) <<'PYTHON'
+import socket, sys, time
+host, port, path, count = sys.argv[1], int(sys.argv[2]), sys.argv[3], int(sys.argv[4])
+pids = sys.argv[5:]
+request = ('GET %s HTTP/1.1\r\nHost: %s\r\n\r\n' % (path, host)).encode()
+conns = []
+for i in range(count):
+    s = socket.create_connection((host, port))
+    s.sendall(request)
+    conns.append(s)
+failed = 0
+for s in conns:
+    buf = b''
+    try:
+        while b'\r\n\r\n' not in buf:
+            data = s.recv(65536)
+            if not data:
+                raise Exception('closed')
+            buf += data
+        head, body = buf.split(b'\r\n\r\n', 1)
+        length = 0
+        for line in head.split(b'\r\n'):
+            if line.lower().startswith(b'content-length:'):
+                length = int(line.split(b':')[1])
+        while len(body) < length:
+            body += s.recv(65536)
+        if not head.startswith(b'HTTP/1.1 200'):
+            failed += 1
+    except Exception:
+        failed += 1
+sys.stderr.write('%d connections open, %d failed\n' % (count, failed))
+time.sleep(1)
+rss = 0
+for pid in pids:
+    for line in open('/proc/%s/status' % pid):
+        if line.startswith('VmRSS:'):
+            rss += int(line.split()[1])
+print(rss)
+for s in conns:
+    s.close()
+PYTHON
+)
+
+echo "Server RSS with idle connections: ${RSS_IDLE} kB"
+awk -v b=$RSS_BEFORE -v i=$RSS_IDLE -v n=$CONNECTIONS \
+    'BEGIN { printf "Per idle connection: %.0f bytes\n", (i - b) * 1024 / n }'
+
+echo ""
+echo -e "${GREEN}=== Benchmark completed ===${NC}"
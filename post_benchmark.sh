@@ -0,0 +1,75 @@
+#!/bin/bash
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+YELLOW='\033[1;33m'
+NC='\033[0m'
+
+PORT=8080
+HOST="localhost"
+URL_PATH="/"
+BODY_MB=${1:-8}
+REQUESTS=${2:-40}
+CONCURRENT=${3:-4}
+
+BODY_FILE=$(mktemp)
+CODES_FILE=$(mktemp)
+trap 'rm -f "$BODY_FILE" "$CODES_FILE"' EXIT
+# Un seul champ sans '=': le handler de formulaire ne renvoie presque rien,
+# le temps mesure est celui de la reception du body
+head -c $((BODY_MB * 1024 * 1024)) /dev/zero | tr '\0' 'x' > "$BODY_FILE"
+
+# Temps CPU (user + sys, en ticks) de tous les process webserv
+server_ticks() {
+    local total=0
+    for pid in $(pgrep -x webserv); do
+        total=$((total + $(awk '{ print $14 + $15 }' /proc/$pid/stat 2>/dev/null || echo 0)))
+    done
+    echo $total
+}
+
+# $1: label, remaining args: extra curl options
+run_test() {
+    local label=$1
+    shift
+    : > "$CODES_FILE"
+    local ticks_before=$(server_ticks)
+    local start=$(date +%s.%N)
+
+    for i in $(seq 1 $REQUESTS); do
+        curl -s -o /dev/null -w "%{http_code}\n" -H "Expect:" "$@" --data-binary @"$BODY_FILE" \
+            -H "Content-Type: application/x-www-form-urlencoded" http://$HOST:$PORT$URL_PATH >> "$CODES_FILE" &
+        if [ $((i % $CONCURRENT)) -eq 0 ]; then
+            wait
+        fi
+    done
+    wait
+
+    local end=$(date +%s.%N)
+    local ticks=$(( $(server_ticks) - ticks_before ))
+    awk -v mb=$((BODY_MB * REQUESTS)) -v s=$start -v e=$end -v t=$ticks -v hz=$(getconf CLK_TCK) -v l="$label" \
+        'BEGIN { printf "%-16s %6.2fs  %8.1f MB/s  server cpu %.2fs (%.2f ms/MB)\n", l, e - s, mb / (e - s), t / hz, t / hz * 1000 / mb }'
+    local failed=$(grep -vc '^200$' "$CODES_FILE")
+    if [ "$failed" -ne 0 ]; then
+        echo -e "${RED}✗ $failed request(s) did not get a 200${NC}"
+    fi
+}
+
+echo -e "${YELLOW}=== Webserv POST Benchmark ===${NC}"
+echo "Target: http://$HOST:$PORT$URL_PATH"
+echo "Body size: ${BODY_MB} MB, requests: $REQUESTS, concurrent: $CONCURRENT"
+echo ""
+
+if [ -z "$(pgrep -x webserv)" ]; then
+    echo -e "${RED}✗ webserv is not running${NC}"
+    exit 1
+fi
+
+echo -e "${YELLOW}[1/2] Content-Length${NC}"
+run_test "content-length"
+
+echo -e "${YELLOW}[2/2] Chunked${NC}"
+run_test "chunked" -H "Transfer-Encoding: chunked"
+
+echo ""
+echo -e "${GREEN}=== Benchmark completed ===${NC}"
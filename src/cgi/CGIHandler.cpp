@@ -10,6 +10,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/select.h>
+#include <csignal>
 
 
 CGIHandler::CGIHandler(const HTTPRequest& request, const LocationConfig& location, const std::string& scriptPath)
@@ -51,13 +52,13 @@ void CGIHandler::setupEnvironment() {
     _env["SCRIPT_NAME"] = getScriptFilename();
     _env["PATH_INFO"] = getPathInfo();
     _env["QUERY_STRING"] = _request->getQueryString();
-    _env["CONTENT_LENGTH"] = Utils::intToString(_request->getContentLength());
-    _env["CONTENT_TYPE"] = _request->getHeader("content-type");
+    _env["CONTENT_LENGTH"] = Utils::intToString(_request->getBodyLength());
+    _env["CONTENT_TYPE"] = _request->getHeader(HEADER_CONTENT_TYPE);
     
     // Server variables
     _env["SERVER_SOFTWARE"] = "Webserv/1.0";
     _env["GATEWAY_INTERFACE"] = "CGI/1.1";
-    _env["SERVER_NAME"] = _request->getHeader("host");
+    _env["SERVER_NAME"] = _request->getHeader(HEADER_HOST);
     _env["REDIRECT_STATUS"] = "200";
     
     // HTTP headers as CGI variables
@@ -98,15 +99,47 @@ bool CGIHandler::executeCGI(std::string& output) {
     int pipeIn[2];
     int pipeOut[2];
     
-    if (pipe(pipeIn) < 0 || pipe(pipeOut) < 0) {
+    // Close-on-exec: another thread's CGI, or an upgraded binary, must not
+    // inherit these ends, or the EOFs never come. dup2() clears the flag on
+    // the script's stdin and stdout.
+    if (pipe2(pipeIn, O_CLOEXEC) < 0) {
         Logger::error("Failed to create pipes");
         return false;
     }
+    if (pipe2(pipeOut, O_CLOEXEC) < 0) {
+        Logger::error("Failed to create pipes");
+        close(pipeIn[0]);
+        close(pipeIn[1]);
+        return false;
+    }
+
+    // A body received into a temp file is the script's stdin as is, read
+    // from the start; one in memory goes through the pipe
+    int bodyFd = _request->getBodyFd();
+    if (bodyFd != -1 && lseek(bodyFd, 0, SEEK_SET) < 0) {
+        Logger::error("Failed to rewind request body file");
+        close(pipeIn[0]);
+        close(pipeIn[1]);
+        close(pipeOut[0]);
+        close(pipeOut[1]);
+        return false;
+    }
+    
+    // Everything the child needs is built before fork(): with several worker
+    // threads, another one may hold the malloc or a stream lock at that
+    // moment, and the child would deadlock on it. The child only makes
+    // async-signal-safe calls.
+    char* argv[3];  // Programme + script + NULL
+    argv[0] = const_cast<char*>(_location->cgi_path.c_str());
+    argv[1] = const_cast<char*>(_scriptPath.c_str());
+    argv[2] = NULL;
+    char** env = createEnvArray();
     
     pid_t pid = fork();
     
     if (pid < 0) {
         Logger::error("Fork failed");
+        freeEnvArray(env);
         close(pipeIn[0]);
         close(pipeIn[1]);
         close(pipeOut[0]);
@@ -115,40 +148,32 @@ bool CGIHandler::executeCGI(std::string& output) {
     }
     
     if (pid == 0) {
-        // Child process
-        close(pipeIn[1]);
-        close(pipeOut[0]);
-
-        // Redirect stdin/stdout
-        dup2(pipeIn[0], STDIN_FILENO);
+        // Child process: redirect stdin/stdout, the pipe ends themselves
+        // are closed by execve (close-on-exec)
+        dup2(bodyFd != -1 ? bodyFd : pipeIn[0], STDIN_FILENO);
         dup2(pipeOut[1], STDOUT_FILENO);
 
-        close(pipeIn[0]);
-        close(pipeOut[1]);
-
-        // Prepare arguments
-        char* argv[3];  // Programme + script + NULL
-        argv[0] = const_cast<char*>(_location->cgi_path.c_str());
-        argv[1] = const_cast<char*>(_scriptPath.c_str());
-        argv[2] = NULL;
-
-        // Prepare environment
-        char** env = createEnvArray();
+        // Worker threads run with the supervisor's signals blocked, and an
+        // ignored SIGPIPE: both survive execve, the script gets the defaults
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        signal(SIGPIPE, SIG_DFL);
 
         // Execute CGI
-        execve(_location->cgi_path.c_str(), argv, env);
+        execve(argv[0], argv, env);
 
-        // If execve returns, it failed
-        Logger::error("execve failed");
-        exit(1);
+        // If execve returns, it failed: the parent sees the exit status
+        _exit(127);
     }   
     
     // Parent process
+    freeEnvArray(env);
     close(pipeIn[0]);
     close(pipeOut[1]);
     
     // Send request body to CGI
-    if (_request->getContentLength() > 0) {
+    if (bodyFd == -1 && !_request->getBody().empty()) {
         const std::string& body = _request->getBody();
         write(pipeIn[1], body.c_str(), body.length());
     }
@@ -158,8 +183,10 @@ bool CGIHandler::executeCGI(std::string& output) {
 
     fcntl(pipeOut[0], F_SETFL, O_NONBLOCK);
 
-    // Read CGI output avec timeout
-    char buffer[8192];
+    // Read CGI output avec timeout, directement a la fin de output: elle
+    // devient le body de la reponse, sans copie ni buffer du pool
+    const size_t chunk = 16384;
+    size_t used = 0;
     time_t start = time(NULL);
     int timeout_seconds = 5;
     bool timeout_occurred = false;
@@ -174,12 +201,13 @@ bool CGIHandler::executeCGI(std::string& output) {
         }
 
         // Essaie de lire
-        ssize_t bytesRead = read(pipeOut[0], buffer, sizeof(buffer));
+        output.resize(used + chunk);
+        ssize_t bytesRead = read(pipeOut[0], &output[used], chunk);
 
         
         // remove errno checks and replace them
         if (bytesRead > 0) {
-            output.append(buffer, bytesRead);
+            used += bytesRead;
             Logger::debug("Read " + Utils::intToString(bytesRead) + " bytes from CGI");
         } else if (bytesRead == 0) {
             // EOF - process termine
@@ -201,6 +229,7 @@ bool CGIHandler::executeCGI(std::string& output) {
     }
 
     close(pipeOut[0]);
+    output.resize(used);
 
     if (timeout_occurred) {
         waitpid(pid, NULL, 0);
@@ -220,18 +249,23 @@ bool CGIHandler::executeCGI(std::string& output) {
         return true;
     }
     
-    Logger::error("CGI exited with error");
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+        Logger::error("CGI could not be executed: " + _location->cgi_path);
+    } else {
+        Logger::error("CGI exited with error");
+    }
     return false;
 }
 
-bool CGIHandler::parseCGIOutput(const std::string& output, HTTPResponse& response) {
+// Takes output over as the response body
+bool CGIHandler::parseCGIOutput(std::string& output, HTTPResponse& response) {
     // Find headers/body separator
     size_t headerEnd = output.find("\r\n\r\n");
     if (headerEnd == std::string::npos) {
         headerEnd = output.find("\n\n");
         if (headerEnd == std::string::npos) {
             // No headers, treat all as body
-            response.setBody(output);
+            response.swapBody(output);
             response.setStatusCode(200);
             return true;
         }
@@ -263,8 +297,8 @@ bool CGIHandler::parseCGIOutput(const std::string& output, HTTPResponse& respons
     }
     
     // Set body
-    std::string body = output.substr(headerEnd);
-    response.setBody(body);
+    output.erase(0, headerEnd);
+    response.swapBody(output);
     
     // Default status if not set
     if (response.getStatusCode() == 200 && !response.hasHeader("Status")) {
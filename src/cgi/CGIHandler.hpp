@@ -31,7 +31,7 @@ private:
     bool executeCGI(std::string& output);
     
     // Parse CGI output
-    bool parseCGIOutput(const std::string& output, HTTPResponse& response);
+    bool parseCGIOutput(std::string& output, HTTPResponse& response);
     
     // Utils
     std::string getScriptFilename() const;
@@ -4,20 +4,37 @@
 #include <fstream>
 #include <sstream>
  #include <cstdlib>
+#include <climits>
 
-Config::Config() {
+EventsConfig::EventsConfig() : edgeTriggered(false), workerThreads(1), workerProcesses(0), acceptBudget(64),
+    workerConnections(0), maxConnections(0), backend("epoll"), drainTimeout(30), hugePages(false),
+    ioBufferLimit(DEFAULT_IO_BUFFER_LIMIT) {
 }
 
-Config::Config(const std::string& configFile) : _configFile(configFile) {
+Config::Config() : _refs(1) {
+}
+
+Config::Config(const std::string& configFile) : _configFile(configFile), _refs(1) {
     parseFile(configFile);
 }
 
 Config::~Config() {
 }
 
+void Config::retain() {
+    __atomic_add_fetch(&_refs, 1, __ATOMIC_RELAXED);
+}
+
+void Config::release() {
+    if (__atomic_sub_fetch(&_refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        delete this;
+    }
+}
+
 bool Config::parseFile(const std::string& configFile) {
     _configFile = configFile;
     _servers.clear();
+    _events = EventsConfig();
 
     if (!Utils::fileExists(configFile)) {
         Logger::error("Config file not found: " + configFile);
@@ -42,9 +59,16 @@ bool Config::parseFile(const std::string& configFile) {
         }
     }
 
-    // Parse server blocks
+    // Parse server and events blocks
     for (size_t i = 0; i < cleanLines.size(); ++i) {
-        if (isBlockStart(cleanLines[i], "server")) {
+        if (isBlockStart(cleanLines[i], "events")) {
+            ++i; // Skip opening brace
+            if (!parseEventsBlock(cleanLines, i)) {
+                Logger::error("Failed to parse events block");
+                return false;
+            }
+        }
+        else if (isBlockStart(cleanLines[i], "server")) {
             ServerConfig server;
             ++i; // Skip opening brace
             if (parseServerBlock(cleanLines, i, server)) {
@@ -81,7 +105,15 @@ bool Config::parseServerBlock(const std::vector<std::string>& lines, size_t& ind
             return true;
         }
         
-        if (Utils::startsWith(line, "listen")) {
+        // Before "listen", which is a prefix of it
+        if (Utils::startsWith(line, "listen_backlog")) {
+            int backlog;
+            if (!parseCount(line, 1, 65535, backlog)) {
+                return false;
+            }
+            server.setListenBacklog(backlog);
+        }
+        else if (Utils::startsWith(line, "listen")) {
             int port = Utils::stringToInt(extractValue(line));
             if (port > 0 && port <= 65535) {
                 server.setPort(port);
@@ -93,6 +125,51 @@ bool Config::parseServerBlock(const std::vector<std::string>& lines, size_t& ind
         else if (Utils::startsWith(line, "server_name")) {
             server.setServerName(extractValue(line));
         }
+        else if (Utils::startsWith(line, "keepalive_timeout")) {
+            int seconds;
+            if (!parseCount(line, 0, 3600, seconds)) {
+                return false;
+            }
+            server.setKeepaliveTimeout(seconds);
+        }
+        else if (Utils::startsWith(line, "keepalive_requests")) {
+            int requests;
+            if (!parseCount(line, 1, 1000000, requests)) {
+                return false;
+            }
+            server.setKeepaliveRequests(requests);
+        }
+        else if (Utils::startsWith(line, "tcp_nodelay")) {
+            server.getSocketOptions().tcpNodelay = parseFlag(line);
+        }
+        else if (Utils::startsWith(line, "tcp_quickack")) {
+            server.getSocketOptions().tcpQuickAck = parseFlag(line);
+        }
+        else if (Utils::startsWith(line, "tcp_defer_accept")) {
+            if (!parseCount(line, 0, 3600, server.getSocketOptions().tcpDeferAccept)) {
+                return false;
+            }
+        }
+        else if (Utils::startsWith(line, "tcp_fastopen")) {
+            if (!parseCount(line, 0, 65535, server.getSocketOptions().tcpFastOpen)) {
+                return false;
+            }
+        }
+        else if (Utils::startsWith(line, "so_rcvbuf")) {
+            if (!parseCount(line, 0, MAX_SOCKET_BUFFER, server.getSocketOptions().rcvBuf)) {
+                return false;
+            }
+        }
+        else if (Utils::startsWith(line, "so_sndbuf")) {
+            if (!parseCount(line, 0, MAX_SOCKET_BUFFER, server.getSocketOptions().sndBuf)) {
+                return false;
+            }
+        }
+        else if (Utils::startsWith(line, "so_busy_poll")) {
+            if (!parseCount(line, 0, 1000000, server.getSocketOptions().busyPoll)) {
+                return false;
+            }
+        }
         else if (Utils::startsWith(line, "client_max_body_size")) {
             std::string value = extractValue(line);
             size_t size;
@@ -108,6 +185,13 @@ bool Config::parseServerBlock(const std::vector<std::string>& lines, size_t& ind
             server.setClientMaxBodySize(size);
             Logger::debug("Set max body size to: " + Utils::intToString(size) + " bytes");
         }
+        else if (Utils::startsWith(line, "client_body_buffer_size")) {
+            size_t size;
+            if (!parseSize(line, size)) {
+                return false;
+            }
+            server.setClientBodyBufferSize(size);
+        }
         // else if (Utils::startsWith(line, "client_max_body_size")) {
         //     std::string value = extractValue(line);
         //     size_t size = Utils::stringToInt(value);
@@ -158,8 +242,7 @@ bool Config::parseLocationBlock(const std::vector<std::string>& lines, size_t& i
             location.uploadPath = extractValue(line);
         }
         else if (Utils::startsWith(line, "autoindex")) {
-            std::string value = Utils::toLowerCase(extractValue(line));
-            location.autoindex = (value == "on" || value == "true" || value == "yes");
+            location.autoindex = parseFlag(line);
         }
         else if (Utils::startsWith(line, "cgi_extension")) {
             location.cgi_extension = extractValue(line);
@@ -179,6 +262,107 @@ bool Config::parseLocationBlock(const std::vector<std::string>& lines, size_t& i
     return false;
 }
 
+bool Config::parseEventsBlock(const std::vector<std::string>& lines, size_t& index) {
+    while (index < lines.size()) {
+        std::string line = Utils::trim(lines[index]);
+
+        if (isBlockEnd(line)) {
+            return true;
+        }
+
+        if (Utils::startsWith(line, "edge_triggered")) {
+            _events.edgeTriggered = parseFlag(line);
+        }
+        else if (Utils::startsWith(line, "worker_threads")) {
+            if (!parseCount(line, 1, EventsConfig::MAX_WORKER_THREADS, _events.workerThreads)) {
+                return false;
+            }
+        }
+        else if (Utils::startsWith(line, "worker_processes")) {
+            if (!parseCount(line, 0, EventsConfig::MAX_WORKER_PROCESSES, _events.workerProcesses)) {
+                return false;
+            }
+        }
+        else if (Utils::startsWith(line, "accept_budget")) {
+            if (!parseCount(line, 1, EventsConfig::MAX_ACCEPT_BUDGET, _events.acceptBudget)) {
+                return false;
+            }
+        }
+        else if (Utils::startsWith(line, "worker_connections")) {
+            if (!parseCount(line, 0, EventsConfig::MAX_CONNECTIONS, _events.workerConnections)) {
+                return false;
+            }
+        }
+        else if (Utils::startsWith(line, "max_connections")) {
+            if (!parseCount(line, 0, EventsConfig::MAX_CONNECTIONS, _events.maxConnections)) {
+                return false;
+            }
+        }
+        else if (Utils::startsWith(line, "backend")) {
+            _events.backend = Utils::toLowerCase(extractValue(line));
+            if (_events.backend != "epoll" && _events.backend != "io_uring") {
+                Logger::error("Invalid value for directive: " + line);
+                return false;
+            }
+        }
+        else if (Utils::startsWith(line, "drain_timeout")) {
+            if (!parseCount(line, 0, EventsConfig::MAX_DRAIN_TIMEOUT, _events.drainTimeout)) {
+                return false;
+            }
+        }
+        else if (Utils::startsWith(line, "huge_pages")) {
+            _events.hugePages = parseFlag(line);
+        }
+        else if (Utils::startsWith(line, "io_buffer_limit")) {
+            if (!parseSize(line, _events.ioBufferLimit)) {
+                return false;
+            }
+        }
+
+        ++index;
+    }
+    return false;
+}
+
+// Byte count, optionally suffixed with k or m
+bool Config::parseSize(const std::string& line, size_t& out) {
+    std::string value = extractValue(line);
+    char* end = NULL;
+    long n = std::strtol(value.c_str(), &end, 10);
+    size_t unit = 1;
+    if (*end == 'k' || *end == 'K') {
+        unit = 1024;
+        ++end;
+    } else if (*end == 'm' || *end == 'M') {
+        unit = 1024 * 1024;
+        ++end;
+    }
+    if (value.empty() || end == value.c_str() || *end != '\0' || n < 0 || n > LONG_MAX / static_cast<long>(unit)) {
+        Logger::error("Invalid value for directive: " + line);
+        return false;
+    }
+    out = static_cast<size_t>(n) * unit;
+    return true;
+}
+
+bool Config::parseFlag(const std::string& line) {
+    std::string value = Utils::toLowerCase(extractValue(line));
+    return value == "on" || value == "true" || value == "yes";
+}
+
+// Integer directive value within [min, max]
+bool Config::parseCount(const std::string& line, int min, int max, int& out) {
+    std::string value = extractValue(line);
+    char* end = NULL;
+    long n = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || n < min || n > max) {
+        Logger::error("Invalid value for directive: " + line);
+        return false;
+    }
+    out = static_cast<int>(n);
+    return true;
+}
+
 std::string Config::extractValue(const std::string& line) {
     size_t pos = line.find_first_of(" \t");
     if (pos == std::string::npos) return "";
@@ -212,6 +396,14 @@ const std::vector<ServerConfig>& Config::getServers() const {
     return _servers;
 }
 
+const EventsConfig& Config::getEvents() const {
+    return _events;
+}
+
+const std::string& Config::getConfigFile() const {
+    return _configFile;
+}
+
 ServerConfig* Config::getServerByPort(int port) {
     for (size_t i = 0; i < _servers.size(); ++i) {
         if (_servers[i].getPort() == port) {
@@ -221,6 +413,15 @@ ServerConfig* Config::getServerByPort(int port) {
     return NULL;
 }
 
+const ServerConfig* Config::getServerByPort(int port) const {
+    for (size_t i = 0; i < _servers.size(); ++i) {
+        if (_servers[i].getPort() == port) {
+            return &_servers[i];
+        }
+    }
+    return NULL;
+}
+
 const ServerConfig* Config::getServerByHostPort(const std::string& host, int port) const {
     for (size_t i = 0; i < _servers.size(); ++i) {
         if (_servers[i].getHost() == host && _servers[i].getPort() == port) {
@@ -238,8 +439,3 @@ size_t Config::getServerCount() const {
     return _servers.size();
 }
 
-
-bool Config::parseNginx(const std::string& configFile)
-{
-    return parseFile(configFile);
-}
@@ -4,25 +4,60 @@
 #include <vector>
 #include "ServerConfig.hpp"
 
+// Process-wide event loop settings (the top-level "events { }" block)
+struct EventsConfig {
+    bool edgeTriggered;     // register sockets with EPOLLET and drain them
+    int workerThreads;      // independent event loops, one per thread
+    int workerProcesses;    // 0: serve from this process, N: master + N forked workers
+    int acceptBudget;       // connections accepted per listen socket wakeup
+    int workerConnections;  // per event loop: stop accepting at this many clients, 0: no limit
+    int maxConnections;     // per process: answer 503 and close above this many, 0: no limit
+    std::string backend;    // "epoll" or "io_uring"
+    int drainTimeout;       // seconds given to connections in progress on shutdown, 0: close at once
+    bool hugePages;         // back the I/O buffer pool with huge pages (MAP_HUGETLB)
+    size_t ioBufferLimit;   // bytes the I/O buffer pool may map per process, 0: no limit
+
+    static const int MAX_WORKER_THREADS = 64;
+    static const int MAX_WORKER_PROCESSES = 64;
+    static const int MAX_ACCEPT_BUDGET = 65536;
+    static const int MAX_CONNECTIONS = 1000000;
+    static const int MAX_DRAIN_TIMEOUT = 3600;
+    static const size_t DEFAULT_IO_BUFFER_LIMIT = 256 * 1024 * 1024;
+
+    EventsConfig();
+};
+
+// Once parsed a Config is never modified: a reload parses a new one and the
+// event loops switch to it. Reference counted, so the previous snapshot stays
+// alive until the last request started under it is answered.
 class Config {
 private:
     std::vector<ServerConfig> _servers;
+    EventsConfig _events;
     std::string _configFile;
+    int _refs;
+
+    static const int MAX_SOCKET_BUFFER = 64 * 1024 * 1024;
 
 public:
     Config();
     Config(const std::string& configFile);
     ~Config();
 
+    // Shared ownership across threads; the creator holds the first reference
+    // and the last release() deletes the snapshot
+    void retain();
+    void release();
+
     // Parse config
     bool parseFile(const std::string& configFile);
-    
-    // methods for different formats
-    bool parseNginx(const std::string& configFile);
 
     // Getters
     const std::vector<ServerConfig>& getServers() const;
+    const EventsConfig& getEvents() const;
+    const std::string& getConfigFile() const;
     ServerConfig* getServerByPort(int port);
+    const ServerConfig* getServerByPort(int port) const;
     const ServerConfig* getServerByHostPort(const std::string& host, int port) const;
 
     // Utils
@@ -30,9 +65,16 @@ public:
     size_t getServerCount() const;
 
 private:
+    Config(const Config&);
+    Config& operator=(const Config&);
+
     // Nginx parsing
     bool parseServerBlock(const std::vector<std::string>& lines, size_t& index, ServerConfig& server);
     bool parseLocationBlock(const std::vector<std::string>& lines, size_t& index, LocationConfig& location);
+    bool parseEventsBlock(const std::vector<std::string>& lines, size_t& index);
+    bool parseFlag(const std::string& line);
+    bool parseCount(const std::string& line, int min, int max, int& out);
+    bool parseSize(const std::string& line, size_t& out);
     std::string extractValue(const std::string& line);
     std::vector<std::string> extractMethods(const std::string& line);
     bool isBlockStart(const std::string& line, const std::string& blockType);
@@ -6,7 +6,13 @@ LocationConfig::LocationConfig()
     : autoindex(false), cgi_enabled(false) {
 }
 
-ServerConfig::ServerConfig() : _port(8080), _host("127.0.0.1"), _serverName("localhost"), _clientMaxBodySize(1048576) {
+SocketOptions::SocketOptions()
+    : tcpNodelay(false), tcpDeferAccept(0), tcpFastOpen(0), rcvBuf(0), sndBuf(0), busyPoll(0),
+      tcpQuickAck(false) {
+}
+
+ServerConfig::ServerConfig() : _port(8080), _host("127.0.0.1"), _serverName("localhost"), _clientMaxBodySize(DEFAULT_MAX_BODY_SIZE),
+    _clientBodyBufferSize(DEFAULT_BODY_BUFFER_SIZE), _keepaliveTimeout(75), _keepaliveRequests(1000), _listenBacklog(511) {
     // Default error pages
     _errorPages[404] = "./errors/404.html";
     _errorPages[500] = "./errors/500.html";
@@ -32,6 +38,30 @@ size_t ServerConfig::getClientMaxBodySize() const {
     return _clientMaxBodySize;
 }
 
+size_t ServerConfig::getClientBodyBufferSize() const {
+    return _clientBodyBufferSize;
+}
+
+int ServerConfig::getKeepaliveTimeout() const {
+    return _keepaliveTimeout;
+}
+
+int ServerConfig::getKeepaliveRequests() const {
+    return _keepaliveRequests;
+}
+
+int ServerConfig::getListenBacklog() const {
+    return _listenBacklog;
+}
+
+const SocketOptions& ServerConfig::getSocketOptions() const {
+    return _socketOptions;
+}
+
+SocketOptions& ServerConfig::getSocketOptions() {
+    return _socketOptions;
+}
+
 const std::vector<LocationConfig>& ServerConfig::getLocations() const {
     return _locations;
 }
@@ -59,6 +89,22 @@ void ServerConfig::setClientMaxBodySize(size_t size) {
     _clientMaxBodySize = size;
 }
 
+void ServerConfig::setClientBodyBufferSize(size_t size) {
+    _clientBodyBufferSize = size;
+}
+
+void ServerConfig::setKeepaliveTimeout(int seconds) {
+    _keepaliveTimeout = seconds;
+}
+
+void ServerConfig::setKeepaliveRequests(int requests) {
+    _keepaliveRequests = requests;
+}
+
+void ServerConfig::setListenBacklog(int backlog) {
+    _listenBacklog = backlog;
+}
+
 void ServerConfig::addLocation(const LocationConfig& location) {
     _locations.push_back(location);
 }
@@ -20,12 +20,35 @@ struct LocationConfig {
     LocationConfig();
 };
 
+// Socket options from the server block, 0/false leaves the kernel default.
+// All but quickAck are set on the listen socket and inherited by accepted ones.
+struct SocketOptions {
+    bool tcpNodelay;
+    int tcpDeferAccept;     // seconds the kernel holds a connection until data arrives
+    int tcpFastOpen;        // pending TFO requests queue length
+    int rcvBuf;             // bytes
+    int sndBuf;             // bytes
+    int busyPoll;           // microseconds
+    bool tcpQuickAck;       // not inherited (and not sticky): set on every accepted socket
+
+    SocketOptions();
+};
+
 class ServerConfig {
+public:
+    static const size_t DEFAULT_BODY_BUFFER_SIZE = 16384;
+    static const size_t DEFAULT_MAX_BODY_SIZE = 1048576;
+
 private:
     int _port;
     std::string _host;
     std::string _serverName;
     size_t _clientMaxBodySize;
+    size_t _clientBodyBufferSize;   // bodies above it are received into a temp file
+    int _keepaliveTimeout;      // seconds, 0 disables persistent connections
+    int _keepaliveRequests;     // requests served before the connection is closed
+    int _listenBacklog;         // accept queue length passed to listen(), capped by net.core.somaxconn
+    SocketOptions _socketOptions;
     std::map<int, std::string> _errorPages;
     std::vector<LocationConfig> _locations;
 
@@ -38,6 +61,12 @@ public:
     const std::string& getHost() const;
     const std::string& getServerName() const;
     size_t getClientMaxBodySize() const;
+    size_t getClientBodyBufferSize() const;
+    int getKeepaliveTimeout() const;
+    int getKeepaliveRequests() const;
+    int getListenBacklog() const;
+    const SocketOptions& getSocketOptions() const;
+    SocketOptions& getSocketOptions();
     const std::vector<LocationConfig>& getLocations() const;
     std::string getErrorPage(int errorCode) const;
     
@@ -46,6 +75,10 @@ public:
     void setHost(const std::string& host);
     void setServerName(const std::string& serverName);
     void setClientMaxBodySize(size_t size);
+    void setClientBodyBufferSize(size_t size);
+    void setKeepaliveTimeout(int seconds);
+    void setKeepaliveRequests(int requests);
+    void setListenBacklog(int backlog);
     void addLocation(const LocationConfig& location);
     void addErrorPage(int errorCode, const std::string& path);
     
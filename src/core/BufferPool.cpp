@@ -0,0 +1,172 @@
+#include "BufferPool.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+#include <sys/mman.h>
+
+// One mapping and the descriptors of its buffers
+struct BufferSlab {
+    char* memory;
+    BufferSegment* segments;
+    size_t free;            // buffers of this slab on the pool's free list
+};
+
+pthread_mutex_t BufferPool::_lock = PTHREAD_MUTEX_INITIALIZER;
+BufferSegment* BufferPool::_free = NULL;
+size_t BufferPool::_free_count = 0;
+size_t BufferPool::_allocated = 0;
+size_t BufferPool::_max_slabs = 0;
+bool BufferPool::_huge_pages = false;
+bool BufferPool::_limit_logged = false;
+
+void BufferPool::setHugePages(bool enabled) {
+    pthread_mutex_lock(&_lock);
+    _huge_pages = enabled;
+    pthread_mutex_unlock(&_lock);
+}
+
+void BufferPool::setLimit(size_t bytes) {
+    pthread_mutex_lock(&_lock);
+    _max_slabs = bytes ? bytes / SLAB_SIZE : 0;
+    if (bytes && !_max_slabs) {
+        _max_slabs = 1;
+    }
+    _limit_logged = false;
+    pthread_mutex_unlock(&_lock);
+}
+
+// Called with the lock held. Pages are only touched when a buffer is first
+// written, a slab costs address space until then.
+bool BufferPool::grow() {
+    if (_max_slabs && _allocated / BUFFERS_PER_SLAB >= _max_slabs) {
+        if (!_limit_logged) {
+            Logger::warning("I/O buffer pool limit reached (" + Utils::intToString(_max_slabs * SLAB_SIZE / (1024 * 1024))
+                            + " MB), reads wait for buffers to come back");
+            _limit_logged = true;
+        }
+        return false;
+    }
+
+    void* slab = MAP_FAILED;
+    if (_huge_pages) {
+        slab = mmap(NULL, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (slab == MAP_FAILED) {
+            Logger::warning("No huge page available for I/O buffers, using normal pages");
+            _huge_pages = false;
+        }
+    }
+    if (slab == MAP_FAILED) {
+        slab = mmap(NULL, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (slab == MAP_FAILED) {
+        Logger::error("Cannot map I/O buffers");
+        return false;
+    }
+
+    BufferSlab* owner = new BufferSlab;
+    BufferSegment* segments = new BufferSegment[BUFFERS_PER_SLAB];
+    owner->memory = static_cast<char*>(slab);
+    owner->segments = segments;
+    owner->free = BUFFERS_PER_SLAB;
+    for (size_t i = 0; i < BUFFERS_PER_SLAB; ++i) {
+        segments[i].data = owner->memory + i * BufferSegment::SIZE;
+        segments[i].slab = owner;
+        segments[i].next = i + 1 < BUFFERS_PER_SLAB ? &segments[i + 1] : _free;
+    }
+    _free = segments;
+    _free_count += BUFFERS_PER_SLAB;
+    _allocated += BUFFERS_PER_SLAB;
+    Logger::debug("I/O buffer pool grown to " + Utils::intToString(_allocated) + " buffers");
+    return true;
+}
+
+// Called with the lock held, for a slab whose buffers are all free: they
+// leave the free list and the slab is unmapped
+void BufferPool::shrink(BufferSlab* slab) {
+    BufferSegment** link = &_free;
+    while (*link) {
+        if ((*link)->slab == slab) {
+            *link = (*link)->next;
+        } else {
+            link = &(*link)->next;
+        }
+    }
+    _free_count -= BUFFERS_PER_SLAB;
+    _allocated -= BUFFERS_PER_SLAB;
+    munmap(slab->memory, SLAB_SIZE);
+    delete[] slab->segments;
+    delete slab;
+    _limit_logged = false;
+    Logger::debug("I/O buffer pool shrunk to " + Utils::intToString(_allocated) + " buffers");
+}
+
+BufferSegment* BufferPool::get() {
+    BufferSegment* segment = NULL;
+    return take(segment, 1) ? segment : NULL;
+}
+
+void BufferPool::put(BufferSegment* segment) {
+    segment->next = NULL;
+    give(segment, 1);
+}
+
+size_t BufferPool::take(BufferSegment*& list, size_t count) {
+    size_t taken = 0;
+
+    pthread_mutex_lock(&_lock);
+    while (taken < count) {
+        if (!_free && !grow()) {
+            break;
+        }
+        BufferSegment* segment = _free;
+        _free = segment->next;
+        --_free_count;
+        --segment->slab->free;
+        segment->next = list;
+        segment->start = 0;
+        segment->end = 0;
+        list = segment;
+        ++taken;
+    }
+    pthread_mutex_unlock(&_lock);
+    return taken;
+}
+
+// A slab this makes entirely free is unmapped if another slab's worth of
+// buffers stays free, so a burst does not leave its memory behind and a
+// steady load does not map and unmap the same slab over and over
+void BufferPool::give(BufferSegment* list, size_t count) {
+    if (!list) {
+        return;
+    }
+
+    pthread_mutex_lock(&_lock);
+    BufferSegment* last = list;
+    BufferSlab* emptied = NULL;
+    for (BufferSegment* segment = list; segment; segment = segment->next) {
+        if (++segment->slab->free == BUFFERS_PER_SLAB) {
+            emptied = segment->slab;
+        }
+        last = segment;
+    }
+    last->next = _free;
+    _free = list;
+    _free_count += count;
+    if (emptied && _free_count >= 2 * BUFFERS_PER_SLAB) {
+        shrink(emptied);
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+size_t BufferPool::allocated() {
+    pthread_mutex_lock(&_lock);
+    size_t count = _allocated;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+size_t BufferPool::available() {
+    pthread_mutex_lock(&_lock);
+    size_t count = _free_count;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
@@ -0,0 +1,68 @@
+#ifndef BUFFERPOOL_HPP
+#define BUFFERPOOL_HPP
+
+#include <cstddef>
+#include <pthread.h>
+
+struct BufferSlab;
+
+// One fixed-size I/O buffer; bytes [start, end) of data are unread. The
+// descriptor lives apart from the memory it points to, so buffers are packed
+// back to back in the pool's slabs.
+struct BufferSegment {
+    static const size_t SIZE = 16 * 1024;
+
+    BufferSegment* next;
+    size_t start;
+    size_t end;
+    char* data;
+    BufferSlab* slab;       // the slab data belongs to (pool bookkeeping)
+};
+
+// Process-wide pool of I/O buffers, shared by every event loop thread.
+// Buffers are carved out of 2 MB slabs mapped on demand, optionally with
+// MAP_HUGETLB (one TLB entry per slab), up to a configurable limit: past it
+// get() returns NULL and the borrower waits for buffers to come back. A slab
+// whose buffers are all back is unmapped once another slab's worth is free,
+// so memory follows the I/O in flight, not its all-time peak.
+// Borrowers give buffers back as soon as they hold no data.
+class BufferPool {
+public:
+    static const size_t SLAB_SIZE = 2 * 1024 * 1024;
+    static const size_t BUFFERS_PER_SLAB = SLAB_SIZE / BufferSegment::SIZE;
+
+    // Before any buffer is handed out; falls back to normal pages when no
+    // huge page is available
+    static void setHugePages(bool enabled);
+    // Bytes of slabs the pool may map, rounded down to whole slabs (at least
+    // one); 0: no limit. Slabs already mapped above a lower limit are kept
+    // until their buffers come back.
+    static void setLimit(size_t bytes);
+
+    // NULL when no memory is left
+    static BufferSegment* get();
+    static void put(BufferSegment* segment);
+    // Batches for per-loop caches: take links up to count buffers onto list
+    // and returns how many; give returns a list of count buffers
+    static size_t take(BufferSegment*& list, size_t count);
+    static void give(BufferSegment* list, size_t count);
+
+    static size_t allocated();
+    static size_t available();
+
+private:
+    static pthread_mutex_t _lock;
+    static BufferSegment* _free;
+    static size_t _free_count;
+    static size_t _allocated;
+    static size_t _max_slabs;
+    static bool _huge_pages;
+    static bool _limit_logged;
+
+    static bool grow();
+    static void shrink(BufferSlab* slab);
+
+    BufferPool();
+};
+
+#endif
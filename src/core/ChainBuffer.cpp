@@ -0,0 +1,233 @@
+#include "ChainBuffer.hpp"
+#include <cstring>
+
+SegmentPool::SegmentPool() : _free(NULL), _cached(0) {
+}
+
+SegmentPool::~SegmentPool() {
+    BufferPool::give(_free, _cached);
+}
+
+BufferSegment* SegmentPool::get() {
+    if (!_free) {
+        _cached = BufferPool::take(_free, BATCH);
+        if (!_free) {
+            return NULL;
+        }
+    }
+    BufferSegment* segment = _free;
+    _free = segment->next;
+    --_cached;
+    segment->next = NULL;
+    segment->start = 0;
+    segment->end = 0;
+    return segment;
+}
+
+// Past MAX_CACHED, half of the cache goes back to the shared pool
+void SegmentPool::put(BufferSegment* segment) {
+    segment->next = _free;
+    _free = segment;
+    if (++_cached < MAX_CACHED) {
+        return;
+    }
+    BufferSegment* last = _free;
+    for (size_t i = 1; i < MAX_CACHED / 2; ++i) {
+        last = last->next;
+    }
+    BufferSegment* returned = _free;
+    _free = last->next;
+    last->next = NULL;
+    _cached -= MAX_CACHED / 2;
+    BufferPool::give(returned, MAX_CACHED / 2);
+}
+
+size_t SegmentPool::cached() const {
+    return _cached;
+}
+
+ChainBuffer::ChainBuffer() : _head(NULL), _tail(NULL), _spare(NULL), _size(0), _pool(NULL) {
+}
+
+ChainBuffer::~ChainBuffer() {
+    clear();
+}
+
+void ChainBuffer::setPool(SegmentPool* pool) {
+    _pool = pool;
+}
+
+size_t ChainBuffer::size() const {
+    return _size;
+}
+
+bool ChainBuffer::empty() const {
+    return _size == 0;
+}
+
+void ChainBuffer::pushSegment(BufferSegment* segment) {
+    segment->next = NULL;
+    if (_tail) {
+        _tail->next = segment;
+    } else {
+        _head = segment;
+    }
+    _tail = segment;
+}
+
+void ChainBuffer::popSegment() {
+    BufferSegment* segment = _head;
+    _head = segment->next;
+    if (!_head) {
+        _tail = NULL;
+    }
+    _pool->put(segment);
+}
+
+// The tail's free space first, then a whole spare segment, so a single
+// readv can take up to a segment's worth even when the tail is almost full
+int ChainBuffer::prepareRead(struct iovec* iov) {
+    int count = 0;
+    if (_tail && _tail->end < BufferSegment::SIZE) {
+        iov[count].iov_base = _tail->data + _tail->end;
+        iov[count].iov_len = BufferSegment::SIZE - _tail->end;
+        ++count;
+    }
+    if (!_spare) {
+        _spare = _pool->get();
+        if (!_spare) {
+            return count;
+        }
+    }
+    iov[count].iov_base = _spare->data;
+    iov[count].iov_len = BufferSegment::SIZE;
+    return count + 1;
+}
+
+void ChainBuffer::commitRead(size_t length) {
+    _size += length;
+    if (_tail && _tail->end < BufferSegment::SIZE) {
+        size_t room = BufferSegment::SIZE - _tail->end;
+        size_t taken = length < room ? length : room;
+        _tail->end += taken;
+        length -= taken;
+    }
+    if (length > 0) {
+        _spare->end = length;
+        pushSegment(_spare);
+    } else if (_spare) {
+        _pool->put(_spare);
+    }
+    _spare = NULL;
+}
+
+const char* ChainBuffer::front() const {
+    return _head ? _head->data + _head->start : NULL;
+}
+
+size_t ChainBuffer::frontSize() const {
+    return _head ? _head->end - _head->start : 0;
+}
+
+size_t ChainBuffer::makeContiguous(size_t length) {
+    if (length > _size) {
+        length = _size;
+    }
+    if (length > BufferSegment::SIZE) {
+        length = BufferSegment::SIZE;
+    }
+    if (!_head || frontSize() >= length) {
+        return frontSize();
+    }
+
+    BufferSegment* head = _head;
+    if (head->start + length > BufferSegment::SIZE) {
+        memmove(head->data, head->data + head->start, head->end - head->start);
+        head->end -= head->start;
+        head->start = 0;
+    }
+    while (head->end - head->start < length) {
+        BufferSegment* next = head->next;
+        size_t wanted = length - (head->end - head->start);
+        size_t available = next->end - next->start;
+        size_t taken = wanted < available ? wanted : available;
+
+        memcpy(head->data + head->end, next->data + next->start, taken);
+        head->end += taken;
+        next->start += taken;
+        if (next->start == next->end) {
+            head->next = next->next;
+            if (_tail == next) {
+                _tail = head;
+            }
+            _pool->put(next);
+        }
+    }
+    return frontSize();
+}
+
+void ChainBuffer::consume(size_t length) {
+    if (length > _size) {
+        length = _size;
+    }
+    _size -= length;
+    while (length > 0) {
+        size_t available = _head->end - _head->start;
+        if (length < available) {
+            _head->start += length;
+            return;
+        }
+        length -= available;
+        popSegment();
+    }
+}
+
+// Bytes that fit in the tail's free space are copied there and the segment
+// goes back to the pool: small reads do not each hold a segment
+void ChainBuffer::appendSegment(BufferSegment* segment) {
+    size_t length = segment->end - segment->start;
+    if (_tail && length <= BufferSegment::SIZE - _tail->end) {
+        memcpy(_tail->data + _tail->end, segment->data + segment->start, length);
+        _tail->end += length;
+        _size += length;
+        _pool->put(segment);
+        return;
+    }
+    if (length == 0) {
+        _pool->put(segment);
+        return;
+    }
+    _size += length;
+    pushSegment(segment);
+}
+
+bool ChainBuffer::append(const char* data, size_t length) {
+    while (length > 0) {
+        if (!_tail || _tail->end == BufferSegment::SIZE) {
+            BufferSegment* segment = _pool->get();
+            if (!segment) {
+                return false;
+            }
+            pushSegment(segment);
+        }
+        size_t room = BufferSegment::SIZE - _tail->end;
+        size_t taken = length < room ? length : room;
+        memcpy(_tail->data + _tail->end, data, taken);
+        _tail->end += taken;
+        _size += taken;
+        data += taken;
+        length -= taken;
+    }
+    return true;
+}
+
+void ChainBuffer::clear() {
+    while (_head) {
+        popSegment();
+    }
+    if (_spare) {
+        _pool->put(_spare);
+        _spare = NULL;
+    }
+    _size = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef CHAINBUFFER_HPP
+#define CHAINBUFFER_HPP
+
+#include <cstddef>
+#include <sys/uio.h>
+#include "BufferPool.hpp"
+
+// Cache of one event loop in front of the shared BufferPool (not
+// thread-safe): buffers move to and from the pool BATCH at a time, so its
+// lock is not taken on every read. Never holds more than MAX_CACHED.
+class SegmentPool {
+public:
+    SegmentPool();
+    ~SegmentPool();
+
+    // NULL when the shared pool is out of memory
+    BufferSegment* get();
+    void put(BufferSegment* segment);
+    size_t cached() const;
+
+private:
+    static const size_t BATCH = 16;
+    static const size_t MAX_CACHED = 64;
+
+    BufferSegment* _free;
+    size_t _cached;
+
+    SegmentPool(const SegmentPool&);
+    SegmentPool& operator=(const SegmentPool&);
+};
+
+// Byte queue made of pooled segments. The socket reads straight into the
+// free space at the tail (readv over the tail and a fresh segment), the
+// parser reads in place from the head and consumes what it used. Segments
+// are handed back as soon as they are consumed, so an idle connection holds
+// none.
+class ChainBuffer {
+public:
+    ChainBuffer();
+    ~ChainBuffer();
+
+    void setPool(SegmentPool* pool);
+
+    size_t size() const;
+    bool empty() const;
+
+    // Fills iov (2 entries) with the free space to read into, returns the
+    // number of entries used, 0 when no buffer is available. commitRead must
+    // follow, even after a failed read.
+    int prepareRead(struct iovec* iov);
+    void commitRead(size_t length);
+
+    // Unread bytes of the first segment, contiguous in memory
+    const char* front() const;
+    size_t frontSize() const;
+    // Gathers up to length bytes (at most one segment) at the front, copying
+    // only what straddles a segment boundary. Returns frontSize().
+    size_t makeContiguous(size_t length);
+    void consume(size_t length);
+
+    // Takes over a segment filled outside prepareRead (io_uring recv)
+    void appendSegment(BufferSegment* segment);
+    bool append(const char* data, size_t length);
+    void clear();
+
+private:
+    BufferSegment* _head;
+    BufferSegment* _tail;
+    BufferSegment* _spare;   // offered to the last readv, linked if it got data
+    size_t _size;
+    SegmentPool* _pool;      // not owned
+
+    void pushSegment(BufferSegment* segment);
+    void popSegment();
+
+    ChainBuffer(const ChainBuffer&);
+    ChainBuffer& operator=(const ChainBuffer&);
+};
+
+#endif
@@ -1,33 +1,55 @@
 #include "Client.hpp"
 #include "Logger.hpp"
 #include "Utils.hpp"
+#include "Config.hpp"
 #include <unistd.h>
-#include <fcntl.h>
 #include <cstring>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
-Client::Client() : _fd(-1) {
-    init();
+ClientBuffers::ClientBuffers() : queued_responses(0) {
+    parser.setInput(&read_buffer);
 }
 
-Client::Client(int fd) : _fd(fd) {
+Client::Client()
+    : _fd(-1), _timers(NULL), _stats(NULL), _config(NULL), _buffers(NULL) {
     init();
-    
-    // Set socket to non-blocking
-    int flags = fcntl(_fd, F_GETFL, 0);
-    if (flags != -1) {
-        fcntl(_fd, F_SETFL, flags | O_NONBLOCK);
-    }
-    
-    Logger::debug("Client created with fd " + Utils::intToString(_fd));
 }
 
 Client::~Client() {
-    _read_buffer.clear();
-    _write_buffer.clear();
-    _request.clear();
 }
 
+void Client::attach(ClientBuffers* buffers) {
+    _buffers = buffers;
+}
+
+// Takes over a freshly accepted socket; the slot may have served others
+// before, its buffers are reset in place
+void Client::open(int fd, TimerWheel* timers, LoopStats* stats) {
+    _fd = fd;
+    _timers = timers;
+    _stats = stats;
+    init();
+    _buffers->read_buffer.clear();
+    clearWriteQueue();
+    _buffers->parser.reset();
+    _buffers->request.clear();
+    armTimer(TIMER_HEADER_READ);
+    Logger::debug("Client created with fd " + Utils::intToString(_fd));
+}
+
+// Slot goes back to the free list holding no buffer: read segments return
+// to the pool, unsent responses and the body are freed, and so are request
+// strings that grew large
+void Client::release() {
+    closeFd();
+    setConfig(NULL);
+    clearWriteQueue();
+    releaseBody();
+    _buffers->read_buffer.clear();
+    _buffers->parser.reset();
+    _buffers->request.release();
+}
 
 void Client::closeFd() {
     if (_fd != -1) {
@@ -37,49 +59,21 @@ void Client::closeFd() {
     }
 }
 
-
-Client::Client(const Client& other) {
-    _fd = other._fd;
-    _bytes_sent = other._bytes_sent;
-    _state = other._state;
-    _read_buffer = other._read_buffer;
-    _write_buffer = other._write_buffer;
-    _write_offset = other._write_offset;
-    _last_activity = other._last_activity;
-    _parser = other._parser;
-    _request = other._request;
-}
-
-Client& Client::operator=(const Client& other) {
-    if (this != &other) {
-        if (_fd != -1) {
-            close(_fd);
-        }
-
-        _read_buffer.clear();
-        _write_buffer.clear();
-        
-        _fd = other._fd;
-        _state = other._state;
-        _bytes_sent = other._bytes_sent;
-        _read_buffer = other._read_buffer;
-        _write_buffer = other._write_buffer;
-        _write_offset = other._write_offset;
-        _last_activity = other._last_activity;
-        _parser = other._parser;
-        _request = other._request;
-    }
-    return *this;
-}
-
 void Client::init() {
     _state = READING_REQUEST;
     _write_offset = 0;
     _bytes_sent = 0;
-    _last_activity = time(NULL);
-    _parser.reset();           // Reset le parser
-    _request = HTTPRequest();  // Reset la requete
-    _request.clear();
+    _peer_closed = false;
+    _more_to_read = false;
+    _read_starved = false;
+    _read_queued = false;
+    _send_in_flight = false;
+    _closing = false;
+    _keep_alive = false;
+    _keepalive_timeout = KEEPALIVE_TIMEOUT;
+    _requests_served = 0;
+    _pipeline_paused = false;
+    _last_activity = _timers ? _timers->now() : TimerWheel::monotonicMs();
 }
 
 int Client::getFd() const {
@@ -90,109 +84,400 @@ ClientState Client::getState() const {
     return _state;
 }
 
-const std::string& Client::getReadBuffer() const {
-    return _read_buffer;
-}
-
-const std::string& Client::getWriteBuffer() const {
-    return _write_buffer;
+const ChainBuffer& Client::getReadBuffer() const {
+    return _buffers->read_buffer;
 }
 
-size_t Client::getWriteOffset() const {
-    return _write_offset;
-}
-
-time_t Client::getLastActivity() const {
+msec_t Client::getLastActivity() const {
     return _last_activity;
 }
 
 HTTPParser& Client::getParser() {
-    return _parser;
+    return _buffers->parser;
 }
 
 HTTPRequest& Client::getRequest() {
-    return _request;
+    return _buffers->request;
 }
 
 void Client::setState(ClientState state) {
     _state = state;
 }
 
-void Client::setWriteBuffer(const std::string& data) {
-    _write_buffer = data;
+// Responses are queued in the order requests were parsed, so pipelined
+// requests are answered in order and several small ones leave in one writev()
+void Client::queueResponse(const std::string& data) {
+    if (data.empty()) {
+        return;
+    }
+    std::string copy(data);
+    pushSegment(copy, true);
+    armTimer(TIMER_WRITE);
+}
+
+void Client::queueResponse(std::string& head, std::string& body) {
+    if (head.empty() && body.empty()) {
+        return;
+    }
+    if (!head.empty()) {
+        pushSegment(head, body.empty());
+    }
+    if (!body.empty()) {
+        pushSegment(body, true);
+    }
+    armTimer(TIMER_WRITE);
+}
+
+void Client::pushSegment(std::string& data, bool ends_response) {
+    _buffers->write_queue.push_back(WriteSegment());
+    WriteSegment& segment = _buffers->write_queue.back();
+    segment.data.swap(data);
+    segment.ends_response = ends_response;
+    if (ends_response) {
+        ++_buffers->queued_responses;
+    }
+}
+
+// Drops the segments a write completed, a segment is freed as soon as its
+// last byte is sent
+void Client::advanceWrite(size_t length) {
+    std::list<WriteSegment>& queue = _buffers->write_queue;
+    while (length > 0 && !queue.empty()) {
+        size_t remaining = queue.front().data.size() - _write_offset;
+        if (length < remaining) {
+            _write_offset += length;
+            return;
+        }
+        length -= remaining;
+        if (queue.front().ends_response) {
+            --_buffers->queued_responses;
+        }
+        queue.pop_front();
+        _write_offset = 0;
+    }
+}
+
+void Client::clearWriteQueue() {
+    _buffers->write_queue.clear();
+    _buffers->queued_responses = 0;
     _write_offset = 0;
 }
 
+size_t Client::getPendingResponses() const {
+    return _buffers->queued_responses;
+}
+
+bool Client::isPipelineFull() const {
+    return _buffers->queued_responses >= MAX_PIPELINE_DEPTH;
+}
+
+void Client::setPipelinePaused(bool paused) {
+    _pipeline_paused = paused;
+}
+
+bool Client::isPipelinePaused() const {
+    return _pipeline_paused;
+}
+
+void Client::setKeepAlive(bool keep_alive, int timeout) {
+    _keep_alive = keep_alive;
+    _keepalive_timeout = timeout;
+}
+
+bool Client::isKeepAlive() const {
+    return _keep_alive;
+}
+
+size_t Client::getRequestsServed() const {
+    return _requests_served;
+}
+
+// Pins the snapshot: a reload while the request is read or answered does
+// not change the server block it is matched against
+void Client::setConfig(Config* config) {
+    if (config == _config) {
+        return;
+    }
+    if (config) {
+        config->retain();
+    }
+    if (_config) {
+        _config->release();
+    }
+    _config = config;
+    _buffers->parser.setConfig(config);
+}
+
+Config* Client::getConfig() const {
+    return _config;
+}
+
+// A response has been queued: parse the next request with the same parser
+// and request objects, starting from any bytes already buffered
+void Client::startNextRequest() {
+    ++_requests_served;
+    _buffers->parser.next();
+    releaseBody();
+    _buffers->request.clear();
+}
+
+// A body's storage is not kept around for the next request, which most
+// often has none
+void Client::releaseBody() {
+    std::string().swap(_buffers->request.getBodyRef());
+}
+
+// Re-arms the deadline matching what the connection now waits for; the
+// wheel's cached clock is used, so this costs no syscall.
 void Client::updateLastActivity() {
-    _last_activity = time(NULL);
+    if (!_timers) {
+        _last_activity = TimerWheel::monotonicMs();
+        return;
+    }
+    _last_activity = _timers->now();
+    armTimer(currentTimerKind());
+}
+
+void Client::armTimer(TimerKind kind) {
+    if (!_timers || _fd == -1) {
+        return;
+    }
+
+    int seconds;
+    switch (kind) {
+        case TIMER_BODY_READ: seconds = CLIENT_BODY_TIMEOUT; break;
+        case TIMER_KEEPALIVE: seconds = _keepalive_timeout; break;
+        case TIMER_WRITE:     seconds = SEND_TIMEOUT; break;
+        default:              seconds = CLIENT_HEADER_TIMEOUT; break;
+    }
+    _timers->arm(_fd, kind, static_cast<msec_t>(seconds) * 1000);
+}
+
+TimerKind Client::currentTimerKind() const {
+    if (hasDataToWrite()) {
+        return TIMER_WRITE;
+    }
+    if (_buffers->parser.getState() == PARSING_BODY) {
+        return TIMER_BODY_READ;
+    }
+    if (_requests_served > 0 && _buffers->parser.getState() == PARSING_REQUEST_LINE && !_buffers->parser.hasBufferedData()) {
+        return TIMER_KEEPALIVE;
+    }
+    return TIMER_HEADER_READ;
 }
 
-ssize_t Client::readData() {
+// Returns the number of bytes appended to the read buffer, 0 on orderly
+// shutdown with nothing read, -1 when nothing could be read. Bytes land
+// directly in the buffer's segments, no intermediate copy. A short read
+// means the socket was emptied, which ends a drain without an extra read;
+// socket errors are left to the EVENT_ERROR callback.
+// A drain stops at MAX_READ_PER_WAKEUP bytes or MAX_READS_PER_WAKEUP reads;
+// hasMoreToRead() then tells the loop to come back, no new edge will be
+// reported for these bytes. Any read stops when the pool has no buffer
+// left, isReadStarved() tells the loop to wait for buffers.
+ssize_t Client::readData(bool drain) {
+    _more_to_read = false;
+    _read_starved = false;
     if (_fd == -1) return -1;
     
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_read = recv(_fd, buffer, BUFFER_SIZE - 1, 0);
-    
-    if (bytes_read > 0) {
-        buffer[bytes_read] = '\0';
-        _read_buffer.append(buffer, bytes_read);
+    ChainBuffer& input = _buffers->read_buffer;
+    struct iovec iov[2];
+    ssize_t total = 0;
+    ssize_t bytes_read = -1;
+    int reads = 0;
+
+    while (true) {
+        int count = input.prepareRead(iov);
+        if (count == 0) {
+            Logger::debug("No I/O buffer left for client " + Utils::intToString(_fd));
+            _read_starved = true;
+            break;
+        }
+        size_t room = iov[0].iov_len + (count > 1 ? iov[1].iov_len : 0);
+
+        bytes_read = readv(_fd, iov, count);
+        if (_stats) {
+            ++_stats->recv_calls;
+        }
+        if (bytes_read <= 0) {
+            input.commitRead(0);
+            if (bytes_read == 0) {
+                _peer_closed = true;
+            }
+            break;
+        }
+        input.commitRead(bytes_read);
+        total += bytes_read;
+        if (!drain || static_cast<size_t>(bytes_read) < room) {
+            break;
+        }
+        if (static_cast<size_t>(total) >= MAX_READ_PER_WAKEUP || ++reads >= MAX_READS_PER_WAKEUP) {
+            _more_to_read = true;
+            break;
+        }
+    }
+
+    if (total > 0) {
         updateLastActivity();
-        Logger::debug("Read " + Utils::intToString(bytes_read) + " bytes from client " + Utils::intToString(_fd)
-                     + " (total buffer: " + Utils::intToString(_read_buffer.size()) + " bytes)");
-    } else if (bytes_read == 0) {
+        Logger::debug("Read " + Utils::intToString(total) + " bytes from client " + Utils::intToString(_fd)
+                     + " (total buffer: " + Utils::intToString(_buffers->read_buffer.size()) + " bytes)");
+        return total;
+    }
+    if (bytes_read == 0) {
         Logger::debug("Client " + Utils::intToString(_fd) + " closed connection");
     } else {
         Logger::debug("Read error from client " + Utils::intToString(_fd));
     }
-    
     return bytes_read;
 }
 
-ssize_t Client::writeData() {
-    if (_fd == -1 || _write_buffer.empty() || _write_offset >= _write_buffer.size()) {
+// Points iov (MAX_WRITE_SEGMENTS entries) at the queued segments, the first
+// one from where the last write stopped
+int Client::gatherWrite(struct iovec* iov, size_t& remaining) const {
+    const std::list<WriteSegment>& queue = _buffers->write_queue;
+    int count = 0;
+    remaining = 0;
+    for (std::list<WriteSegment>::const_iterator it = queue.begin();
+         it != queue.end() && count < MAX_WRITE_SEGMENTS; ++it, ++count) {
+        size_t skip = count == 0 ? _write_offset : 0;
+        iov[count].iov_base = const_cast<char*>(it->data.data()) + skip;
+        iov[count].iov_len = it->data.size() - skip;
+        remaining += iov[count].iov_len;
+    }
+    return count;
+}
+
+// Gathers the queued segments (heads and bodies of successive responses)
+// into one writev(); a partial write resumes inside the segment it stopped in
+ssize_t Client::writeData(bool drain) {
+    std::list<WriteSegment>& queue = _buffers->write_queue;
+    if (_fd == -1 || queue.empty()) {
         return 0;
     }
     
-    const char* data = _write_buffer.c_str() + _write_offset;
-    size_t remaining = _write_buffer.size() - _write_offset;
-    
-    ssize_t bytes_sent = send(_fd, data, remaining, 0);
-    
-    if (bytes_sent > 0) {
-        _write_offset += bytes_sent;
-        updateLastActivity();
-        Logger::debug("Wrote " + Utils::intToString(bytes_sent) + " bytes to client " + Utils::intToString(_fd));
-    } else if (bytes_sent < 0) {
-        if (bytes_sent == -1) {
-            Logger::debug("Write error to client " + Utils::intToString(_fd));
+    ssize_t total = 0;
+    ssize_t bytes_sent = 0;
+    struct iovec iov[MAX_WRITE_SEGMENTS];
+
+    while (!queue.empty()) {
+        size_t remaining;
+        int count = gatherWrite(iov, remaining);
+
+        bytes_sent = writev(_fd, iov, count);
+        if (_stats) {
+            ++_stats->send_calls;
+        }
+        if (bytes_sent <= 0) {
+            break;
         }
+        advanceWrite(bytes_sent);
+        total += bytes_sent;
+        // A partial write means the socket buffer is full
+        if (!drain || static_cast<size_t>(bytes_sent) < remaining) {
+            break;
+        }
+    }
+
+    if (total > 0) {
+        updateLastActivity();
+        Logger::debug("Wrote " + Utils::intToString(total) + " bytes to client " + Utils::intToString(_fd));
+        _bytes_sent = total;
+        return total;
+    }
+    if (bytes_sent == -1) {
+        Logger::debug("Write error to client " + Utils::intToString(_fd));
     }
     _bytes_sent = bytes_sent;
     return bytes_sent;
 }
 
-void Client::clearReadBuffer() {
-    _read_buffer.clear();
+// Bytes an io_uring recv put in a pool segment, linked into the read buffer
+void Client::receiveSegment(BufferSegment* segment) {
+    size_t length = segment->end - segment->start;
+    _read_starved = false;
+    _buffers->read_buffer.appendSegment(segment);
+    updateLastActivity();
+    Logger::debug("Received " + Utils::intToString(length) + " bytes from client " + Utils::intToString(_fd)
+                 + " (total buffer: " + Utils::intToString(_buffers->read_buffer.size()) + " bytes)");
 }
 
-void Client::clearWriteBuffer() {
-    _write_buffer.clear();
-    _write_offset = 0;
+void Client::markReadStarved() {
+    _read_starved = true;
+}
+
+// The segments stay queued, untouched, until completeSend: the kernel
+// reads them in place
+int Client::prepareSend(struct iovec* iov) {
+    size_t remaining;
+    if (_fd == -1 || _send_in_flight || _buffers->write_queue.empty()) {
+        return 0;
+    }
+    _send_in_flight = true;
+    return gatherWrite(iov, remaining);
+}
+
+ssize_t Client::completeSend(ssize_t bytes_sent) {
+    _send_in_flight = false;
+    _bytes_sent = bytes_sent;
+    if (bytes_sent <= 0) {
+        Logger::debug("Send error to client " + Utils::intToString(_fd));
+        return bytes_sent;
+    }
+    advanceWrite(bytes_sent);
+    updateLastActivity();
+    Logger::debug("Sent " + Utils::intToString(bytes_sent) + " bytes to client " + Utils::intToString(_fd));
+    return bytes_sent;
+}
+
+bool Client::isSendInFlight() const {
+    return _send_in_flight;
+}
+
+void Client::setClosing() {
+    _closing = true;
 }
 
-void Client::appendToReadBuffer(const std::string& data) {
-    _read_buffer.append(data);
+bool Client::isClosing() const {
+    return _closing;
+}
+
+bool Client::isPeerClosed() const {
+    return _peer_closed;
+}
+
+bool Client::hasMoreToRead() const {
+    return _more_to_read;
+}
+
+bool Client::isReadStarved() const {
+    return _read_starved;
+}
+
+void Client::setReadQueued(bool queued) {
+    _read_queued = queued;
+}
+
+bool Client::isReadQueued() const {
+    return _read_queued;
+}
+
+void Client::clearReadBuffer() {
+    _buffers->read_buffer.clear();
+}
+
+void Client::clearWriteBuffer() {
+    clearWriteQueue();
 }
 
-bool Client::isTimedOut() const {
-    return (time(NULL) - _last_activity) > CLIENT_TIMEOUT;
+bool Client::appendToReadBuffer(const std::string& data) {
+    return _buffers->read_buffer.append(data.data(), data.size());
 }
 
 bool Client::isWriteComplete() const {
-    return _write_offset >= _write_buffer.size() && _bytes_sent > 0;
+    return _buffers->write_queue.empty() && _bytes_sent > 0;
 }
 
 bool Client::hasDataToWrite() const {
-    return !_write_buffer.empty() && _write_offset < _write_buffer.size();
+    return !_buffers->write_queue.empty();
 }
 
@@ -2,12 +2,33 @@
 #define CLIENT_HPP
 
 #include <string>
+#include <list>
 #include <sys/socket.h>
 #include <ctime>
 #include "HTTPParser.hpp"
 #include "HTTPRequest.hpp"
+#include "ChainBuffer.hpp"
+#include "TimerWheel.hpp"
+#include "LoopStats.hpp"
 
-static const int CLIENT_TIMEOUT = 120;  // 2 minutes timeout
+class Config;
+
+// Per-phase timeouts (seconds)
+static const int CLIENT_HEADER_TIMEOUT = 60;   // request line + headers
+static const int CLIENT_BODY_TIMEOUT = 60;     // between two body reads
+static const int KEEPALIVE_TIMEOUT = 75;       // idle between requests (default)
+static const int SEND_TIMEOUT = 60;            // between two successful writes
+
+// Responses waiting to be sent before pipelined requests stop being parsed
+static const size_t MAX_PIPELINE_DEPTH = 16;
+
+// Segments handed to a single writev()
+static const int MAX_WRITE_SEGMENTS = 32;
+
+// Edge-triggered drain budget per wakeup, so one fast sender cannot hold
+// the loop or the buffer pool; the rest is read on the next pass
+static const size_t MAX_READ_PER_WAKEUP = 256 * 1024;
+static const int MAX_READS_PER_WAKEUP = 16;
 
 enum ClientState {
     READING_REQUEST,
@@ -16,58 +37,129 @@ enum ClientState {
     DONE
 };
 
+// A piece of a queued response: its head or its body. Sent in place, a body
+// is never copied into a larger buffer.
+struct WriteSegment {
+    std::string data;
+    bool ends_response;     // last segment of its response
+};
+
+// Per-connection data only touched once bytes actually move: buffers and
+// parser state. Lives in its own slab (see ClientTable) so the Client
+// records scanned on every event stay small and contiguous.
+struct ClientBuffers {
+    ChainBuffer read_buffer;            // the socket reads into it, the parser consumes it
+    std::list<WriteSegment> write_queue;    // unsent segments, in request order; holds no memory once sent
+    size_t queued_responses;                // responses with a segment in write_queue
+    HTTPParser parser;                  // Parser pour ce client
+    HTTPRequest request;                // Requete en cours de construction
+
+    ClientBuffers();
+
+private:
+    ClientBuffers(const ClientBuffers&);
+    ClientBuffers& operator=(const ClientBuffers&);
+};
+
+// One connection. Clients are never copied: ClientTable owns them in place
+// and recycles them with open()/release().
 class Client {
 private:
+    // Hot: read on every event for this fd
     int _fd;
     ClientState _state;
-    std::string _read_buffer;
-    std::string _write_buffer;
-    size_t  _bytes_sent;
-    size_t _write_offset;
-    time_t _last_activity;
-    HTTPParser _parser;      // Parser pour ce client
-    HTTPRequest _request;    // Requete en cours de construction
-    
-    static const size_t BUFFER_SIZE = 8192;
+    bool _peer_closed;       // recv() reported EOF while draining
+    bool _more_to_read;      // the last drain stopped before the socket would block
+    bool _read_starved;      // the last read found no I/O buffer left in the pool
+    bool _read_queued;       // on the owning loop's list of sockets left readable
+    bool _send_in_flight;    // io_uring: the kernel may still read the queued segments
+    bool _closing;           // removed while a send was in flight, released when it completes
+    bool _keep_alive;        // keep the connection once the response is sent
+    bool _pipeline_paused;   // a complete request waits for room in the queue
+    int _keepalive_timeout;  // seconds, from the server block that answered
+    size_t _bytes_sent;
+    size_t _write_offset;    // bytes of the first queued segment already sent
+    size_t _requests_served;
+    msec_t _last_activity;
+    TimerWheel* _timers;     // Wheel of the owning event loop (not owned)
+    LoopStats* _stats;       // Counters of the owning event loop (not owned)
+    Config* _config;         // Snapshot the current request is answered with (holds a reference)
+
+    // Cold: owned by the table, attached for the lifetime of the slot
+    ClientBuffers* _buffers;
+
+    Client(const Client& other);
+    Client& operator=(const Client& other);
 
 public:
     Client();
-    Client(int fd);
     ~Client();
+
+    void attach(ClientBuffers* buffers);
+    void open(int fd, TimerWheel* timers, LoopStats* stats);
+    void release();
     void closeFd();
     
-    Client(const Client& other);
-    Client& operator=(const Client& other);
-    
     int getFd() const;
     ClientState getState() const;
-    const std::string& getReadBuffer() const;
-    const std::string& getWriteBuffer() const;
-    size_t getWriteOffset() const;
-    time_t getLastActivity() const;
+    const ChainBuffer& getReadBuffer() const;
+    msec_t getLastActivity() const;
     HTTPParser& getParser();
     HTTPRequest& getRequest();
     
     void setState(ClientState state);
-    void setWriteBuffer(const std::string& data);
+    void queueResponse(const std::string& data);
+    // Takes the contents of head and body (swapped, not copied)
+    void queueResponse(std::string& head, std::string& body);
+    size_t getPendingResponses() const;
+    bool isPipelineFull() const;
+    void setPipelinePaused(bool paused);
+    bool isPipelinePaused() const;
+    void setKeepAlive(bool keep_alive, int timeout = KEEPALIVE_TIMEOUT);
+    bool isKeepAlive() const;
+    size_t getRequestsServed() const;
+    void setConfig(Config* config);
+    Config* getConfig() const;
+    void startNextRequest();
     void updateLastActivity();
+    void armTimer(TimerKind kind);
+    TimerKind currentTimerKind() const;
     
-    // I/O operations
-    ssize_t readData();
-    ssize_t writeData();
+    // I/O operations (drain: keep going until the socket would block, as
+    // required by edge-triggered registration)
+    ssize_t readData(bool drain = false);
+    ssize_t writeData(bool drain = false);
+    // io_uring completions: the backend receives into pool segments and
+    // sends from the queued segments themselves
+    void receiveSegment(BufferSegment* segment);
+    void markReadStarved();
+    int prepareSend(struct iovec* iov);
+    ssize_t completeSend(ssize_t bytes_sent);
+    bool isSendInFlight() const;
+    void setClosing();
+    bool isClosing() const;
+    bool isPeerClosed() const;
+    bool hasMoreToRead() const;
+    bool isReadStarved() const;
+    void setReadQueued(bool queued);
+    bool isReadQueued() const;
     
     // Buffer management
     void clearReadBuffer();
     void clearWriteBuffer();
-    void appendToReadBuffer(const std::string& data);
+    bool appendToReadBuffer(const std::string& data);
     
     // Utils
-    bool isTimedOut() const;
     bool isWriteComplete() const;
     bool hasDataToWrite() const;
 
 private:
     void init();
+    void releaseBody();
+    void pushSegment(std::string& data, bool ends_response);
+    void advanceWrite(size_t length);
+    int gatherWrite(struct iovec* iov, size_t& remaining) const;
+    void clearWriteQueue();
 };
 
 #endif
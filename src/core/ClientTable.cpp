@@ -0,0 +1,103 @@
+#include "ClientTable.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+
+ClientTable::ClientTable() : _count(0) {
+    _slot_of_fd.assign(INITIAL_FDS, -1);
+}
+
+ClientTable::~ClientTable() {
+    for (size_t i = 0; i < _client_slabs.size(); ++i) {
+        for (size_t j = 0; j < SLAB_SIZE; ++j) {
+            _client_slabs[i][j].closeFd();
+        }
+        delete[] _client_slabs[i];
+        delete[] _buffer_slabs[i];
+    }
+}
+
+Client& ClientTable::slot(int index) const {
+    return _client_slabs[index / SLAB_SIZE][index % SLAB_SIZE];
+}
+
+// Adds one slab; its slots are pushed so the lowest index is handed out first
+void ClientTable::grow() {
+    Client* clients = new Client[SLAB_SIZE];
+    ClientBuffers* buffers = new ClientBuffers[SLAB_SIZE];
+    int base = static_cast<int>(_client_slabs.size() * SLAB_SIZE);
+
+    _client_slabs.push_back(clients);
+    _buffer_slabs.push_back(buffers);
+    _fd_of_slot.resize(_fd_of_slot.size() + SLAB_SIZE, -1);
+    for (int i = SLAB_SIZE - 1; i >= 0; --i) {
+        buffers[i].read_buffer.setPool(&_segments);
+        clients[i].attach(&buffers[i]);
+        _free_slots.push_back(base + i);
+    }
+    Logger::debug("Client table grown to " + Utils::intToString(_fd_of_slot.size()) + " slots");
+}
+
+Client* ClientTable::find(int fd) const {
+    if (fd < 0 || static_cast<size_t>(fd) >= _slot_of_fd.size() || _slot_of_fd[fd] == -1) {
+        return NULL;
+    }
+    return &slot(_slot_of_fd[fd]);
+}
+
+Client* ClientTable::open(int fd, TimerWheel* timers, LoopStats* stats) {
+    if (fd < 0 || static_cast<size_t>(fd) >= MAX_FDS) {
+        return NULL;
+    }
+    if (static_cast<size_t>(fd) >= _slot_of_fd.size()) {
+        size_t capacity = _slot_of_fd.size();
+        while (capacity <= static_cast<size_t>(fd)) {
+            capacity *= 2;
+        }
+        _slot_of_fd.resize(capacity < MAX_FDS ? capacity : MAX_FDS, -1);
+    }
+    if (_slot_of_fd[fd] != -1) {
+        Logger::error("fd " + Utils::intToString(fd) + " already has a client");
+        return NULL;
+    }
+    if (_free_slots.empty()) {
+        grow();
+    }
+
+    int index = _free_slots.back();
+    _free_slots.pop_back();
+    _slot_of_fd[fd] = index;
+    _fd_of_slot[index] = fd;
+    ++_count;
+
+    Client& client = slot(index);
+    client.open(fd, timers, stats);
+    return &client;
+}
+
+void ClientTable::release(int fd) {
+    if (fd < 0 || static_cast<size_t>(fd) >= _slot_of_fd.size() || _slot_of_fd[fd] == -1) {
+        return;
+    }
+    int index = _slot_of_fd[fd];
+    slot(index).release();
+    _slot_of_fd[fd] = -1;
+    _fd_of_slot[index] = -1;
+    _free_slots.push_back(index);
+    --_count;
+}
+
+size_t ClientTable::size() const {
+    return _count;
+}
+
+size_t ClientTable::capacity() const {
+    return _slot_of_fd.size();
+}
+
+void ClientTable::collectFds(std::vector<int>& fds) const {
+    for (size_t i = 0; i < _fd_of_slot.size(); ++i) {
+        if (_fd_of_slot[i] != -1) {
+            fds.push_back(_fd_of_slot[i]);
+        }
+    }
+}
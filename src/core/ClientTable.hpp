@@ -0,0 +1,51 @@
+#ifndef CLIENTTABLE_HPP
+#define CLIENTTABLE_HPP
+
+#include <vector>
+#include <cstddef>
+#include "Client.hpp"
+#include "ChainBuffer.hpp"
+
+// Connections of one event loop, looked up by fd in O(1).
+// Clients and their buffers live in fixed-size slabs that are allocated on
+// demand and never move or shrink, so a Client& stays valid until release().
+// Released slots go on a free list and are reused most-recent first, while
+// their memory is still warm. The fd -> slot index doubles when a higher fd
+// is opened, like the event tables. Read buffers of every connection draw
+// their segments from one pool per table.
+class ClientTable {
+public:
+    ClientTable();
+    ~ClientTable();
+
+    Client* find(int fd) const;
+    // NULL if the fd is beyond the table
+    Client* open(int fd, TimerWheel* timers, LoopStats* stats);
+    // Closes the fd and recycles the slot
+    void release(int fd);
+    size_t size() const;
+    size_t capacity() const;
+    // fds of every open connection, for shutdown
+    void collectFds(std::vector<int>& fds) const;
+
+private:
+    static const size_t SLAB_SIZE = 256;
+    static const size_t INITIAL_FDS = 1024;
+    static const size_t MAX_FDS = 1 << 20;
+
+    SegmentPool _segments;              // before the slabs: their buffers return segments to it
+    std::vector<int> _slot_of_fd;       // -1: no connection on this fd
+    std::vector<int> _fd_of_slot;
+    std::vector<Client*> _client_slabs;
+    std::vector<ClientBuffers*> _buffer_slabs;
+    std::vector<int> _free_slots;
+    size_t _count;
+
+    Client& slot(int index) const;
+    void grow();
+
+    ClientTable(const ClientTable&);
+    ClientTable& operator=(const ClientTable&);
+};
+
+#endif
@@ -1,37 +1,9 @@
 #include "Epoll.hpp"
 #include "Utils.hpp"
 #include <cstring>
-#include <sstream>
+#include <cerrno>
 
-namespace {
-
-std::string eventMaskToString(uint32_t events) {
-	std::string names;
-
-	if (events & EVENT_READ) {
-		names += "READ";
-	}
-	if (events & EVENT_WRITE) {
-		if (!names.empty())
-			names += "|";
-		names += "WRITE";
-	}
-	if (events & EVENT_ERROR) {
-		if (!names.empty())
-			names += "|";
-		names += "ERROR";
-	}
-	if (names.empty()) {
-		std::ostringstream oss;
-		oss << "0x" << std::hex << events;
-		names = oss.str();
-	}
-	return names;
-}
-
-}
-
-EpollManager::EpollManager(int flags) : failed(false)
+EpollManager::EpollManager(int flags) : _events(NULL), _entries(NULL), _capacity(0)
 {
 	Logger::debug("Initializing epoll (flags=" + Utils::intToString(flags) + ", READ="
 		+ eventMaskToString(EVENT_READ) + ", WRITE=" + eventMaskToString(EVENT_WRITE)
@@ -52,57 +24,109 @@ EpollManager::EpollManager(int flags) : failed(false)
 		failed = true;
 		return ;
 	}
+
+	reserve(INITIAL_TRACKED_FDS - 1);
+}
+
+// Makes room for fd, doubling the table: it follows the highest fd bound,
+// not the descriptor limit. Entries are only reached by index, so they may
+// move.
+bool EpollManager::reserve(int fd)
+{
+	if (static_cast<size_t>(fd) < _capacity)
+		return true;
+	if (fd >= MAX_TRACKED_FDS)
+		return false;
+
+	size_t capacity = _capacity ? _capacity : INITIAL_TRACKED_FDS;
+	while (capacity <= static_cast<size_t>(fd))
+		capacity *= 2;
+	if (capacity > MAX_TRACKED_FDS)
+		capacity = MAX_TRACKED_FDS;
+
+	FdEntry *entries = new FdEntry[capacity];
+	for (size_t i = 0; i < capacity; i++)
+	{
+		if (i < _capacity)
+		{
+			entries[i] = _entries[i];
+			continue;
+		}
+		entries[i].events = 0;
+		entries[i].on_read = NULL;
+		entries[i].on_write = NULL;
+		entries[i].on_error = NULL;
+		entries[i].user = NULL;
+	}
+	delete[] _entries;
+	_entries = entries;
+	_capacity = capacity;
+	Logger::debug("epoll table grown to " + Utils::intToString(_capacity) + " fds");
+	return true;
 }
 
 bool EpollManager::isTracked(int fd) const throw()
 {
-	return fds_callbacks.find(fd) != fds_callbacks.end();
+	return fd >= 0 && static_cast<size_t>(fd) < _capacity && _entries[fd].events != 0;
 }
 
-bool EpollManager::isTracked(int fd, int event) throw()
+bool EpollManager::isTracked(int fd, int event) const throw()
 {
 	if (!isTracked(fd))
 		return false;
-	return fds_callbacks[fd].find(event) != fds_callbacks[fd].end();
+	return (_entries[fd].events & event) == static_cast<uint32_t>(event);
 }
 
-int EpollManager::getTrackedEvents(int fd) throw()
+int EpollManager::getTrackedEvents(int fd) const throw()
 {
-	int events = 0;
 	if (!isTracked(fd))
 		return 0;
-
-	for (int i = EVENT_READ; i < __EVENT_COUNTS__; i++)
-	{
-		if (isTracked(fd, i))
-			events |= i;
-	}
-
-	return events;
+	return _entries[fd].events;
 }
 
-bool EpollManager::bindToFd(int fd, uint32_t event, callback_t callback)
+bool EpollManager::control(int op, int fd) throw()
 {
 	epoll_t tmp;
 
-	if (!isTracked(fd))
+	tmp.data.u64 = 0;
+	tmp.data.fd = fd;
+	tmp.events = _entries[fd].events;
+	countControl();
+	return epoll_ctl(_ep_fd, op, fd, &tmp) == 0;
+}
+
+bool EpollManager::bindToFd(int fd, uint32_t event, callback_t callback, void *user)
+{
+	if (fd < 0 || !reserve(fd))
 	{
-		fds_callbacks[fd] = std::map<int, callback_t>();
+		Logger::error("fd " + Utils::intToString(fd) + " exceeds the epoll table capacity");
+		return false;
 	}
-	else if (isTracked(fd, event))
+
+	FdEntry &entry = _entries[fd];
+	bool was_tracked = entry.events != 0;
+
+	if (was_tracked && (entry.events & event) == event)
 	{
 		Logger::debug("fd " + Utils::intToString(fd) + " already bound for event " + eventMaskToString(event));
 		return true;
 	}
 
-	fds_callbacks[fd][event] = callback;
-
-	tmp.data.fd = fd;
-	tmp.events = getTrackedEvents(fd) | event;
-
-	if (epoll_ctl(_ep_fd, EPOLL_CTL_MOD, fd, &tmp) == -1)
+	if (event & EVENT_READ)
+		entry.on_read = callback;
+	if (event & EVENT_WRITE)
+		entry.on_write = callback;
+	if (event & EVENT_ERROR)
+		entry.on_error = callback;
+	if (user)
+		entry.user = user;
+	entry.events |= event;
+
+	if (!control(was_tracked ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd))
 	{
-		epoll_ctl(_ep_fd, EPOLL_CTL_ADD, fd, &tmp);
+		Logger::error("epoll_ctl failed for fd " + Utils::intToString(fd));
+		entry.events &= ~event;
+		return false;
 	}
 	Logger::debug("Bound fd " + Utils::intToString(fd) + " for event " + eventMaskToString(event));
 	return true;
@@ -110,10 +134,23 @@ bool EpollManager::bindToFd(int fd, uint32_t event, callback_t callback)
 
 bool EpollManager::unbindFd(int fd, int event) throw()
 {
+	if (fd < 0 || static_cast<size_t>(fd) >= _capacity)
+		return false;
+
+	FdEntry &entry = _entries[fd];
+
 	if (event == -1)
 	{
-		fds_callbacks[fd].clear();
-		epoll_ctl(_ep_fd, EPOLL_CTL_DEL, fd, NULL);
+		if (entry.events != 0)
+		{
+			countControl();
+			epoll_ctl(_ep_fd, EPOLL_CTL_DEL, fd, NULL);
+		}
+		entry.events = 0;
+		entry.on_read = NULL;
+		entry.on_write = NULL;
+		entry.on_error = NULL;
+		entry.user = NULL;
 		Logger::debug("Unbound all events for fd " + Utils::intToString(fd));
 		return true;
 	}
@@ -122,51 +159,61 @@ bool EpollManager::unbindFd(int fd, int event) throw()
 		Logger::debug("fd " + Utils::intToString(fd) + " is not bound for event " + eventMaskToString(event));
 		return false;
 	}
-	else
-	{
-		epoll_t tmp;
 
-		tmp.data.fd = fd;
-		tmp.events = getTrackedEvents(fd) & ~event;
+	entry.events &= ~event;
+	if (event & EVENT_READ)
+		entry.on_read = NULL;
+	if (event & EVENT_WRITE)
+		entry.on_write = NULL;
+	if (event & EVENT_ERROR)
+		entry.on_error = NULL;
+	control(EPOLL_CTL_MOD, fd);
+	Logger::debug("Unbound fd " + Utils::intToString(fd) + " for event " + eventMaskToString(event));
+	return true;
+}
 
-		fds_callbacks[fd].erase(event);
-		epoll_ctl(_ep_fd, EPOLL_CTL_MOD, fd, &tmp);
-		Logger::debug("Unbound fd " + Utils::intToString(fd) + " for event " + eventMaskToString(event));
-		return true;
-	}
+const char *EpollManager::name() const throw()
+{
+	return "epoll";
 }
 
-bool EpollManager::watchForEvents(void *ptr) throw()
+int EpollManager::watchForEvents(void *ptr, int timeout_ms) throw()
 {
-	int ready = epoll_wait(_ep_fd, _events, MAX_EVENTS, 0);
+	countWait();
+	int ready = epoll_wait(_ep_fd, _events, MAX_EVENTS, timeout_ms);
 
 	if (ready == -1)
 	{
+		if (errno == EINTR)
+			return 0;
 		Logger::error("epoll_wait failed !");
-		return false;
+		return -1;
 	}
 
-	if (ready == 0)
-		return true;
-
-	for (size_t i = 0; i < (size_t)ready; i++)
+	for (int i = 0; i < ready; i++)
 	{
 		int fd = _events[i].data.fd;
-		int events = _events[i].events;
-		for (int binding = EVENT_READ; binding < __EVENT_COUNTS__; binding++)
-		{
-			if (events & binding && isTracked(fd, binding))
-			{
-				fds_callbacks[fd][binding](fd, ptr);
-			}
-		}
+		uint32_t events = _events[i].events;
+		void *context = _entries[fd].user ? _entries[fd].user : ptr;
+
+		// Re-check the mask before each callback: an earlier one may have
+		// unbound (or closed) the fd. Indexed each time, a callback that
+		// binds a higher fd may move the table.
+		if ((events & EVENT_READ) && (_entries[fd].events & EVENT_READ))
+			_entries[fd].on_read(fd, context);
+		if ((events & EVENT_WRITE) && (_entries[fd].events & EVENT_WRITE))
+			_entries[fd].on_write(fd, context);
+		if ((events & EVENT_ERROR) && (_entries[fd].events & EVENT_ERROR))
+			_entries[fd].on_error(fd, context);
 	}
 
-	return true;
+	return ready;
 }
 
 EpollManager::~EpollManager()
 {
-	close(_ep_fd);
+	if (_ep_fd != -1)
+		close(_ep_fd);
 	delete[] _events;
+	delete[] _entries;
 }
@@ -4,55 +4,64 @@
 #include <sys/epoll.h>
 #include <vector>
 #include <cstddef>
-#include <sys/epoll.h>
 #include <unistd.h>
-#include <map>
+#include <stdint.h>
 #include "Logger.hpp"
+#include "EventManager.hpp"
 
 #define MAX_EVENTS 1024
-
-enum EventType {
-    EVENT_READ = EPOLLIN,
-    EVENT_WRITE = EPOLLOUT,
-    EVENT_ERROR = EPOLLERR | EPOLLHUP,
-    __EVENT_COUNTS__
-};
+#define MAX_TRACKED_FDS (1 << 20)
+#define INITIAL_TRACKED_FDS 1024
 
 typedef struct epoll_event epoll_t;
 typedef int fd_t;
 
-class EpollManager
+class EpollManager : public EventManager
 {
-
-	public:
-		typedef void (*callback_t)(int, void *);
-
 	private:
 
+		// One slot per fd, indexed by the fd epoll hands back in
+		// epoll_event.data.fd: a ready event reaches its callbacks with a
+		// single array access.
+		struct FdEntry
+		{
+			uint32_t events;
+			callback_t on_read;
+			callback_t on_write;
+			callback_t on_error;
+			void *user;
+		};
+
 		epoll_t *_events;
 
-		std::map<int, std::map<int, callback_t> > fds_callbacks;
+		FdEntry *_entries;
+
+		size_t _capacity;
 
 		fd_t _ep_fd;
 
+		bool control(int op, int fd) throw();
+
+		bool reserve(int fd);
+
         
     public:
 
-        bool failed;
-
 		EpollManager(int flags);
 
+		const char *name() const throw();
+
 		bool isTracked(int fd) const throw();
 
-		bool isTracked(int fd, int event) throw();
+		bool isTracked(int fd, int event) const throw();
 
-		int getTrackedEvents(int fd) throw();
+		int getTrackedEvents(int fd) const throw();
 
-		bool bindToFd(int fd, uint32_t event, callback_t callback);
+		bool bindToFd(int fd, uint32_t event, callback_t callback, void *user = NULL);
 
 		bool unbindFd(int fd, int event) throw();
 
-		bool watchForEvents(void *ptr) throw();
+		int watchForEvents(void *ptr, int timeout_ms) throw();
 
 		~EpollManager();
 };
@@ -0,0 +1,110 @@
+#include "EventManager.hpp"
+#include "Epoll.hpp"
+#include "Uring.hpp"
+#include "Logger.hpp"
+#include <sstream>
+
+EventManager::EventManager() : failed(false), _stats(NULL)
+{
+}
+
+EventManager::~EventManager()
+{
+}
+
+EventManager *EventManager::create(const std::string &backend)
+{
+	if (backend == "io_uring")
+	{
+		UringManager *uring = new UringManager();
+		if (!uring->failed)
+			return uring;
+		delete uring;
+		Logger::warning("io_uring unavailable, falling back to epoll");
+	}
+	// Close-on-exec: neither CGI scripts nor an upgraded binary inherit it
+	return new EpollManager(EPOLL_CLOEXEC);
+}
+
+bool EventManager::supportsCompletions() const throw()
+{
+	return false;
+}
+
+bool EventManager::bindAccept(int fd, io_callback_t callback, void *user)
+{
+	(void)fd;
+	(void)callback;
+	(void)user;
+	return false;
+}
+
+bool EventManager::bindRecv(int fd, io_callback_t callback, void *user)
+{
+	(void)fd;
+	(void)callback;
+	(void)user;
+	return false;
+}
+
+bool EventManager::submitSend(int fd, const struct iovec *iov, int count, io_callback_t callback, void *user)
+{
+	(void)fd;
+	(void)iov;
+	(void)count;
+	(void)callback;
+	(void)user;
+	return false;
+}
+
+void EventManager::setStats(LoopStats *stats) throw()
+{
+	_stats = stats;
+}
+
+void EventManager::countWait() throw()
+{
+	if (_stats)
+		++_stats->wait_calls;
+}
+
+void EventManager::countControl() throw()
+{
+	if (_stats)
+		++_stats->ctl_calls;
+}
+
+std::string eventMaskToString(uint32_t events)
+{
+	std::string names;
+
+	if (events & EVENT_READ) {
+		names += "READ";
+	}
+	if (events & EVENT_WRITE) {
+		if (!names.empty())
+			names += "|";
+		names += "WRITE";
+	}
+	if (events & EVENT_ERROR) {
+		if (!names.empty())
+			names += "|";
+		names += "ERROR";
+	}
+	if (events & EVENT_EDGE) {
+		if (!names.empty())
+			names += "|";
+		names += "EDGE";
+	}
+	if (events & EVENT_EXCLUSIVE) {
+		if (!names.empty())
+			names += "|";
+		names += "EXCLUSIVE";
+	}
+	if (names.empty()) {
+		std::ostringstream oss;
+		oss << "0x" << std::hex << events;
+		names = oss.str();
+	}
+	return names;
+}
@@ -0,0 +1,100 @@
+#ifndef EVENTMANAGER_HPP
+#define EVENTMANAGER_HPP
+
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <string>
+#include <stdint.h>
+#include "LoopStats.hpp"
+
+struct BufferSegment;
+
+// Event masks are the epoll ones; poll(2) uses the same values, so the
+// io_uring backend passes them through unchanged
+enum EventType {
+    EVENT_READ = EPOLLIN,
+    EVENT_WRITE = EPOLLOUT,
+    EVENT_ERROR = EPOLLERR | EPOLLHUP,
+    __EVENT_COUNTS__
+};
+
+// Modifier for bindToFd: report readiness changes only (EPOLLET). The owner
+// must then drain the fd until it would block before waiting again.
+static const uint32_t EVENT_EDGE = EPOLLET;
+
+// Modifier for bindToFd on an fd shared with other epoll instances (listen
+// sockets inherited by worker processes): wake only one of the waiters.
+// Only valid when the fd is first added, never on a later MOD.
+static const uint32_t EVENT_EXCLUSIVE = EPOLLEXCLUSIVE;
+
+// Readiness notification surface shared by the epoll and io_uring backends.
+// Callbacks are bound per fd and event; watchForEvents waits and dispatches.
+class EventManager
+{
+	public:
+		typedef void (*callback_t)(int, void *);
+		// fd, result of the operation (bytes, accepted fd or -errno), the
+		// buffer received into (owned by the callback from then on) or NULL
+		typedef void (*io_callback_t)(int, int, BufferSegment *, void *);
+
+		bool failed;
+
+		// "epoll" or "io_uring"; falls back to epoll when io_uring cannot be
+		// set up. Never NULL, check failed.
+		static EventManager *create(const std::string &backend);
+
+		virtual ~EventManager();
+
+		virtual const char *name() const throw() = 0;
+
+		virtual bool isTracked(int fd) const throw() = 0;
+
+		virtual bool isTracked(int fd, int event) const throw() = 0;
+
+		virtual int getTrackedEvents(int fd) const throw() = 0;
+
+		virtual bool bindToFd(int fd, uint32_t event, callback_t callback, void *user = NULL) = 0;
+
+		virtual bool unbindFd(int fd, int event) throw() = 0;
+
+		// Blocks until an event arrives or timeout_ms elapses (-1 waits forever).
+		// Returns the number of events dispatched, 0 on timeout/signal, -1 on failure.
+		virtual int watchForEvents(void *ptr, int timeout_ms) throw() = 0;
+
+		// Completion-based I/O (io_uring): the backend makes the accept, recv
+		// and send calls itself and hands over their results. Only when
+		// supportsCompletions(); the other methods then return false.
+		virtual bool supportsCompletions() const throw();
+
+		// Multishot accept/recv, tracked as EVENT_READ: isTracked and
+		// unbindFd apply. An fd bound this way takes no other event. A recv
+		// that finds no buffer completes with -ENOBUFS and stays unarmed
+		// until unbound and bound again.
+		virtual bool bindAccept(int fd, io_callback_t callback, void *user = NULL);
+
+		virtual bool bindRecv(int fd, io_callback_t callback, void *user = NULL);
+
+		// One send of iov (copied, the data itself must stay in place until
+		// the callback). It always completes, unbindFd does not cancel it.
+		virtual bool submitSend(int fd, const struct iovec *iov, int count, io_callback_t callback, void *user = NULL);
+
+		// Counts wait and control syscalls into stats
+		void setStats(LoopStats *stats) throw();
+
+	protected:
+		LoopStats *_stats;
+
+		EventManager();
+
+		void countWait() throw();
+
+		void countControl() throw();
+
+	private:
+		EventManager(const EventManager &);
+		EventManager &operator=(const EventManager &);
+};
+
+std::string eventMaskToString(uint32_t events);
+
+#endif
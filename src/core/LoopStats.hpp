@@ -0,0 +1,29 @@
+#ifndef LOOPSTATS_HPP
+#define LOOPSTATS_HPP
+
+// Event loop counters, logged every STATS_INTERVAL seconds and at shutdown
+struct LoopStats {
+    unsigned long iterations;      // passes through Server::run
+    unsigned long idle_wakeups;    // the event wait returned without any event
+    unsigned long events;          // ready fds dispatched
+    unsigned long requests;        // complete requests handed to a handler
+    unsigned long accept_calls;    // accept4() syscalls
+    unsigned long accept_wakeups;  // listen socket reported readable
+    unsigned long accepted;        // connections accepted
+    unsigned long accepted_with_data;  // request already readable at accept (defer accept / fast open)
+    unsigned long shed_connections;    // accepted above max_connections, answered 503 and closed
+    unsigned long accept_pauses;       // listen sockets unbound at worker_connections or fd exhaustion
+    unsigned long accept_budget_hits;  // wakeups that stopped at accept_budget with the queue maybe not empty
+    unsigned long listen_overflows;    // TcpExt ListenOverflows since start, host-wide (worker 0 only)
+    unsigned long recv_calls;      // recv()/readv() syscalls on client sockets
+    unsigned long send_calls;      // send()/writev() syscalls on client sockets
+    unsigned long write_arms;      // EVENT_WRITE bound because output was left unsent
+    unsigned long write_events;    // EVENT_WRITE dispatched to a client
+    unsigned long spurious_write_wakeups;  // EPOLLOUT reported with nothing queued
+    unsigned long wait_calls;      // epoll_wait / io_uring_enter to wait for events
+    unsigned long ctl_calls;       // epoll_ctl, or io_uring_enter forced by a full submission ring
+
+    LoopStats();
+};
+
+#endif
@@ -0,0 +1,680 @@
+#include "Master.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+#include "BufferPool.hpp"
+#include <csignal>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+int Master::_running_loops = 0;
+
+Master::WorkerProcess::WorkerProcess() : pid(-1), started(0), respawn_at(0) {
+}
+
+Master::Master() : _config(0), _upgrade_pid(-1) {
+    sigemptyset(&_saved_mask);
+}
+
+Master::~Master() {
+    stop();
+    if (_config) {
+        _config->release();
+    }
+}
+
+void Master::setArguments(char** argv) {
+    _arguments.clear();
+    for (int i = 0; argv[i]; ++i) {
+        _arguments.push_back(argv[i]);
+    }
+}
+
+bool Master::init(Config* config) {
+    _config = config;
+    _config->retain();
+    BufferPool::setHugePages(_config->getEvents().hugePages);
+    BufferPool::setLimit(_config->getEvents().ioBufferLimit);
+
+    Server::inheritListenSockets();
+    bool started = _config->getEvents().workerProcesses > 0 ? openSharedListenSockets() : startWorkers(0);
+    Server::closeInheritedSockets();
+    if (started) {
+        notifyPreviousBinary();
+    }
+    return started;
+}
+
+void Master::run() {
+    if (_config && _config->getEvents().workerProcesses > 0) {
+        superviseProcesses();
+    } else {
+        runWorkers();
+    }
+}
+
+void Master::stop() {
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        Server::unregisterInstance(_workers[i]);
+        delete _workers[i];
+    }
+    _workers.clear();
+
+    for (size_t i = 0; i < _shared_listen_fds.size(); ++i) {
+        close(_shared_listen_fds[i]);
+    }
+    _shared_listen_fds.clear();
+}
+
+bool Master::startWorkers(int first_id) {
+    int count = _config->getEvents().workerThreads;
+
+    for (int i = 0; i < count; ++i) {
+        Server* worker = new Server();
+        worker->setWorkerId(first_id + i);
+        _workers.push_back(worker);
+        Server::registerInstance(worker);
+
+        if (!worker->init(_config, _shared_listen_fds) || !worker->start()) {
+            Logger::error("Failed to start worker " + Utils::intToString(first_id + i));
+            return false;
+        }
+    }
+
+    Logger::info("Started " + Utils::intToString(count) + " worker(s)");
+    return true;
+}
+
+void* Master::workerMain(void* arg) {
+    Server* worker = static_cast<Server*>(arg);
+    worker->run();
+    // One loop leaving (/stop, fatal epoll error) takes the others with it;
+    // a drained one just leaves
+    if (!worker->isDraining()) {
+        Server::requestShutdownAll();
+    }
+    // Wakes the sigwaitinfo in runWorkers
+    __atomic_sub_fetch(&_running_loops, 1, __ATOMIC_ACQ_REL);
+    kill(getpid(), SIGUSR1);
+    return NULL;
+}
+
+void Master::runWorkers() {
+    if (_workers.empty()) {
+        return;
+    }
+
+    // Blocked before the threads start so they all inherit the mask: the
+    // signals are only ever taken here, synchronously, and a reload never
+    // runs inside a signal handler
+    sigset_t signals;
+    sigset_t previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGQUIT);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    sigaddset(&signals, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        pthread_t thread;
+        __atomic_add_fetch(&_running_loops, 1, __ATOMIC_ACQ_REL);
+        if (pthread_create(&thread, NULL, workerMain, _workers[i]) != 0) {
+            __atomic_sub_fetch(&_running_loops, 1, __ATOMIC_ACQ_REL);
+            Logger::error("Failed to create thread for worker " + Utils::intToString(i));
+            Server::requestShutdownAll();
+            break;
+        }
+        _threads.push_back(thread);
+    }
+
+    // First SIGINT/SIGTERM drains, a second one stops right away
+    bool draining = false;
+    while (__atomic_load_n(&_running_loops, __ATOMIC_ACQUIRE) > 0) {
+        int sig = sigwaitinfo(&signals, NULL);
+        if ((sig == SIGINT || sig == SIGTERM) && !draining && _config->getEvents().drainTimeout > 0) {
+            Logger::info("Received shutdown signal, draining connections (send again to stop now)");
+            draining = true;
+            Server::requestDrainAll();
+        } else if (sig == SIGINT || sig == SIGTERM) {
+            Logger::info("Received shutdown signal");
+            Server::requestShutdownAll();
+        } else if (sig == SIGHUP) {
+            // Worker processes are reloaded by replacing them, see reloadProcesses
+            if (_shared_listen_fds.empty()) {
+                reloadWorkers();
+            }
+        } else if (sig == SIGQUIT) {
+            Logger::info("Received drain signal");
+            draining = true;
+            Server::requestDrainAll();
+        } else if (sig == SIGUSR2) {
+            if (_shared_listen_fds.empty()) {
+                upgrade();
+            }
+        } else if (sig == SIGCHLD && _upgrade_pid != -1) {
+            // Only the new binary: CGI children are waited for by their handler
+            int status;
+            if (waitpid(_upgrade_pid, &status, WNOHANG) == _upgrade_pid) {
+                reapUpgrade(_upgrade_pid, status);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        pthread_join(_threads[i], NULL);
+    }
+    _threads.clear();
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+// A file that no longer parses changes nothing: NULL, the current snapshot
+// stays in use
+Config* Master::loadConfig() const {
+    Config* config = new Config();
+    if (!config->parseFile(_config->getConfigFile()) || !config->isValid()) {
+        Logger::error("Reload failed, keeping the current configuration");
+        config->release();
+        return NULL;
+    }
+    return config;
+}
+
+// Each loop takes the new snapshot before its next wait and updates its own
+// listen sockets; this thread only parses
+void Master::reloadWorkers() {
+    Config* config = loadConfig();
+    if (!config) {
+        return;
+    }
+    Logger::info("Reloading configuration from " + config->getConfigFile());
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        _workers[i]->requestReload(config);
+    }
+    _config->release();
+    _config = config;
+}
+
+// Bound once here and inherited by every worker process
+bool Master::openSharedListenSockets() {
+    const std::vector<ServerConfig>& servers = _config->getServers();
+    for (size_t i = 0; i < servers.size(); ++i) {
+        int fd = Server::createSocket(servers[i], false);
+        if (fd == -1) {
+            Logger::error("Failed to setup listen socket for port " + Utils::intToString(servers[i].getPort()));
+            stop();
+            return false;
+        }
+        _shared_listen_fds.push_back(fd);
+        Logger::info("Master listening on " + servers[i].getHost() + ":" + Utils::intToString(servers[i].getPort()));
+    }
+    return true;
+}
+
+// SIGUSR2. Everything execve needs is prepared before fork: the child of a
+// threaded process may only make syscalls. The child clears close-on-exec on
+// every listening socket it has and lists them in WEBSERV_LISTEN_FDS; the
+// new process finds their addresses with getsockname.
+void Master::upgrade() {
+    if (_upgrade_pid != -1) {
+        Logger::warning("Upgrade already in progress (pid " + Utils::intToString(_upgrade_pid) + ")");
+        return;
+    }
+    if (_arguments.empty()) {
+        Logger::error("Cannot upgrade: command line unknown");
+        return;
+    }
+
+    std::vector<std::string> environment;
+    for (char** var = environ; *var; ++var) {
+        if (std::strncmp(*var, "WEBSERV_", 8) != 0) {
+            environment.push_back(*var);
+        }
+    }
+    environment.push_back("WEBSERV_UPGRADE_PID=" + Utils::intToString(getpid()));
+
+    std::vector<char*> argv;
+    for (size_t i = 0; i < _arguments.size(); ++i) {
+        argv.push_back(const_cast<char*>(_arguments[i].c_str()));
+    }
+    argv.push_back(NULL);
+
+    std::vector<char> listen_fds(LISTEN_FDS_VAR_SIZE);
+    std::vector<char*> envp;
+    for (size_t i = 0; i < environment.size(); ++i) {
+        envp.push_back(const_cast<char*>(environment[i].c_str()));
+    }
+    envp.push_back(&listen_fds[0]);
+    envp.push_back(NULL);
+
+    struct rlimit limit;
+    int max_fd = getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY
+        ? static_cast<int>(limit.rlim_cur) : 1024;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        Logger::error("Failed to fork for upgrade");
+        return;
+    }
+
+    if (pid == 0) {
+        const char prefix[] = "WEBSERV_LISTEN_FDS=";
+        size_t used = sizeof(prefix) - 1;
+        std::memcpy(&listen_fds[0], prefix, used);
+
+        for (int fd = 3; fd < max_fd; ++fd) {
+            int listening = 0;
+            socklen_t len = sizeof(listening);
+            if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == -1 || !listening) {
+                continue;
+            }
+            char digits[16];
+            size_t count = 0;
+            for (int n = fd; n > 0; n /= 10) {
+                digits[count++] = static_cast<char>('0' + n % 10);
+            }
+            if (used + count + 2 > listen_fds.size()) {
+                break;
+            }
+            while (count > 0) {
+                listen_fds[used++] = digits[--count];
+            }
+            listen_fds[used++] = ';';
+            fcntl(fd, F_SETFD, 0);
+        }
+        listen_fds[used] = '\0';
+
+        // The supervisor blocks the signals it waits for; masks survive exec
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        execve(argv[0], &argv[0], &envp[0]);
+        _exit(127);
+    }
+
+    _upgrade_pid = pid;
+    Logger::info("Upgrade: started " + _arguments[0] + " (pid " + Utils::intToString(pid) + ")");
+}
+
+// The new binary exiting at all means it did not take over (it would have
+// outlived us): keep serving
+bool Master::reapUpgrade(pid_t pid, int status) {
+    if (pid != _upgrade_pid) {
+        return false;
+    }
+    _upgrade_pid = -1;
+    std::string reason = WIFSIGNALED(status)
+        ? "killed by signal " + Utils::intToString(WTERMSIG(status))
+        : "exited with status " + Utils::intToString(WEXITSTATUS(status));
+    Logger::error("Upgrade failed: new binary " + reason + ", still serving");
+    return true;
+}
+
+// Started by the SIGUSR2 of a running webserv: now that the sockets are
+// ours, tell it to drain. The pid is checked against our parent so a stale
+// variable cannot signal an unrelated process.
+void Master::notifyPreviousBinary() {
+    const char* value = getenv("WEBSERV_UPGRADE_PID");
+    if (!value) {
+        return;
+    }
+    pid_t previous = static_cast<pid_t>(std::atoi(value));
+    unsetenv("WEBSERV_UPGRADE_PID");
+    if (previous > 1 && previous == getppid()) {
+        Logger::info("Upgrade: asking previous process " + Utils::intToString(previous) + " to drain");
+        kill(previous, SIGQUIT);
+    }
+}
+
+// SIGQUIT on the master: every worker drains, none is restarted, and the
+// master leaves once they are all gone. Its own copies of the listen sockets
+// close right away; whoever else holds them (an upgraded binary) keeps
+// accepting.
+void Master::drainProcesses() {
+    Logger::info("Received drain signal");
+    for (size_t slot = 0; slot < _processes.size(); ++slot) {
+        if (_processes[slot].pid != -1) {
+            kill(_processes[slot].pid, SIGQUIT);
+            _retiring.push_back(_processes[slot].pid);
+        }
+    }
+    _processes.clear();
+    for (size_t i = 0; i < _shared_listen_fds.size(); ++i) {
+        close(_shared_listen_fds[i]);
+    }
+    _shared_listen_fds.clear();
+}
+
+// Same matching as Server::applyConfig: sockets for addresses still
+// configured are carried over with their backlog, new ones are bound, the
+// others closed (the retiring workers hold their own copies). Nothing changes
+// if a new address cannot be bound.
+bool Master::updateSharedListenSockets(const Config& config) {
+    const std::vector<ServerConfig>& servers = config.getServers();
+    const std::vector<ServerConfig>& current = _config->getServers();
+    std::vector<int> fds;
+    std::vector<bool> kept(_shared_listen_fds.size(), false);
+    std::vector<bool> opened(servers.size(), false);
+
+    for (size_t i = 0; i < servers.size(); ++i) {
+        size_t j = 0;
+        while (j < current.size() && (kept[j] || current[j].getPort() != servers[i].getPort()
+                                      || current[j].getHost() != servers[i].getHost())) {
+            ++j;
+        }
+        if (j < current.size()) {
+            kept[j] = true;
+            Server::retuneSocket(_shared_listen_fds[j], servers[i]);
+            fds.push_back(_shared_listen_fds[j]);
+            continue;
+        }
+
+        int fd = Server::createSocket(servers[i], false);
+        if (fd == -1) {
+            Logger::error("Failed to setup listen socket for port " + Utils::intToString(servers[i].getPort()));
+            for (size_t k = 0; k < fds.size(); ++k) {
+                if (opened[k]) {
+                    close(fds[k]);
+                }
+            }
+            return false;
+        }
+        opened[i] = true;
+        fds.push_back(fd);
+        Logger::info("Master listening on " + servers[i].getHost() + ":" + Utils::intToString(servers[i].getPort()));
+    }
+
+    for (size_t j = 0; j < _shared_listen_fds.size(); ++j) {
+        if (!kept[j]) {
+            close(_shared_listen_fds[j]);
+            Logger::info("Master stopped listening on " + current[j].getHost() + ":"
+                         + Utils::intToString(current[j].getPort()));
+        }
+    }
+    _shared_listen_fds.swap(fds);
+    return true;
+}
+
+// The new generation starts before the old one is told to drain: the listen
+// sockets are shared, so every address has a worker accepting at all times.
+// Unlike a reload in place this also applies the events block.
+void Master::reloadProcesses() {
+    Config* config = loadConfig();
+    if (!config) {
+        return;
+    }
+    if (!updateSharedListenSockets(*config)) {
+        Logger::error("Reload failed, keeping the current configuration");
+        config->release();
+        return;
+    }
+    Logger::info("Reloading configuration from " + config->getConfigFile());
+    _config->release();
+    _config = config;
+    // The master never uses the pool: the new generation starts with the new setting
+    BufferPool::setHugePages(_config->getEvents().hugePages);
+    BufferPool::setLimit(_config->getEvents().ioBufferLimit);
+
+    std::vector<WorkerProcess> previous;
+    previous.swap(_processes);
+    _processes.assign(_config->getEvents().workerProcesses, WorkerProcess());
+    for (size_t slot = 0; slot < _processes.size(); ++slot) {
+        spawnProcess(slot);
+    }
+
+    for (size_t slot = 0; slot < previous.size(); ++slot) {
+        if (previous[slot].pid != -1) {
+            kill(previous[slot].pid, SIGQUIT);
+            _retiring.push_back(previous[slot].pid);
+        }
+    }
+    Logger::info("Retiring " + Utils::intToString(_retiring.size()) + " worker process(es)");
+}
+
+void Master::superviseProcesses() {
+    // Signals are consumed synchronously with sigtimedwait: nothing else runs
+    // in the master, and there is no window between checking and sleeping
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGQUIT);
+    sigaddset(&signals, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &signals, &_saved_mask);
+
+    _processes.assign(_config->getEvents().workerProcesses, WorkerProcess());
+    for (size_t slot = 0; slot < _processes.size(); ++slot) {
+        spawnProcess(slot);
+    }
+
+    bool stop_requested = false;
+    bool draining = false;
+    while (!stop_requested && !(draining && _retiring.empty())) {
+        int timeout = nextRespawnTimeout();
+        int sig;
+        if (timeout < 0) {
+            sig = sigwaitinfo(&signals, NULL);
+        } else {
+            struct timespec ts;
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000L;
+            sig = sigtimedwait(&signals, NULL, &ts);
+        }
+
+        if (sig == SIGINT || sig == SIGTERM) {
+            Logger::info("Received shutdown signal");
+            break;
+        }
+        if (sig == SIGCHLD) {
+            reapProcesses(stop_requested);
+        }
+        if (sig == SIGHUP && !draining) {
+            reloadProcesses();
+        }
+        if (sig == SIGUSR2 && !draining) {
+            upgrade();
+        }
+        if (sig == SIGQUIT && !draining) {
+            draining = true;
+            drainProcesses();
+        }
+
+        msec_t now = TimerWheel::monotonicMs();
+        for (size_t slot = 0; slot < _processes.size() && !stop_requested; ++slot) {
+            if (_processes[slot].pid == -1 && _processes[slot].respawn_at != 0
+                && _processes[slot].respawn_at <= now) {
+                spawnProcess(slot);
+            }
+        }
+    }
+
+    stopProcesses();
+    sigprocmask(SIG_SETMASK, &_saved_mask, NULL);
+}
+
+bool Master::spawnProcess(size_t slot) {
+    WorkerProcess& process = _processes[slot];
+    msec_t now = TimerWheel::monotonicMs();
+    pid_t master_pid = getpid();
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        Logger::error("Failed to fork worker process " + Utils::intToString(slot));
+        process.respawn_at = now + RESPAWN_DELAY_MS;
+        return false;
+    }
+
+    if (pid == 0) {
+        // Worker: die with the master, take signals through Server again
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != master_pid) {
+            std::exit(1);
+        }
+        sigprocmask(SIG_SETMASK, &_saved_mask, NULL);
+        _processes.clear();
+        _retiring.clear();
+
+        int status = 1;
+        int threads = _config->getEvents().workerThreads;
+        if (startWorkers(static_cast<int>(slot) * threads)) {
+            runWorkers();
+            status = 0;
+        }
+        stop();
+        std::exit(status);
+    }
+
+    process.pid = pid;
+    process.started = now;
+    process.respawn_at = 0;
+    Logger::info("Started worker process " + Utils::intToString(pid));
+    return true;
+}
+
+// A worker exiting with status 0 was asked to stop (/stop): the whole host
+// stops with it. Anything else is a crash and the slot gets restarted.
+void Master::reapProcesses(bool& stop_requested) {
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if (reapUpgrade(pid, status)) {
+            continue;
+        }
+        std::vector<pid_t>::iterator retired = std::find(_retiring.begin(), _retiring.end(), pid);
+        if (retired != _retiring.end()) {
+            _retiring.erase(retired);
+            Logger::info("Retired worker process " + Utils::intToString(pid) + " exited");
+            continue;
+        }
+        for (size_t slot = 0; slot < _processes.size(); ++slot) {
+            WorkerProcess& process = _processes[slot];
+            if (process.pid != pid) {
+                continue;
+            }
+            process.pid = -1;
+
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                Logger::info("Worker process " + Utils::intToString(pid) + " exited");
+                stop_requested = true;
+                break;
+            }
+
+            std::string reason = WIFSIGNALED(status)
+                ? "killed by signal " + Utils::intToString(WTERMSIG(status))
+                : "exited with status " + Utils::intToString(WEXITSTATUS(status));
+            Logger::error("Worker process " + Utils::intToString(pid) + " " + reason + ", restarting");
+
+            msec_t now = TimerWheel::monotonicMs();
+            process.respawn_at = now - process.started < RESPAWN_DELAY_MS
+                ? process.started + RESPAWN_DELAY_MS : now;
+            break;
+        }
+    }
+}
+
+// Workers drain on SIGTERM (drain_timeout) and are killed if they are still
+// there STOP_TIMEOUT seconds after that. Another SIGINT/SIGTERM meanwhile is
+// passed on: the workers then stop at once.
+void Master::stopProcesses() {
+    // Retiring workers are drained as well, with the same deadline
+    for (size_t i = 0; i < _retiring.size(); ++i) {
+        WorkerProcess process;
+        process.pid = _retiring[i];
+        _processes.push_back(process);
+    }
+    _retiring.clear();
+
+    for (size_t slot = 0; slot < _processes.size(); ++slot) {
+        if (_processes[slot].pid != -1) {
+            kill(_processes[slot].pid, SIGTERM);
+        }
+    }
+
+    // The address stops queuing connections as soon as the workers have
+    // closed their copies too
+    for (size_t i = 0; i < _shared_listen_fds.size(); ++i) {
+        close(_shared_listen_fds[i]);
+    }
+    _shared_listen_fds.clear();
+
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigaddset(&chld, SIGINT);
+    sigaddset(&chld, SIGTERM);
+    msec_t deadline = TimerWheel::monotonicMs()
+        + static_cast<msec_t>(_config->getEvents().drainTimeout + STOP_TIMEOUT) * 1000;
+
+    while (true) {
+        size_t alive = 0;
+        for (size_t slot = 0; slot < _processes.size(); ++slot) {
+            WorkerProcess& process = _processes[slot];
+            if (process.pid != -1 && waitpid(process.pid, NULL, WNOHANG) == 0) {
+                ++alive;
+            } else {
+                process.pid = -1;
+            }
+        }
+        if (alive == 0) {
+            break;
+        }
+
+        msec_t now = TimerWheel::monotonicMs();
+        if (now >= deadline) {
+            Logger::warning("Worker processes did not stop in time, killing them");
+            for (size_t slot = 0; slot < _processes.size(); ++slot) {
+                if (_processes[slot].pid != -1) {
+                    kill(_processes[slot].pid, SIGKILL);
+                    waitpid(_processes[slot].pid, NULL, 0);
+                    _processes[slot].pid = -1;
+                }
+            }
+            break;
+        }
+
+        struct timespec ts;
+        ts.tv_sec = (deadline - now) / 1000;
+        ts.tv_nsec = ((deadline - now) % 1000) * 1000000L;
+        int sig = sigtimedwait(&chld, NULL, &ts);
+        if (sig == SIGINT || sig == SIGTERM) {
+            Logger::info("Received shutdown signal, stopping workers now");
+            for (size_t slot = 0; slot < _processes.size(); ++slot) {
+                if (_processes[slot].pid != -1) {
+                    kill(_processes[slot].pid, SIGTERM);
+                }
+            }
+        }
+    }
+    _processes.clear();
+    Logger::info("All worker processes stopped");
+}
+
+// Milliseconds until the next pending restart, -1 if none
+int Master::nextRespawnTimeout() const {
+    msec_t now = TimerWheel::monotonicMs();
+    int timeout = -1;
+
+    for (size_t slot = 0; slot < _processes.size(); ++slot) {
+        const WorkerProcess& process = _processes[slot];
+        if (process.pid != -1 || process.respawn_at == 0) {
+            continue;
+        }
+        int wait = process.respawn_at > now ? static_cast<int>(process.respawn_at - now) : 0;
+        if (timeout < 0 || wait < timeout) {
+            timeout = wait;
+        }
+    }
+    return timeout;
+}
@@ -0,0 +1,91 @@
+#ifndef MASTER_HPP
+#define MASTER_HPP
+
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+#include <signal.h>
+#include "Server.hpp"
+#include "TimerWheel.hpp"
+#include "Config.hpp"
+
+// Owns the event loops. Each worker is a complete Server (epoll instance,
+// client table, timers, listen sockets) running in its own thread; the only
+// thing they share is the read-only Config snapshot. The calling thread
+// takes the signals: SIGINT/SIGTERM and SIGQUIT drain the loops (finish
+// what is in progress, at most drain_timeout seconds), a second SIGINT/SIGTERM
+// stops them at once, SIGHUP parses the config file again and hands the new
+// snapshot to every loop.
+//
+// With worker_processes N the process becomes a supervisor instead: it binds
+// the listen sockets once, forks N workers that each run the loops above on
+// the inherited sockets, restarts the ones that crash and stops them all on
+// SIGINT/SIGTERM. On SIGHUP it forks a new generation of workers with the
+// new config and retires the previous one (SIGQUIT).
+//
+// In both modes SIGUSR2 starts the binary again (nginx style upgrade): the
+// new process takes over the listen sockets and, once it serves, sends
+// SIGQUIT to this one, which drains and exits.
+class Master {
+private:
+    struct WorkerProcess {
+        pid_t pid;
+        msec_t started;
+        msec_t respawn_at;  // crashed and waiting to be restarted, 0 otherwise
+
+        WorkerProcess();
+    };
+
+    Config* _config;
+    std::vector<Server*> _workers;
+    std::vector<pthread_t> _threads;
+    std::vector<int> _shared_listen_fds;
+    std::vector<WorkerProcess> _processes;
+    std::vector<pid_t> _retiring;   // previous generation, draining after a reload
+    sigset_t _saved_mask;   // signal mask to restore in forked workers
+    std::vector<std::string> _arguments;    // command line, to exec on upgrade
+    pid_t _upgrade_pid;     // new binary started by SIGUSR2, -1 if none
+
+    // A worker dying sooner than this after start is restarted only once the
+    // delay has passed, so a worker crashing at startup cannot fork-loop
+    static const msec_t RESPAWN_DELAY_MS = 1000;
+    static const int STOP_TIMEOUT = 10;
+    static const size_t LISTEN_FDS_VAR_SIZE = 4096;
+
+    static int _running_loops;     // worker threads still in Server::run
+
+    static void* workerMain(void* arg);
+
+    bool startWorkers(int first_id);
+    void runWorkers();
+    Config* loadConfig() const;
+    void reloadWorkers();
+    bool openSharedListenSockets();
+    bool updateSharedListenSockets(const Config& config);
+    void reloadProcesses();
+    void drainProcesses();
+    void upgrade();
+    bool reapUpgrade(pid_t pid, int status);
+    void notifyPreviousBinary();
+    void superviseProcesses();
+    bool spawnProcess(size_t slot);
+    void reapProcesses(bool& stop_requested);
+    void stopProcesses();
+    int nextRespawnTimeout() const;
+
+public:
+    Master();
+    ~Master();
+
+    // argv as given to main, re-executed on SIGUSR2
+    void setArguments(char** argv);
+    bool init(Config* config);
+    void run();
+    void stop();
+
+private:
+    Master(const Master&);
+    Master& operator=(const Master&);
+};
+
+#endif
@@ -3,93 +3,248 @@
 #include "Utils.hpp"
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <csignal>
 #include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
 #include <algorithm>
 #include "HTTPParser.hpp"
 #include "FileServer.hpp"
 #include "HTTPResponse.hpp"
 #include "CGIHandler.hpp"
+#include "BufferPool.hpp"
 
 
-Server* Server::_signalInstance = NULL;
+std::vector<Server*> Server::_instances;
+std::vector<Server::InheritedSocket> Server::_inherited;
+long Server::_open_connections = 0;
 
-Server::Server() : _epoll_manager(0), _config(0), _running(false), _shouldStop(false) {
+// Sent as is to connections shed above max_connections: no parsing, no
+// allocation, one send
+static const char OVERLOAD_RESPONSE[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Type: text/html\r\n"
+    "Content-Length: 58\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "<html><body><h1>503 Service Unavailable</h1></body></html>";
+
+// SYNs dropped because an accept queue was full, from the TcpExt counters.
+// The kernel only keeps this per network namespace, not per socket.
+static bool readListenOverflows(unsigned long& count) {
+    std::ifstream file("/proc/net/netstat");
+    std::string names;
+    std::string values;
+
+    while (std::getline(file, names) && std::getline(file, values)) {
+        if (names.compare(0, 7, "TcpExt:") != 0) {
+            continue;
+        }
+        std::istringstream name_stream(names);
+        std::istringstream value_stream(values);
+        std::string name;
+        std::string value;
+        while (name_stream >> name && value_stream >> value) {
+            if (name == "ListenOverflows") {
+                count = std::strtoul(value.c_str(), NULL, 10);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static std::string formatRatio(unsigned long count, unsigned long total) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.2f", total ? static_cast<double>(count) / total : 0.0);
+    return buffer;
+}
+
+LoopStats::LoopStats()
+    : iterations(0), idle_wakeups(0), events(0), requests(0),
+      accept_calls(0), accept_wakeups(0), accepted(0), accepted_with_data(0),
+      shed_connections(0), accept_pauses(0), accept_budget_hits(0), listen_overflows(0),
+      recv_calls(0), send_calls(0),
+      write_arms(0), write_events(0), spurious_write_wakeups(0), wait_calls(0), ctl_calls(0) {
+}
+
+Server::Server()
+    : _event_manager(NULL), _read_retry_at(0), _write_armed(0), _config(0), _pending_config(0), _running(false), _shouldStop(false),
+      _edge_triggered(false), _completions(false), _accept_budget(1), _worker_connections(0),
+      _max_connections(0), _accept_paused(false), _accept_resume_at(0), _reuse_port(false), _shared_listen(false),
+      _drain_requested(false), _draining(false), _drain_timeout(0), _drain_deadline(0), _worker_id(0),
+      _next_stats_log(0), _listen_overflows_base(0) {
+    _wake_fds[0] = -1;
+    _wake_fds[1] = -1;
 }
 
 Server::~Server() {
     stop();
+    delete _event_manager;
+    if (_pending_config) {
+        _pending_config->release();
+    }
+    if (_config) {
+        _config->release();
+    }
+}
+
+// Registration happens before any worker starts and after all of them have
+// stopped, so the list is never modified while a signal can walk it.
+void Server::registerInstance(Server* instance) {
+    _instances.push_back(instance);
+}
+
+void Server::unregisterInstance(Server* instance) {
+    std::vector<Server*>::iterator it = std::find(_instances.begin(), _instances.end(), instance);
+    if (it != _instances.end()) {
+        _instances.erase(it);
+    }
+}
+
+void Server::requestShutdownAll() {
+    for (size_t i = 0; i < _instances.size(); ++i) {
+        _instances[i]->requestShutdown();
+    }
 }
 
-void Server::setSignalInstance(Server* instance) {
-    _signalInstance = instance;
+void Server::requestDrainAll() {
+    for (size_t i = 0; i < _instances.size(); ++i) {
+        _instances[i]->requestDrain();
+    }
 }
 
 void Server::signalHandler(int signum) {
     if (signum == SIGINT || signum == SIGTERM) {
         Logger::info("Received shutdown signal");
-        if (_signalInstance) {
-            _signalInstance->requestShutdown();
-        }
+        requestShutdownAll();
     }
 }
 
 void Server::requestShutdown() {
     _running = false;
+    wake();
+}
+
+// Async-signal-safe: a single write to the self-pipe
+void Server::wake() {
+    if (_wake_fds[1] != -1) {
+        ssize_t ret = write(_wake_fds[1], "", 1);
+        (void)ret;
+    }
+}
+
+// The previous pending snapshot, if the loop has not picked it up yet, is
+// simply replaced
+void Server::requestReload(Config* config) {
+    config->retain();
+    Config* previous = __atomic_exchange_n(&_pending_config, config, __ATOMIC_ACQ_REL);
+    if (previous) {
+        previous->release();
+    }
+    wake();
+}
+
+void Server::requestDrain() {
+    _drain_requested = true;
+    wake();
+}
+
+void Server::handleWakeup(int wake_fd, Server *server) {
+    char buffer[64];
+    while (read(wake_fd, buffer, sizeof(buffer)) > 0) {
+    }
+    (void)server;
 }
 
-bool Server::init(Config* config) {
+bool Server::init(Config* config, const std::vector<int>& shared_listen_fds) {
     if (!config || !config->isValid()) {
         Logger::error("Invalid configuration");
         return false;
     }
     
     _config = config;
+    _config->retain();
+    _edge_triggered = _config->getEvents().edgeTriggered;
+    _accept_budget = _config->getEvents().acceptBudget;
+    _worker_connections = _config->getEvents().workerConnections;
+    _max_connections = _config->getEvents().maxConnections;
+    _drain_timeout = _config->getEvents().drainTimeout;
+    _shared_listen = !shared_listen_fds.empty();
+    _reuse_port = !_shared_listen && _config->getEvents().workerThreads > 1;
     
-    if (_epoll_manager.failed) {
-        Logger::error("Failed to initialize epoll");
+    _event_manager = EventManager::create(_config->getEvents().backend);
+    if (_event_manager->failed) {
+        Logger::error("Failed to initialize the event backend");
+        return false;
+    }
+    _event_manager->setStats(&_stats);
+    _completions = _event_manager->supportsCompletions();
+
+    if (pipe2(_wake_fds, O_NONBLOCK | O_CLOEXEC) == -1
+        || !_event_manager->bindToFd(_wake_fds[0], EVENT_READ, (EventManager::callback_t)handleWakeup)) {
+        Logger::error("Failed to create wakeup pipe");
         return false;
     }
     
     // Setup listen sockets for each server configuration
     const std::vector<ServerConfig>& servers = _config->getServers();
     for (size_t i = 0; i < servers.size(); ++i) {
-        if (!setupListenSocket(servers[i])) {
+        int shared_fd = i < shared_listen_fds.size() ? shared_listen_fds[i] : -1;
+        if (!setupListenSocket(servers[i], shared_fd)) {
             Logger::error("Failed to setup listen socket for port " + Utils::intToString(servers[i].getPort()));
             return false;
         }
     }
     
-    Logger::info("Server initialized successfully");
+    Logger::info("Worker " + Utils::intToString(_worker_id) + " initialized successfully (" + _event_manager->name() + ", "
+                 + (_completions ? "completions" : _edge_triggered ? "edge-triggered" : "level-triggered") + ")");
     return true;
 }
 
-bool Server::setupListenSocket(const ServerConfig& serverConfig) {
-    int listen_fd = createSocket(serverConfig.getHost(), serverConfig.getPort());
+bool Server::setupListenSocket(const ServerConfig& serverConfig, int shared_fd) {
+    // A shared socket is dup'ed so every event loop owns (and closes) its own fd
+    int listen_fd = shared_fd != -1
+        ? fcntl(shared_fd, F_DUPFD_CLOEXEC, 0)
+        : createSocket(serverConfig, _reuse_port);
     if (listen_fd == -1) {
         return false;
     }
     
-    if (!makeNonBlocking(listen_fd)) {
-        close(listen_fd);
-        return false;
-    }
-    
-    if (!_epoll_manager.bindToFd(listen_fd, EVENT_READ, (EpollManager::callback_t)handleNewConnection)) {
+    // While accepting is paused the socket gets bound with the others on resume
+    if (!_accept_paused && !bindListen(listen_fd)) {
         close(listen_fd);
         return false;
     }
     
     _listen_fds.push_back(listen_fd);
+    _listen_configs.push_back(&serverConfig);
     Logger::info("Listening on " + serverConfig.getHost() + ":" + Utils::intToString(serverConfig.getPort()));
     return true;
 }
 
-int Server::createSocket(const std::string& host, int port) {
-    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+int Server::createSocket(const ServerConfig& serverConfig, bool reuse_port) {
+    const std::string& host = serverConfig.getHost();
+    int port = serverConfig.getPort();
+
+    // Already bound by the previous binary, with connections maybe queued
+    int inherited = takeInheritedSocket(serverConfig);
+    if (inherited != -1) {
+        retuneSocket(inherited, serverConfig);
+        Logger::info("Taking over inherited socket for " + host + ":" + Utils::intToString(port));
+        return inherited;
+    }
+
+    // Non-blocking from the start; dup'ed copies share the flag
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (listen_fd == -1) {
         Logger::error("Failed to create socket");
         return -1;
@@ -100,6 +255,17 @@ int Server::createSocket(const std::string& host, int port) {
     if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
         Logger::warning("Failed to set SO_REUSEADDR");
     }
+
+    // One socket per event loop on the same address: the kernel spreads
+    // incoming connections across them
+    if (reuse_port && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        Logger::error("Failed to set SO_REUSEPORT");
+        close(listen_fd);
+        return -1;
+    }
+
+    // Before listen(): the receive buffer size decides the window scale
+    applySocketOptions(listen_fd, serverConfig.getSocketOptions());
     
     // Setup address structure
     struct sockaddr_in addr;
@@ -121,7 +287,7 @@ int Server::createSocket(const std::string& host, int port) {
     }
     
     // Start listening
-    if (listen(listen_fd, LISTEN_BACKLOG) == -1) {
+    if (listen(listen_fd, serverConfig.getListenBacklog()) == -1) {
         Logger::error("Failed to listen on socket");
         close(listen_fd);
         return -1;
@@ -130,19 +296,262 @@ int Server::createSocket(const std::string& host, int port) {
     return listen_fd;
 }
 
-bool Server::makeNonBlocking(int fd) {
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags == -1) {
-        Logger::error("Failed to get socket flags");
-        return false;
+// Options set to 0 in the new config are skipped, not reset: they keep their
+// previous value until the socket is recreated
+void Server::retuneSocket(int listen_fd, const ServerConfig& serverConfig) {
+    applySocketOptions(listen_fd, serverConfig.getSocketOptions());
+    if (listen(listen_fd, serverConfig.getListenBacklog()) == -1) {
+        Logger::warning("Failed to update the listen backlog: " + std::string(strerror(errno)));
     }
-    
-    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
-        Logger::error("Failed to set non-blocking mode");
-        return false;
+}
+
+// "3;4;5;": only fds that really are listening IPv4 sockets are kept, and
+// they go back to close-on-exec so CGI scripts do not inherit them
+void Server::inheritListenSockets() {
+    const char* value = getenv("WEBSERV_LISTEN_FDS");
+    if (!value) {
+        return;
     }
-    
-    return true;
+
+    std::vector<std::string> fds = Utils::split(value, ';');
+    for (size_t i = 0; i < fds.size(); ++i) {
+        if (fds[i].empty()) {
+            continue;
+        }
+        InheritedSocket inherited;
+        inherited.fd = std::atoi(fds[i].c_str());
+
+        int listening = 0;
+        socklen_t len = sizeof(listening);
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        if (inherited.fd < 3 || getsockopt(inherited.fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == -1
+            || !listening || getsockname(inherited.fd, (struct sockaddr*)&addr, &addr_len) == -1
+            || addr.sin_family != AF_INET) {
+            Logger::warning("Ignoring inherited fd " + fds[i] + ": not a listening socket");
+            continue;
+        }
+        fcntl(inherited.fd, F_SETFD, FD_CLOEXEC);
+        inherited.addr = addr.sin_addr;
+        inherited.port = ntohs(addr.sin_port);
+        _inherited.push_back(inherited);
+    }
+    unsetenv("WEBSERV_LISTEN_FDS");
+    Logger::info("Inherited " + Utils::intToString(_inherited.size()) + " listen socket(s)");
+}
+
+void Server::closeInheritedSockets() {
+    for (size_t i = 0; i < _inherited.size(); ++i) {
+        Logger::info("Closing inherited socket for " + std::string(inet_ntoa(_inherited[i].addr)) + ":"
+                     + Utils::intToString(_inherited[i].port) + ", no longer configured");
+        close(_inherited[i].fd);
+    }
+    _inherited.clear();
+}
+
+// With several event loops the previous binary passes one socket per loop
+// and address (SO_REUSEPORT group): each call takes the next one
+int Server::takeInheritedSocket(const ServerConfig& serverConfig) {
+    struct in_addr addr;
+    if (_inherited.empty() || inet_aton(serverConfig.getHost().c_str(), &addr) == 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < _inherited.size(); ++i) {
+        if (_inherited[i].port == serverConfig.getPort() && _inherited[i].addr.s_addr == addr.s_addr) {
+            int fd = _inherited[i].fd;
+            _inherited.erase(_inherited.begin() + i);
+            return fd;
+        }
+    }
+    return -1;
+}
+
+// A failing option only costs performance: warn and keep the socket
+bool Server::applySocketOptions(int listen_fd, const SocketOptions& options) {
+    struct Option {
+        int level;
+        int name;
+        int value;
+        const char* label;
+    };
+    const Option table[] = {
+        { IPPROTO_TCP, TCP_NODELAY, options.tcpNodelay ? 1 : 0, "TCP_NODELAY" },
+        { IPPROTO_TCP, TCP_DEFER_ACCEPT, options.tcpDeferAccept, "TCP_DEFER_ACCEPT" },
+        { IPPROTO_TCP, TCP_FASTOPEN, options.tcpFastOpen, "TCP_FASTOPEN" },
+        { SOL_SOCKET, SO_RCVBUF, options.rcvBuf, "SO_RCVBUF" },
+        { SOL_SOCKET, SO_SNDBUF, options.sndBuf, "SO_SNDBUF" },
+        { SOL_SOCKET, SO_BUSY_POLL, options.busyPoll, "SO_BUSY_POLL" },
+    };
+    bool ok = true;
+
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); ++i) {
+        if (table[i].value == 0) {
+            continue;
+        }
+        if (setsockopt(listen_fd, table[i].level, table[i].name, &table[i].value, sizeof(table[i].value)) == -1) {
+            Logger::warning("Failed to set " + std::string(table[i].label) + ": " + strerror(errno));
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Level-triggered even in edge mode: handleNewConnection stops at the
+// accept budget and relies on the rest of the queue being reported again.
+// Every worker waits on the same shared socket: without EPOLLEXCLUSIVE
+// each connection would wake all of them for a single accept
+uint32_t Server::listenEvents() const {
+    return EVENT_READ | (_shared_listen ? EVENT_EXCLUSIVE : 0);
+}
+
+// A multishot accept with io_uring completions (the kernel only wakes one
+// of the rings waiting on a shared socket), readiness otherwise
+bool Server::bindListen(int listen_fd) {
+    if (_completions) {
+        return _event_manager->bindAccept(listen_fd, (EventManager::io_callback_t)handleAccepted);
+    }
+    return _event_manager->bindToFd(listen_fd, listenEvents(), (EventManager::callback_t)handleNewConnection);
+}
+
+// Unbinds the listen sockets entirely (an EPOLLEXCLUSIVE registration cannot
+// be modified, only deleted and added again). Pending connections wait in
+// the kernel backlog, or go to the other event loops.
+void Server::pauseAccept(msec_t resume_at) {
+    _accept_resume_at = resume_at;
+    if (_accept_paused) {
+        return;
+    }
+    for (size_t i = 0; i < _listen_fds.size(); ++i) {
+        _event_manager->unbindFd(_listen_fds[i], -1);
+    }
+    _accept_paused = true;
+    ++_stats.accept_pauses;
+    Logger::warning("Worker " + Utils::intToString(_worker_id) + " stopped accepting at "
+                    + Utils::intToString(_clients.size()) + " connections");
+}
+
+void Server::resumeAccept() {
+    if (!_accept_paused) {
+        return;
+    }
+    for (size_t i = 0; i < _listen_fds.size(); ++i) {
+        if (!bindListen(_listen_fds[i])) {
+            Logger::error("Failed to rebind listen socket " + Utils::intToString(_listen_fds[i]));
+        }
+    }
+    _accept_paused = false;
+    _accept_resume_at = 0;
+    Logger::info("Worker " + Utils::intToString(_worker_id) + " accepting again");
+}
+
+// Best effort: the request (if already here) is read first so that close()
+// sends a FIN after the 503 rather than a reset
+void Server::shedConnection(int fd) {
+    char discard[4096];
+    ssize_t ret = recv(fd, discard, sizeof(discard), 0);
+    ret = send(fd, OVERLOAD_RESPONSE, sizeof(OVERLOAD_RESPONSE) - 1, MSG_NOSIGNAL);
+    (void)ret;
+    close(fd);
+    ++_stats.shed_connections;
+}
+
+// Runs on the loop's own thread between two waits. Listen sockets are matched
+// by host:port: the ones still configured stay open (connections waiting in
+// their backlog are not lost), new addresses are bound, the others closed.
+// Requests already started keep the snapshot pinned on their Client.
+void Server::applyConfig(Config* config) {
+    const EventsConfig& events = config->getEvents();
+    const EventsConfig& current = _config->getEvents();
+    if (_worker_id == 0 && (events.edgeTriggered != current.edgeTriggered || events.backend != current.backend
+                            || events.workerThreads != current.workerThreads
+                            || events.workerProcesses != current.workerProcesses
+                            || events.hugePages != current.hugePages)) {
+        Logger::warning("edge_triggered, backend, worker_threads, worker_processes and huge_pages changes need a restart");
+    }
+    // Process-wide, applies to buffers taken from now on
+    if (_worker_id == 0) {
+        BufferPool::setLimit(events.ioBufferLimit);
+    }
+    _accept_budget = events.acceptBudget;
+    _worker_connections = events.workerConnections;
+    _max_connections = events.maxConnections;
+    _drain_timeout = events.drainTimeout;
+
+    std::vector<int> old_fds;
+    std::vector<const ServerConfig*> old_configs;
+    old_fds.swap(_listen_fds);
+    old_configs.swap(_listen_configs);
+    std::vector<bool> kept(old_fds.size(), false);
+
+    const std::vector<ServerConfig>& servers = config->getServers();
+    for (size_t i = 0; i < servers.size(); ++i) {
+        size_t j = 0;
+        while (j < old_fds.size() && (kept[j] || old_configs[j]->getPort() != servers[i].getPort()
+                                      || old_configs[j]->getHost() != servers[i].getHost())) {
+            ++j;
+        }
+        if (j < old_fds.size()) {
+            kept[j] = true;
+            retuneSocket(old_fds[j], servers[i]);
+            _listen_fds.push_back(old_fds[j]);
+            _listen_configs.push_back(&servers[i]);
+        } else if (!setupListenSocket(servers[i], -1)) {
+            Logger::error("Failed to setup listen socket for port " + Utils::intToString(servers[i].getPort()));
+        }
+    }
+
+    for (size_t j = 0; j < old_fds.size(); ++j) {
+        if (!kept[j]) {
+            _event_manager->unbindFd(old_fds[j], -1);
+            close(old_fds[j]);
+            Logger::info("Stopped listening on " + old_configs[j]->getHost() + ":"
+                         + Utils::intToString(old_configs[j]->getPort()));
+        }
+    }
+
+    _config->release();
+    _config = config;
+    Logger::info("Worker " + Utils::intToString(_worker_id) + " reloaded configuration ("
+                 + Utils::intToString(_listen_fds.size()) + " listen socket(s))");
+}
+
+// The listen sockets are closed (other loops, or the next generation of
+// workers, serve the address) and connections close after their current
+// response. Idle keep-alive ones get a short grace rather than being closed
+// on the spot: a request already on its way is answered, not reset. run()
+// returns when none is left or at the deadline.
+void Server::beginDrain() {
+    _draining = true;
+    _drain_deadline = _timers.now() + static_cast<msec_t>(_drain_timeout) * 1000;
+
+    for (size_t i = 0; i < _listen_fds.size(); ++i) {
+        _event_manager->unbindFd(_listen_fds[i], -1);
+        close(_listen_fds[i]);
+    }
+    _listen_fds.clear();
+    _listen_configs.clear();
+    _accept_paused = false;
+    _accept_resume_at = 0;
+
+    std::vector<int> fds;
+    _clients.collectFds(fds);
+    for (size_t i = 0; i < fds.size(); ++i) {
+        Client* client = _clients.find(fds[i]);
+        if (client && client->currentTimerKind() == TIMER_KEEPALIVE) {
+            _timers.arm(fds[i], TIMER_KEEPALIVE, DRAIN_IDLE_MS);
+        }
+    }
+    Logger::info("Worker " + Utils::intToString(_worker_id) + " draining "
+                 + Utils::intToString(_clients.size()) + " connection(s)");
+}
+
+const ServerConfig* Server::listenConfig(int listen_fd) const {
+    for (size_t i = 0; i < _listen_fds.size(); ++i) {
+        if (_listen_fds[i] == listen_fd) {
+            return _listen_configs[i];
+        }
+    }
+    return NULL;
 }
 
 bool Server::start() {
@@ -152,6 +561,10 @@ bool Server::start() {
     }
 
     _running = true;
+    _next_stats_log = _timers.updateClock() + STATS_INTERVAL * 1000;
+    if (_worker_id == 0) {
+        readListenOverflows(_listen_overflows_base);
+    }
     Logger::info("Server started successfully");
     return true;
 }
@@ -160,124 +573,596 @@ void Server::stop() {
     _running = false;
     
     // Close all client connections
-    for (std::map<int, Client>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        _epoll_manager.unbindFd(it->first, -1);
+    std::vector<int> fds;
+    _clients.collectFds(fds);
+    for (size_t i = 0; i < fds.size(); ++i) {
+        // A send in flight fails instead of reading the segments freed below
+        Client* client = _clients.find(fds[i]);
+        if (client && client->isSendInFlight()) {
+            shutdown(fds[i], SHUT_RDWR);
+        }
+        _event_manager->unbindFd(fds[i], -1);
+        _timers.cancel(fds[i]);
+        _clients.release(fds[i]);
     }
-    _clients.clear();
+    __atomic_sub_fetch(&_open_connections, static_cast<long>(fds.size()), __ATOMIC_RELAXED);
+    _write_armed = 0;
+    _readable.clear();
+    _starved.clear();
+    _accept_paused = false;
     
     // Close listen sockets
     for (size_t i = 0; i < _listen_fds.size(); ++i) {
-        _epoll_manager.unbindFd(_listen_fds[i], -1);
+        _event_manager->unbindFd(_listen_fds[i], -1);
         close(_listen_fds[i]);
     }
     _listen_fds.clear();
+    _listen_configs.clear();
+
+    for (int i = 0; i < 2; ++i) {
+        if (_wake_fds[i] != -1) {
+            _event_manager->unbindFd(_wake_fds[i], -1);
+            close(_wake_fds[i]);
+            _wake_fds[i] = -1;
+        }
+    }
     
     Logger::info("Server stopped");
 }
 
 void Server::run() {
-    Logger::info("Server running... Press Ctrl+C to stop");
+    Logger::info("Worker " + Utils::intToString(_worker_id) + " running... Press Ctrl+C to stop");
     
-    while (_running && !_shouldStop) {
-        if (!_epoll_manager.watchForEvents(this)) {
-            Logger::error("Epoll wait failed");
+    while (_running) {
+        int ready = _event_manager->watchForEvents(this, computeWaitTimeout());
+        if (ready < 0) {
+            Logger::error("Event wait failed");
             break;
         }
 
-        // Clean up timed out clients
-        std::vector<int> timed_out_clients;
-        for (std::map<int, Client>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-            if (it->second.isTimedOut()) {
-                timed_out_clients.push_back(it->first);
-            }
+        ++_stats.iterations;
+        if (ready == 0) {
+            ++_stats.idle_wakeups;
         }
-        
-        for (size_t i = 0; i < timed_out_clients.size(); ++i) {
-            Logger::debug("Client " + Utils::intToString(timed_out_clients[i]) + " timed out");
-            removeClient(timed_out_clients[i]);
+        _stats.events += ready;
+
+        // Single clock read per iteration, shared by every timer below
+        _timers.updateClock();
+        // Only right after a wait: with io_uring that wait is what submits
+        // the listen socket removals queued by beginDrain
+        if (_draining && (_clients.size() == 0 || _timers.now() >= _drain_deadline)) {
+            break;
+        }
+        if (__atomic_load_n(&_pending_config, __ATOMIC_RELAXED)) {
+            applyConfig(__atomic_exchange_n(&_pending_config, (Config*)NULL, __ATOMIC_ACQ_REL));
+        }
+        // /stop drains the whole process, this loop included
+        if (_shouldStop && !_drain_requested) {
+            requestDrainAll();
+        }
+        if (_drain_requested && !_draining) {
+            beginDrain();
+        }
+        expireTimers();
+        if (!_readable.empty()) {
+            readPending();
+        }
+        if (!_starved.empty() && _timers.now() >= _read_retry_at) {
+            resumeReads();
+        }
+        if (_accept_paused && _accept_resume_at && _timers.now() >= _accept_resume_at) {
+            resumeAccept();
+        }
+
+        if (_timers.now() >= _next_stats_log) {
+            logStats();
         }
     }
     
     if (_shouldStop) {
         Logger::info("Server stopped via /stop request");
     }
+    logStats();
     Logger::info("Server shutdown complete");
 }
 
+// Milliseconds the event wait may sleep before the next deadline is due: the
+// next timer wheel slot or the next stats report, whichever comes first.
+int Server::computeWaitTimeout() const {
+    msec_t now = _timers.now();
+    int timeout = _next_stats_log > now ? static_cast<int>(_next_stats_log - now) : 0;
+
+    int wheel_timeout = _timers.nextTimeout();
+    if (wheel_timeout >= 0 && wheel_timeout < timeout) {
+        timeout = wheel_timeout;
+    }
+    if (_accept_paused && _accept_resume_at) {
+        int retry = _accept_resume_at > now ? static_cast<int>(_accept_resume_at - now) : 0;
+        if (retry < timeout) {
+            timeout = retry;
+        }
+    }
+    // Clients left readable are served on the next pass without sleeping,
+    // those waiting for buffers once the retry is due
+    if (!_readable.empty()) {
+        timeout = 0;
+    }
+    if (!_starved.empty()) {
+        int retry = _read_retry_at > now ? static_cast<int>(_read_retry_at - now) : 0;
+        if (retry < timeout) {
+            timeout = retry;
+        }
+    }
+    if (_draining) {
+        int drain = _drain_deadline > now && _clients.size() > 0 ? static_cast<int>(_drain_deadline - now) : 0;
+        if (drain < timeout) {
+            timeout = drain;
+        }
+    }
+    return timeout;
+}
+
+void Server::expireTimers() {
+    _expired.clear();
+    _timers.expire(_expired);
+
+    for (size_t i = 0; i < _expired.size(); ++i) {
+        Logger::debug("Client " + Utils::intToString(_expired[i]) + " timed out");
+        removeClient(_expired[i]);
+    }
+}
+
+void Server::logStats() {
+    unsigned long overflows;
+    if (_worker_id == 0 && readListenOverflows(overflows) && overflows >= _listen_overflows_base) {
+        overflows -= _listen_overflows_base;
+        if (overflows > _stats.listen_overflows) {
+            Logger::warning("Listen queues overflowed " + Utils::intToString(overflows - _stats.listen_overflows)
+                            + " times since the last report, consider a larger listen_backlog");
+        }
+        _stats.listen_overflows = overflows;
+    }
+    Logger::info("Worker " + Utils::intToString(_worker_id) + " loop stats: iterations=" + Utils::intToString(_stats.iterations)
+                 + " idle_wakeups=" + Utils::intToString(_stats.idle_wakeups)
+                 + " events=" + Utils::intToString(_stats.events)
+                 + " requests=" + Utils::intToString(_stats.requests)
+                 + " accept=" + Utils::intToString(_stats.accept_calls)
+                 + " accepted=" + Utils::intToString(_stats.accepted)
+                 + " accepts_per_wakeup=" + formatRatio(_stats.accepted, _stats.accept_wakeups)
+                 + " accepted_with_data=" + Utils::intToString(_stats.accepted_with_data)
+                 + " shed=" + Utils::intToString(_stats.shed_connections)
+                 + " accept_pauses=" + Utils::intToString(_stats.accept_pauses)
+                 + " accept_budget_hits=" + Utils::intToString(_stats.accept_budget_hits)
+                 + " listen_overflows=" + Utils::intToString(_stats.listen_overflows)
+                 + " recv=" + Utils::intToString(_stats.recv_calls)
+                 + " send=" + Utils::intToString(_stats.send_calls)
+                 + " write_arms=" + Utils::intToString(_stats.write_arms)
+                 + " write_events=" + Utils::intToString(_stats.write_events)
+                 + " write_armed=" + Utils::intToString(_write_armed)
+                 + " spurious_write_wakeups=" + Utils::intToString(_stats.spurious_write_wakeups)
+                 + " wait=" + Utils::intToString(_stats.wait_calls)
+                 + " ctl=" + Utils::intToString(_stats.ctl_calls)
+                 + " clients=" + Utils::intToString(_clients.size())
+                 + " timers=" + Utils::intToString(_timers.size())
+                 + " io_buffers=" + Utils::intToString(BufferPool::allocated() - BufferPool::available())
+                 + "/" + Utils::intToString(BufferPool::allocated()));
+    _next_stats_log = _timers.now() + STATS_INTERVAL * 1000;
+}
+
 
 void Server::handleNewConnection(int listen_fd, Server *server) {
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    
-    int client_fd = accept(listen_fd, (struct sockaddr*)&client_addr, &client_len);
-    if (client_fd == -1) {
-        Logger::error("Failed to accept connection");
+    // Accept what is queued, up to the budget: during a burst one wakeup
+    // takes a batch instead of a single connection, without starving the
+    // clients already connected. The listen socket is level-triggered, so
+    // anything left is reported again on the next wait.
+    ++server->_stats.accept_wakeups;
+
+    // With deferred accept or fast open the request usually arrives with the
+    // connection: read it right away instead of waiting for the next wakeup
+    const ServerConfig* config = server->listenConfig(listen_fd);
+    bool quickack = config && config->getSocketOptions().tcpQuickAck;
+    bool early_data = config && (config->getSocketOptions().tcpDeferAccept > 0
+                                 || config->getSocketOptions().tcpFastOpen > 0);
+
+    for (int i = 0; i < server->_accept_budget; ++i) {
+        // Hard limit: leave the rest in the backlog until a client leaves
+        if (server->_worker_connections && server->_clients.size() >= server->_worker_connections) {
+            server->pauseAccept(0);
+            return;
+        }
+
+        int client_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        ++server->_stats.accept_calls;
+        if (client_fd == -1) {
+            if (errno == ECONNABORTED || errno == EINTR) {
+                continue;
+            }
+            // Out of fds: the level-triggered socket would be reported (and
+            // fail) again on every pass, stop until a client leaves
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                Logger::error("Failed to accept connection: " + std::string(strerror(errno)));
+                server->pauseAccept(server->_timers.now() + ACCEPT_RETRY_MS);
+                return;
+            }
+            // EAGAIN: queue empty, or another worker took the connection first
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                Logger::error("Failed to accept connection: " + std::string(strerror(errno)));
+            }
+            return;
+        }
+        server->admitConnection(client_fd, quickack, early_data);
+    }
+    ++server->_stats.accept_budget_hits;
+}
+
+// One connection per completion: the multishot accept stays armed and takes
+// every connection queued, there is no budget to apply. Early data needs no
+// special case, the recv bound next completes at once if the request is there.
+void Server::handleAccepted(int listen_fd, int result, BufferSegment* segment, Server *server) {
+    (void)segment;
+    if (result < 0) {
+        int error = -result;
+        if (error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) {
+            Logger::error("Failed to accept connection: " + std::string(strerror(error)));
+            server->pauseAccept(server->_timers.now() + ACCEPT_RETRY_MS);
+        } else if (error != ECONNABORTED && error != EINTR && error != EAGAIN && error != ECANCELED) {
+            Logger::error("Failed to accept connection: " + std::string(strerror(error)));
+        }
         return;
     }
-    
-    server->addClient(client_fd);
+
+    // Hard limit: this one is already accepted and gets a 503, the rest stays
+    // in the backlog until a client leaves
+    if (server->_worker_connections && server->_clients.size() >= server->_worker_connections) {
+        server->pauseAccept(0);
+        ++server->_stats.accepted;
+        server->shedConnection(result);
+        return;
+    }
+
+    const ServerConfig* config = server->listenConfig(listen_fd);
+    server->admitConnection(result, config && config->getSocketOptions().tcpQuickAck, false);
+}
+
+void Server::admitConnection(int client_fd, bool quickack, bool early_data) {
+    ++_stats.accepted;
+
+    // Soft limit: refuse quickly rather than queue work we cannot serve
+    if (_max_connections && __atomic_load_n(&_open_connections, __ATOMIC_RELAXED) >= _max_connections) {
+        shedConnection(client_fd);
+        return;
+    }
+    if (quickack) {
+        int opt = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_QUICKACK, &opt, sizeof(opt));
+    }
+
+    Client* client = addClient(client_fd);
+    if (client && early_data) {
+        // Nothing yet (-1) is fine: the readiness notification follows
+        ssize_t bytes_read = client->readData(_edge_triggered);
+        if (bytes_read > 0) {
+            ++_stats.accepted_with_data;
+            serveInput(*client, bytes_read);
+            queueReadable(client_fd);
+        } else if (bytes_read == 0) {
+            removeClient(client_fd);
+        }
+    }
 }
 
 void Server::handleClientRead(int client_fd, Server *server) {
-    std::map<int, Client>::iterator it = server->_clients.find(client_fd);
-    if (it == server->_clients.end()) {
+    Client* found = server->_clients.find(client_fd);
+    if (!found) {
         return;
     }
     
-    Client& client = it->second;
+    Client& client = *found;
 
-    // tant qu'il y a des donnees disponibles
-    while (true) {
-        ssize_t bytes_read = client.readData();
-        
-        if (bytes_read <= 0) {
-            server->removeClient(client_fd);
-            break;  // Plus de donnees disponibles pour l'instant
+    // Edge-triggered: read what is available now, up to the per-wakeup
+    // budget. Level-triggered: one recv per wakeup, the fd is reported
+    // again while data is pending.
+    ssize_t bytes_read = client.readData(server->_edge_triggered);
+    if (bytes_read == 0 || (bytes_read < 0 && !server->_edge_triggered && !client.isReadStarved())) {
+        server->removeClient(client_fd);
+        return;
+    }
+
+    server->serveInput(client, bytes_read);
+    server->queueReadable(client_fd);
+}
+
+// The kernel received into a pool segment, which the client's read buffer
+// takes over. 0 is an orderly shutdown; -ENOBUFS means the pool is empty and
+// the client waits like a starved read; any other error closes.
+void Server::handleReceived(int client_fd, int result, BufferSegment* segment, Server *server) {
+    Client* client = server->_clients.find(client_fd);
+    if (result > 0 && client) {
+        client->receiveSegment(segment);
+        server->serveInput(*client, result);
+        return;
+    }
+    if (segment) {
+        BufferPool::put(segment);
+    }
+    if (!client) {
+        return;
+    }
+    if (result == -ENOBUFS) {
+        client->markReadStarved();
+        server->queueReadable(client_fd);
+        return;
+    }
+    server->removeClient(client_fd);
+}
+
+// A drain that stopped at its budget leaves bytes no new edge will announce:
+// the client is read again on the next pass. One that found the buffer pool
+// empty stops reading (the kernel buffer then throttles the peer) until
+// resumeReads, so it does not spin on a socket it cannot read.
+void Server::queueReadable(int client_fd) {
+    Client* client = _clients.find(client_fd);
+    if (!client) {
+        return;
+    }
+    if (client->isReadStarved()) {
+        _event_manager->unbindFd(client_fd, EVENT_READ);
+        if (_starved.empty()) {
+            _read_retry_at = _timers.now() + READ_RETRY_MS;
         }
-        
-        // Traiter la requete apres chaque lecture
-        server->processRequest(client);
+        _starved.push_back(client_fd);
+    } else if (client->hasMoreToRead() && !client->isReadQueued()) {
+        client->setReadQueued(true);
+        _readable.push_back(client_fd);
+    }
+}
 
-        it = server->_clients.find(client_fd);
-        if (it == server->_clients.end()) {
-            return;
+// One more budgeted read for each client left readable, after the events of
+// the iteration so a fast sender only gets its share of the loop
+void Server::readPending() {
+    _revisit.swap(_readable);
+    for (size_t i = 0; i < _revisit.size(); ++i) {
+        int client_fd = _revisit[i];
+        Client* client = _clients.find(client_fd);
+        // Closed since (a new connection on the same fd is not queued)
+        if (!client || !client->isReadQueued()) {
+            continue;
         }
-        
-        // Si la requete est complete, pas besoin de lire plus
-        if (client.getRequest().isComplete()) {
-            break;
+        client->setReadQueued(false);
+        // Reading stopped meanwhile; binding it again reports the socket
+        if (!_event_manager->isTracked(client_fd, EVENT_READ)) {
+            continue;
+        }
+        handleClientRead(client_fd, this);
+    }
+    _revisit.clear();
+}
+
+// Binds EVENT_READ again for the clients queueReadable parked: the socket is
+// reported right away if data waited meanwhile, and parked again if the pool
+// is still empty
+void Server::resumeReads() {
+    _revisit.swap(_starved);
+    for (size_t i = 0; i < _revisit.size(); ++i) {
+        int client_fd = _revisit[i];
+        Client* client = _clients.find(client_fd);
+        // Closed since, or already reading again
+        if (!client || !client->isReadStarved() || _event_manager->isTracked(client_fd, EVENT_READ)) {
+            continue;
+        }
+        // Held back by flushClient: it binds the socket when the queue drains
+        if (client->hasDataToWrite() && (!client->isKeepAlive() || client->isPipelinePaused())) {
+            continue;
+        }
+        // The ring only offers fresh segments: the room left in the client's
+        // own buffer is read first, or partial requests holding every
+        // segment could never complete
+        if (_completions) {
+            ssize_t bytes_read = client->readData(false);
+            if (bytes_read == 0) {
+                removeClient(client_fd);
+                continue;
+            }
+            if (bytes_read > 0) {
+                serveInput(*client, bytes_read);
+                client = _clients.find(client_fd);
+                if (!client || _event_manager->isTracked(client_fd, EVENT_READ) || client->hasDataToWrite()) {
+                    continue;
+                }
+            }
+            if (client->isReadStarved()) {
+                queueReadable(client_fd);
+                continue;
+            }
+        }
+        if (!bindRead(client_fd)) {
+            removeClient(client_fd);
         }
     }
+    _revisit.clear();
+}
+
+// Runs the requests readData just buffered and sends what they produced.
+// bytes_read <= 0 (edge-triggered drain with nothing new) only flushes.
+void Server::serveInput(Client& client, ssize_t bytes_read) {
+    int client_fd = client.getFd();
 
-    it = server->_clients.find(client_fd);
-    if (it != server->_clients.end() && it->second.getRequest().isComplete()) {
-        server->_epoll_manager.unbindFd(client_fd, EVENT_READ);
+    if (bytes_read > 0) {
+        processRequest(client);
     }
 
+    // Try the response right away: the socket is almost always writable,
+    // EVENT_WRITE only gets armed if the kernel buffer fills up
+    if (client.hasDataToWrite()) {
+        flushClient(client_fd);
+    } else if (client.isPeerClosed()) {
+        removeClient(client_fd);
+    }
 }
 
 void Server::handleClientWrite(int client_fd, Server *server) {
-    std::map<int, Client>::iterator it = server->_clients.find(client_fd);
-    if (it == server->_clients.end()) {
+    Client* client = server->_clients.find(client_fd);
+    if (!client) {
+        return;
+    }
+
+    ++server->_stats.write_events;
+    if (!client->hasDataToWrite()) {
+        ++server->_stats.spurious_write_wakeups;
+        server->disarmWrite(client_fd);
+        return;
+    }
+    server->flushClient(client_fd);
+}
+
+// Sends queued output and keeps EVENT_WRITE bound only while some remains.
+// With io_uring completions the send is only submitted, handleSent goes on
+// from its result.
+void Server::flushClient(int client_fd) {
+    Client* found = _clients.find(client_fd);
+    if (!found) {
         return;
     }
     
-    Client& client = it->second;
+    Client& client = *found;
+    if (_completions) {
+        sendQueued(client);
+        return;
+    }
 
-    if (client.isWriteComplete()) {
-        Logger::debug("Client write complete on fd " + Utils::intToString(client_fd));
+    while (true) {
+        // Nothing sent (-1) just means the socket is full: wait for
+        // EVENT_WRITE, a broken connection is reported through EVENT_ERROR
+        if (client.writeData(_edge_triggered) <= 0) {
+            break;
+        }
+
+        // The queue has room again: answer the request held back behind it
+        if (!client.isPipelinePaused() || client.isPipelineFull()) {
+            break;
+        }
+        client.setPipelinePaused(false);
+        processRequest(client);
+        if (!client.hasDataToWrite()) {
+            break;
+        }
+    }
+
+    if (client.hasDataToWrite()) {
+        // Reading stops while the connection is closing or a request is
+        // held back, and starts again once the queue drains
+        if (!client.isKeepAlive() || client.isPipelinePaused()) {
+            _event_manager->unbindFd(client_fd, EVENT_READ);
+        } else if (!bindRead(client_fd)) {
+            removeClient(client_fd);
+            return;
+        }
+        armWrite(client_fd);
+        return;
+    }
+
+    Logger::debug("Client write complete on fd " + Utils::intToString(client_fd));
+    if (!client.isKeepAlive() || client.isPeerClosed()) {
         client.setState(DONE);
+        removeClient(client_fd);
+        return;
+    }
+    keepClient(client);
+}
+
+// One send in flight per client, from the queued segments in place. Reading
+// stops while the connection is closing or a request is held back, as in
+// flushClient.
+void Server::sendQueued(Client& client) {
+    int client_fd = client.getFd();
+    struct iovec iov[MAX_WRITE_SEGMENTS];
+    int count = client.prepareSend(iov);
+    if (count == 0) {
+        return;
+    }
+    if (!_event_manager->submitSend(client_fd, iov, count, (EventManager::io_callback_t)handleSent)) {
+        client.completeSend(-1);
+        removeClient(client_fd);
+        return;
+    }
+    if (!client.isKeepAlive() || client.isPipelinePaused()) {
+        _event_manager->unbindFd(client_fd, EVENT_READ);
+    } else if (!bindRead(client_fd)) {
+        removeClient(client_fd);
+    }
+}
+
+// Completion of sendQueued: the same steps as flushClient after a write. A
+// client removed meanwhile was only waiting for this to be released.
+void Server::handleSent(int client_fd, int result, BufferSegment* segment, Server *server) {
+    (void)segment;
+    Client* found = server->_clients.find(client_fd);
+    if (!found) {
+        return;
+    }
+
+    Client& client = *found;
+    if (client.completeSend(result) <= 0 || client.isClosing()) {
         server->removeClient(client_fd);
         return;
     }
 
-    ssize_t bytes_written = client.writeData();
-    
-    if (bytes_written < 0) {
+    // The queue has room again: answer the request held back behind it
+    if (client.isPipelinePaused() && !client.isPipelineFull()) {
+        client.setPipelinePaused(false);
+        server->processRequest(client);
+    }
+    if (client.hasDataToWrite()) {
+        server->sendQueued(client);
+        return;
+    }
+
+    Logger::debug("Client write complete on fd " + Utils::intToString(client_fd));
+    if (!client.isKeepAlive() || client.isPeerClosed()) {
+        client.setState(DONE);
         server->removeClient(client_fd);
         return;
     }
-    
+    server->keepClient(client);
+}
+
+// Persistent connection with nothing left to send: wait for the next request
+void Server::keepClient(Client& client) {
+    int client_fd = client.getFd();
+    disarmWrite(client_fd);
+    if (!bindRead(client_fd)) {
+        removeClient(client_fd);
+        return;
+    }
+    Logger::debug("Keeping connection " + Utils::intToString(client_fd) + " alive");
+}
+
+bool Server::bindRead(int client_fd) {
+    if (_event_manager->isTracked(client_fd, EVENT_READ)) {
+        return true;
+    }
+    if (_completions) {
+        return _event_manager->bindRecv(client_fd, (EventManager::io_callback_t)handleReceived);
+    }
+    uint32_t mode = _edge_triggered ? EVENT_EDGE : 0;
+    return _event_manager->bindToFd(client_fd, EVENT_READ | mode, (EventManager::callback_t)handleClientRead);
+}
+
+void Server::armWrite(int client_fd) {
+    if (_event_manager->isTracked(client_fd, EVENT_WRITE)) {
+        return;
+    }
+    uint32_t mode = _edge_triggered ? EVENT_EDGE : 0;
+    if (_event_manager->bindToFd(client_fd, EVENT_WRITE | mode, (EventManager::callback_t)handleClientWrite)) {
+        ++_write_armed;
+        ++_stats.write_arms;
+    }
+}
+
+void Server::disarmWrite(int client_fd) {
+    if (_event_manager->unbindFd(client_fd, EVENT_WRITE)) {
+        --_write_armed;
+    }
 }
 
 void Server::handleClientError(int client_fd,  Server *server) {
@@ -286,106 +1171,156 @@ void Server::handleClientError(int client_fd,  Server *server) {
     server->removeClient(client_fd);
 }
 
-void Server::addClient(int fd) {
-    
-    if (!makeNonBlocking(fd)) {
+// fd comes from accept4, already non-blocking and close-on-exec.
+// NULL if it could not be registered (the fd is closed then)
+Client* Server::addClient(int fd) {
+    uint32_t mode = _edge_triggered ? EVENT_EDGE : 0;
+
+    // A recv reports errors itself, no EVENT_ERROR poll alongside it
+    if (_completions && !bindRead(fd)) {
+        _event_manager->unbindFd(fd, -1);
         close(fd);
-        Logger::error("Failed to set non-blocking mode on fd " + Utils::intToString(fd));
-        return;
+        Logger::error("Failed to bind a recv to fd " + Utils::intToString(fd));
+        return NULL;
     }
-    
-    if (!_epoll_manager.bindToFd(fd, EVENT_READ, (EpollManager::callback_t)handleClientRead)) {
+    if (!_completions && !_event_manager->bindToFd(fd, EVENT_READ | mode, (EventManager::callback_t)handleClientRead)) {
+        _event_manager->unbindFd(fd, -1);
         close(fd);
         Logger::error("Failed to bind EVENT_READ to fd " + Utils::intToString(fd));
-        return;
-    }
-
-    if (!_epoll_manager.bindToFd(fd, EVENT_WRITE, (EpollManager::callback_t)handleClientWrite)) {
-        close(fd);
-        Logger::error("Failed to bind EVENT_WRITE to fd " + Utils::intToString(fd));
-        return;
+        return NULL;
     }
 
-    if (!_epoll_manager.bindToFd(fd, EVENT_ERROR, (EpollManager::callback_t)handleClientError)) {
+    if (!_completions && !_event_manager->bindToFd(fd, EVENT_ERROR | mode, (EventManager::callback_t)handleClientError)) {
+        _event_manager->unbindFd(fd, -1);
         close(fd);
         Logger::error("Failed to bind EVENT_ERROR to fd " + Utils::intToString(fd));
-        return;
+        return NULL;
     }
     
-    Client client(fd);
-    _clients[fd] = client;
+    Client* client = _clients.open(fd, &_timers, &_stats);
+    if (!client) {
+        _event_manager->unbindFd(fd, -1);
+        close(fd);
+        Logger::error("No client slot for fd " + Utils::intToString(fd));
+        return NULL;
+    }
+    __atomic_add_fetch(&_open_connections, 1, __ATOMIC_RELAXED);
     Logger::info("New client connection", fd);
+    return client;
 }
 
 void Server::removeClient(int client_fd) {
-    std::map<int, Client>::iterator it = _clients.find(client_fd);
-    if (it != _clients.end()) {
-  //it->second.getRequest().clear();
-        _epoll_manager.unbindFd(client_fd, -1);
-        it->second.closeFd();  // Ferme le fd
-        _clients.erase(it);
+    Client* client = _clients.find(client_fd);
+    // The kernel may still read the queued segments: the slot, and the fd so
+    // its number is not reused, stay until handleSent. The shutdown makes
+    // the send complete at once.
+    if (client && client->isSendInFlight()) {
+        if (!client->isClosing()) {
+            client->setClosing();
+            _event_manager->unbindFd(client_fd, -1);
+            _timers.cancel(client_fd);
+            shutdown(client_fd, SHUT_RDWR);
+        }
+        return;
+    }
+    if (client) {
+        if (_event_manager->isTracked(client_fd, EVENT_WRITE)) {
+            --_write_armed;
+        }
+        _event_manager->unbindFd(client_fd, -1);
+        _timers.cancel(client_fd);
+        _clients.release(client_fd);  // Ferme le fd
+        __atomic_sub_fetch(&_open_connections, 1, __ATOMIC_RELAXED);
         Logger::info("Client disconnected", client_fd);
+
+        // Resume a little below the limit, not at every single slot freed
+        if (_accept_paused && (!_worker_connections
+                               || _clients.size() < _worker_connections - (_worker_connections + 15) / 16)) {
+            resumeAccept();
+        }
     }
 }
 
+// Parses every complete request buffered for this client and queues their
+// responses in order. Stops at a response that closes the connection, or
+// when the response queue is full: the next request then stays in the parser
+// until flushClient has made room.
 void Server::processRequest(Client& client) {
-    const std::string buffer = client.getReadBuffer();
-    
-    if (buffer.empty()) {
-        return;
-    }
-    
-    // Utiliser le parser et la requete du client
     HTTPParser& parser = client.getParser();
     HTTPRequest& request = client.getRequest();
+
+    // Request line not parsed yet: it is answered with the current snapshot
+    if (parser.getState() == PARSING_REQUEST_LINE) {
+        client.setConfig(_config);
+    }
+
+    // Closing: whatever the peer sends after the last response is ignored
+    if (!client.isKeepAlive() && client.getRequestsServed() > 0) {
+        client.clearReadBuffer();
+        return;
+    }
     
-    // Parse avec le parser persistant (le parser garde son etat)
-    bool parsed = parser.parse(request, buffer);
-    client.clearReadBuffer();
-
-    if (!parsed) {
-        if (parser.hasError()) {
-            // Send 400 Bad Request et reset le client
-            Logger::warning("Parser error for client " + Utils::intToString(client.getFd()));
-            int client_fd = client.getFd();
-            resetClientAfterError(client.getFd());
-            
-            std::string response = createHttpResponse(400, "<h1>400 Bad Request</h1>");
+    // Parse avec le parser persistant (le parser garde son etat), en place
+    // dans le buffer de lecture du client
+    bool parsed = parser.parse(request) || parser.isComplete();
 
-            std::map<int, Client>::iterator it = _clients.find(client_fd);
-            if (it != _clients.end()) {
-                it->second.setWriteBuffer(response);
+    while (true) {
+        if (!parsed) {
+            if (parser.hasError()) {
+                // Send 400 Bad Request (413 for a body too large) et reset le client
+                int status = parser.getErrorStatus();
+                Logger::warning("Parser error for client " + Utils::intToString(client.getFd()));
+                resetClientAfterError(client.getFd());
+                client.setKeepAlive(false);
+                client.queueResponse(createHttpResponse(status, "<h1>" + Utils::intToString(status) + " "
+                                                        + getStatusMessage(status) + "</h1>"));
+                return;
             }
-            // _epoll_manager.bindToFd(client.getFd(), EVENT_WRITE, (EpollManager::callback_t)handleClientWrite);
+            // Need more data - le parser attend plus de chunks
+            Logger::debug("Parser needs more data, waiting... (client " + Utils::intToString(client.getFd()) + ")");
             return;
         }
-        // Need more data - le parser attend plus de chunks
-        Logger::debug("Parser needs more data, waiting... (client " + Utils::intToString(client.getFd()) + ")");
-        // client.clearReadBuffer();
-        return;
-    }
-    
-    // Only process if request is COMPLETE
-    if (!request.isComplete()) {
-        Logger::debug("Request not complete, waiting for more data... (client " + Utils::intToString(client.getFd()) + ")");
-        return;
+        
+        // Only process if request is COMPLETE
+        if (!request.isComplete()) {
+            Logger::debug("Request not complete, waiting for more data... (client " + Utils::intToString(client.getFd()) + ")");
+            return;
+        }
+
+        if (client.isPipelineFull()) {
+            client.setPipelinePaused(true);
+            return;
+        }
+        
+        // Request parsed successfully and complete
+        ++_stats.requests;
+        Logger::info("Parsed complete request: " + request.methodToString() + " " + request.getURI(), client.getFd());
+        
+        // Generate appropriate response based on the request
+        generateHttpResponse(client, request);
+        client.startNextRequest();
+        client.setConfig(_config);
+
+        // Pipelined requests already received are answered right away
+        if (!client.isKeepAlive() || !parser.hasBufferedData()) {
+            return;
+        }
+        parsed = parser.parse(request);
     }
-    
-    // Request parsed successfully and complete
-    Logger::info("Parsed complete request: " + request.methodToString() + " " + request.getURI(), client.getFd());
-    
-    // Generate appropriate response based on the request
-    generateHttpResponse(client, request);
-   // client.getRequest().clear();
 }
 
 void Server::generateHttpResponse(Client& client, const HTTPRequest& request) {
-    ServerConfig* serverConfig = _config->getServerByPort(request.getPort());
+    ServerConfig* serverConfig = client.getConfig()->getServerByPort(request.getPort());
     if (!serverConfig) {
-        std::string errorResponse = createHttpResponse(500, "<h1>500 Internal Server Error</h1>");
-        client.setWriteBuffer(errorResponse);
+        client.setKeepAlive(false);
+        client.queueResponse(createHttpResponse(500, "<h1>500 Internal Server Error</h1>"));
         return;
     }
+
+    int keepalive_timeout = serverConfig->getKeepaliveTimeout();
+    bool keep_alive = !_draining && request.isKeepAlive() && keepalive_timeout > 0
+        && client.getRequestsServed() + 1 < static_cast<size_t>(serverConfig->getKeepaliveRequests());
+    client.setKeepAlive(keep_alive, keepalive_timeout);
     
     // Find matching location
     const LocationConfig* location = serverConfig->findLocation(request.getURI());
@@ -393,7 +1328,7 @@ void Server::generateHttpResponse(Client& client, const HTTPRequest& request) {
     if (!location) 
     {
         HTTPResponse response = FileServer::serveFile(request, *serverConfig);
-        client.setWriteBuffer(response.toString());
+        sendResponse(client, response);
         Logger::info("Served: " + request.methodToString() + " " + request.getURI() + " -> " + 
                     Utils::intToString(response.getStatusCode()), client.getFd());
         if (response.shouldStopServer()) 
@@ -422,7 +1357,7 @@ void Server::generateHttpResponse(Client& client, const HTTPRequest& request) {
             if (!Utils::fileExists(scriptPath)) {
                 HTTPResponse response(404);
                 response.setBody("<h1>404 - CGI Script Not Found</h1>");
-                client.setWriteBuffer(response.toString());
+                sendResponse(client, response);
                 Logger::warning("CGI script not found: " + scriptPath);
                 return;
             }
@@ -432,13 +1367,13 @@ void Server::generateHttpResponse(Client& client, const HTTPRequest& request) {
             HTTPResponse response;
             
             if (cgiHandler.execute(response)) {
-                client.setWriteBuffer(response.toString());
+                sendResponse(client, response);
                 Logger::info("CGI executed: " + request.methodToString() + " " + request.getURI() + " -> " + 
                             Utils::intToString(response.getStatusCode()), client.getFd());
             } else {
                 response.setStatusCode(500);
                 response.setBody("<h1>500 - CGI Execution Failed</h1>");
-                client.setWriteBuffer(response.toString());
+                sendResponse(client, response);
                 Logger::error("CGI execution failed: " + scriptPath);
             }
             return;
@@ -447,7 +1382,7 @@ void Server::generateHttpResponse(Client& client, const HTTPRequest& request) {
     
     // Normal file serving
     HTTPResponse response = FileServer::serveFile(request, *serverConfig);
-    client.setWriteBuffer(response.toString());
+    sendResponse(client, response);
     
     Logger::info("Served: " + request.methodToString() + " " + request.getURI() + " -> " + 
                 Utils::intToString(response.getStatusCode()), client.getFd());
@@ -459,11 +1394,19 @@ void Server::generateHttpResponse(Client& client, const HTTPRequest& request) {
     }
 }
 
+// The Connection header follows the keep-alive decision for this request.
+// Head and body are queued as two segments, the body is moved, not copied.
+void Server::sendResponse(Client& client, HTTPResponse& response) {
+    response.setConnection(client.isKeepAlive() ? "keep-alive" : "close");
+    std::string head = response.headToString();
+    client.queueResponse(head, response.getBodyRef());
+}
+
 void Server::generateResponse(Client& client, const std::string& request) {
     // Simple response for now
     std::string content = "<html><body><h1>Hello from Webserv!</h1><p>Request received:</p><pre>" + request + "</pre></body></html>";
     std::string response = createHttpResponse(200, content);
-    client.setWriteBuffer(response);
+    client.queueResponse(response);
     
     Logger::debug("Generated response for client " + Utils::intToString(client.getFd()));
 }
@@ -486,7 +1429,9 @@ std::string Server::createHttpResponse(int statusCode, const std::string& conten
 std::string Server::getStatusMessage(int statusCode) {
     switch (statusCode) {
         case 200: return "OK";
+        case 400: return "Bad Request";
         case 404: return "Not Found";
+        case 413: return "Request Entity Too Large";
         case 500: return "Internal Server Error";
         default: return "Unknown";
     }
@@ -501,11 +1446,11 @@ bool Server::isListenSocket(int fd) {
 }
 
 void Server::resetClientAfterError(int client_fd) {
-    std::map<int, Client>::iterator it = _clients.find(client_fd);
-    if (it != _clients.end()) {
-        it->second.clearReadBuffer();
-        it->second.getParser().reset();
-        it->second.getRequest() = HTTPRequest();
+    Client* client = _clients.find(client_fd);
+    if (client) {
+        client->clearReadBuffer();
+        client->getParser().reset();
+        client->getRequest().clear();
         Logger::debug("Client " + Utils::intToString(client_fd) + " reset after error");
     }
 }
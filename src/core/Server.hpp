@@ -3,22 +3,66 @@
 
 #include <map>
 #include <vector>
+#include <netinet/in.h>
 #include "Client.hpp"
-#include "Epoll.hpp"
+#include "ClientTable.hpp"
+#include "EventManager.hpp"
+#include "TimerWheel.hpp"
+#include "LoopStats.hpp"
 #include "Config.hpp"
 #include "HTTPRequest.hpp"
+#include "HTTPResponse.hpp"
 
 class Server {
 private:
     std::vector<int> _listen_fds;
-    EpollManager _epoll_manager;
-    std::map<int, Client> _clients;
-    Config* _config;
-    bool _running;
+    std::vector<const ServerConfig*> _listen_configs;   // server block of each listen fd
+    EventManager* _event_manager;   // epoll or io_uring, from the events block
+    ClientTable _clients;
+    TimerWheel _timers;
+    std::vector<int> _expired;
+    std::vector<int> _readable;     // edge-triggered clients left readable by a capped drain
+    std::vector<int> _revisit;      // _readable being served, swapped to keep both allocations
+    std::vector<int> _starved;      // clients whose reads wait for the buffer pool
+    msec_t _read_retry_at;   // when _starved gets its reads back
+    size_t _write_armed;     // clients currently bound for EVENT_WRITE
+    Config* _config;         // snapshot new requests start with (holds a reference)
+    Config* _pending_config; // handed over by requestReload, applied by the loop
+    volatile bool _running;
     bool _shouldStop;
+    bool _edge_triggered;
+    bool _completions;       // io_uring accepts, receives and sends itself
+    int _accept_budget;      // accept4 calls per listen socket wakeup
+    size_t _worker_connections;  // hard limit for this loop, 0: none
+    long _max_connections;       // soft limit for the process, 0: none
+    bool _accept_paused;         // listen sockets unbound
+    msec_t _accept_resume_at;    // retry after fd exhaustion, 0: when a client leaves
+    bool _reuse_port;        // several event loops share the listen addresses
+    bool _shared_listen;     // listen sockets inherited from the master process
+    volatile bool _drain_requested;
+    bool _draining;          // no more accepts, connections close after their response
+    int _drain_timeout;      // seconds, from the events block
+    msec_t _drain_deadline;
+    int _worker_id;
+    int _wake_fds[2];        // self-pipe: lets other threads/signals interrupt the event wait
+    LoopStats _stats;
+    msec_t _next_stats_log;
+    unsigned long _listen_overflows_base;   // host counter when the loop started
     
-    static Server* _signalInstance; 
-    static const int LISTEN_BACKLOG = 128;
+    // Listen socket handed over by the binary we replace (see Master::upgrade)
+    struct InheritedSocket {
+        int fd;
+        struct in_addr addr;
+        int port;
+    };
+
+    static std::vector<Server*> _instances;
+    static std::vector<InheritedSocket> _inherited;
+    static long _open_connections;  // all event loops of the process
+    static const msec_t ACCEPT_RETRY_MS = 1000;
+    static const int STATS_INTERVAL = 60;
+    static const msec_t DRAIN_IDLE_MS = 1000;
+    static const int READ_RETRY_MS = 10;
 
     void resetClientAfterError(int client_fd);
 
@@ -26,40 +70,97 @@ public:
     Server();
     ~Server();
 
-    static void setSignalInstance(Server* instance);
+    // Every running event loop, so signals and /stop reach all of them
+    static void registerInstance(Server* instance);
+    static void unregisterInstance(Server* instance);
+    static void requestShutdownAll();
+    static void requestDrainAll();
     static void signalHandler(int signum);
     void requestShutdown();
+    void wake();
+    // Thread-safe: the loop switches to config before its next wait
+    void requestReload(Config* config);
+    // Thread-safe: finish the connections in progress, then leave run()
+    void requestDrain();
+    bool isDraining() const { return _draining; }
+    void setWorkerId(int id) { _worker_id = id; }
     
-    bool init(Config* config);
+    // shared_listen_fds: sockets already bound by the master process, one per
+    // server block in config order; empty to create our own
+    bool init(Config* config, const std::vector<int>& shared_listen_fds = std::vector<int>());
     bool start();
     void stop();
     void run();
     bool shouldStop() const { return _shouldStop; }
+    const LoopStats& getStats() const { return _stats; }
+
+    // Bound, listening and non-blocking socket, -1 on failure. An inherited
+    // socket for the same address is taken over instead of binding a new one.
+    static int createSocket(const ServerConfig& serverConfig, bool reuse_port);
+    // Applies the socket options and backlog of serverConfig to a socket
+    // already listening on its address (kept across a reload)
+    static void retuneSocket(int listen_fd, const ServerConfig& serverConfig);
+
+    // Listening sockets listed in WEBSERV_LISTEN_FDS by the previous binary:
+    // collected before the sockets are set up, the ones left unclaimed are
+    // closed afterwards (address no longer configured)
+    static void inheritListenSockets();
+    static void closeInheritedSockets();
     
 private:
     // Socket setup
-    bool setupListenSocket(const ServerConfig& serverConfig);
-    int createSocket(const std::string& host, int port);
-    bool makeNonBlocking(int fd);
+    bool setupListenSocket(const ServerConfig& serverConfig, int shared_fd);
+    static bool applySocketOptions(int listen_fd, const SocketOptions& options);
+    static int takeInheritedSocket(const ServerConfig& serverConfig);
+    const ServerConfig* listenConfig(int listen_fd) const;
+    uint32_t listenEvents() const;
+    bool bindListen(int listen_fd);
+    void admitConnection(int client_fd, bool quickack, bool early_data);
+    void pauseAccept(msec_t resume_at);
+    void resumeAccept();
+    void shedConnection(int fd);
+    void applyConfig(Config* config);
+    void beginDrain();
     
     // Event
     static void handleNewConnection(int listen_fd, Server *server);
     static void handleClientRead(int client_fd, Server *server);
     static void handleClientWrite(int client_fd, Server *server);
     static void handleClientError(int client_fd, Server *server);
+    static void handleWakeup(int wake_fd, Server *server);
+    // io_uring completions
+    static void handleAccepted(int listen_fd, int result, BufferSegment* segment, Server *server);
+    static void handleReceived(int client_fd, int result, BufferSegment* segment, Server *server);
+    static void handleSent(int client_fd, int result, BufferSegment* segment, Server *server);
     
     // Client management
-    void addClient(int fd);
+    Client* addClient(int fd);
+    void serveInput(Client& client, ssize_t bytes_read);
+    void queueReadable(int client_fd);
+    void readPending();
+    void resumeReads();
     void removeClient(int client_fd);
+    void flushClient(int client_fd);
+    void sendQueued(Client& client);
+    void keepClient(Client& client);
+    bool bindRead(int client_fd);
+    void armWrite(int client_fd);
+    void disarmWrite(int client_fd);
     void processRequest(Client& client);
     void generateResponse(Client& client, const std::string& request);
     void generateHttpResponse(Client& client, const HTTPRequest& request);
+    void sendResponse(Client& client, HTTPResponse& response);
     
     // HTTP response generation
     std::string createHttpResponse(int statusCode, const std::string& content, const std::string& contentType = "text/html");
     std::string getStatusMessage(int statusCode);
     std::string getCurrentHttpDate();
     
+    // Event loop
+    int computeWaitTimeout() const;
+    void expireTimers();
+    void logStats();
+
     // Utils
     bool isListenSocket(int fd);
 };
@@ -0,0 +1,203 @@
+#include "TimerWheel.hpp"
+#include <ctime>
+
+TimerWheel::Node::Node() : prev(-1), next(-1), tick(0), kind(TIMER_NONE), level(0), slot(0) {
+}
+
+TimerWheel::TimerWheel() : _count(0) {
+    for (int level = 0; level < LEVELS; ++level) {
+        for (int slot = 0; slot < SLOTS; ++slot) {
+            _heads[level][slot] = -1;
+        }
+    }
+    _now = monotonicMs();
+    _current_tick = _now / TICK_MS;
+}
+
+TimerWheel::~TimerWheel() {
+}
+
+msec_t TimerWheel::monotonicMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<msec_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+msec_t TimerWheel::updateClock() {
+    _now = monotonicMs();
+    return _now;
+}
+
+msec_t TimerWheel::now() const {
+    return _now;
+}
+
+void TimerWheel::arm(int fd, TimerKind kind, msec_t timeout_ms) {
+    if (fd < 0) {
+        return;
+    }
+    if (static_cast<size_t>(fd) >= _nodes.size()) {
+        _nodes.resize(fd + 1);
+    }
+
+    Node& node = _nodes[fd];
+    if (node.kind != TIMER_NONE) {
+        unlink(fd);
+    } else {
+        ++_count;
+    }
+
+    // Round up so a timer never fires before its deadline, and never land in
+    // the slot that has already been processed for the current tick
+    msec_t tick = (_now + timeout_ms + TICK_MS - 1) / TICK_MS;
+    if (tick <= _current_tick) {
+        tick = _current_tick + 1;
+    }
+    node.tick = tick;
+    node.kind = kind;
+    link(fd);
+}
+
+void TimerWheel::cancel(int fd) {
+    if (fd < 0 || static_cast<size_t>(fd) >= _nodes.size() || _nodes[fd].kind == TIMER_NONE) {
+        return;
+    }
+    unlink(fd);
+    _nodes[fd].kind = TIMER_NONE;
+    --_count;
+}
+
+TimerKind TimerWheel::kindOf(int fd) const {
+    if (fd < 0 || static_cast<size_t>(fd) >= _nodes.size()) {
+        return TIMER_NONE;
+    }
+    return _nodes[fd].kind;
+}
+
+size_t TimerWheel::size() const {
+    return _count;
+}
+
+void TimerWheel::link(int fd) {
+    Node& node = _nodes[fd];
+    msec_t delta = node.tick > _current_tick ? node.tick - _current_tick : 0;
+
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (static_cast<msec_t>(1) << (SLOT_BITS * (level + 1)))) {
+        ++level;
+    }
+    // Beyond the last level's range: park it at the far end, it gets
+    // re-cascaded (and re-clamped) until it is finally due
+    msec_t max_delta = (static_cast<msec_t>(1) << (SLOT_BITS * LEVELS)) - 1;
+    msec_t tick = delta > max_delta ? _current_tick + max_delta : node.tick;
+
+    node.level = level;
+    node.slot = static_cast<int>((tick >> (SLOT_BITS * level)) & SLOT_MASK);
+    node.prev = -1;
+    node.next = _heads[level][node.slot];
+    if (node.next != -1) {
+        _nodes[node.next].prev = fd;
+    }
+    _heads[level][node.slot] = fd;
+}
+
+void TimerWheel::unlink(int fd) {
+    Node& node = _nodes[fd];
+    if (node.prev != -1) {
+        _nodes[node.prev].next = node.next;
+    } else {
+        _heads[node.level][node.slot] = node.next;
+    }
+    if (node.next != -1) {
+        _nodes[node.next].prev = node.prev;
+    }
+    node.prev = -1;
+    node.next = -1;
+}
+
+void TimerWheel::cascade(int level) {
+    int slot = static_cast<int>((_current_tick >> (SLOT_BITS * level)) & SLOT_MASK);
+    int fd = _heads[level][slot];
+    _heads[level][slot] = -1;
+
+    while (fd != -1) {
+        int next = _nodes[fd].next;
+        link(fd);
+        fd = next;
+    }
+}
+
+void TimerWheel::expire(std::vector<int>& expired) {
+    msec_t now_tick = _now / TICK_MS;
+
+    if (_count == 0) {
+        _current_tick = now_tick;
+        return;
+    }
+
+    while (_current_tick < now_tick) {
+        ++_current_tick;
+
+        // Refill lower levels from the coarsest one that just wrapped
+        if ((_current_tick & SLOT_MASK) == 0) {
+            int top = 1;
+            while (top < LEVELS - 1 && ((_current_tick >> (SLOT_BITS * top)) & SLOT_MASK) == 0) {
+                ++top;
+            }
+            for (int level = top; level >= 1; --level) {
+                cascade(level);
+            }
+        }
+
+        int slot = static_cast<int>(_current_tick & SLOT_MASK);
+        int fd = _heads[0][slot];
+        _heads[0][slot] = -1;
+        while (fd != -1) {
+            int next = _nodes[fd].next;
+            _nodes[fd].prev = -1;
+            _nodes[fd].next = -1;
+            _nodes[fd].kind = TIMER_NONE;
+            --_count;
+            expired.push_back(fd);
+            fd = next;
+        }
+    }
+}
+
+int TimerWheel::nextTimeout() const {
+    if (_count == 0) {
+        return -1;
+    }
+
+    // First non-empty slot of every level; for level > 0 that is the tick at
+    // which the slot is cascaded, which is when the wheel must be serviced
+    msec_t next_tick = 0;
+    for (int level = 0; level < LEVELS; ++level) {
+        msec_t base = _current_tick >> (SLOT_BITS * level);
+        for (int i = 1; i <= SLOTS; ++i) {
+            if (_heads[level][(base + i) & SLOT_MASK] != -1) {
+                msec_t tick = (base + i) << (SLOT_BITS * level);
+                if (next_tick == 0 || tick < next_tick) {
+                    next_tick = tick;
+                }
+                break;
+            }
+        }
+    }
+
+    msec_t deadline = next_tick * TICK_MS;
+    if (deadline <= _now) {
+        return 0;
+    }
+    return static_cast<int>(deadline - _now);
+}
+
+const char* TimerWheel::kindToString(TimerKind kind) {
+    switch (kind) {
+        case TIMER_HEADER_READ: return "header read";
+        case TIMER_BODY_READ:   return "body read";
+        case TIMER_KEEPALIVE:   return "keep-alive";
+        case TIMER_WRITE:       return "write";
+        default:                return "none";
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include <vector>
+#include <cstddef>
+
+typedef unsigned long msec_t;
+
+// What a connection is currently waiting for; each kind has its own timeout
+enum TimerKind {
+    TIMER_NONE,
+    TIMER_HEADER_READ,
+    TIMER_BODY_READ,
+    TIMER_KEEPALIVE,
+    TIMER_WRITE
+};
+
+// Hierarchical timing wheel keyed by fd: at most one pending deadline per fd,
+// arm/re-arm/cancel are O(1) (unlink + link into a slot list). Level 0 has
+// TICK_MS resolution, each following level is SLOTS times coarser and gets
+// cascaded down when the level below wraps around.
+class TimerWheel {
+public:
+    static const msec_t TICK_MS = 100;
+
+    TimerWheel();
+    ~TimerWheel();
+
+    // Clock, read once per loop iteration and cached for everyone else
+    static msec_t monotonicMs();
+    msec_t updateClock();
+    msec_t now() const;
+
+    void arm(int fd, TimerKind kind, msec_t timeout_ms);
+    void cancel(int fd);
+    TimerKind kindOf(int fd) const;
+    size_t size() const;
+
+    // Collects (and disarms) every fd whose deadline has passed
+    void expire(std::vector<int>& expired);
+
+    // Milliseconds until the wheel next needs servicing, -1 if empty
+    int nextTimeout() const;
+
+    static const char* kindToString(TimerKind kind);
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int SLOT_MASK = SLOTS - 1;
+
+    struct Node {
+        int prev;
+        int next;
+        msec_t tick;
+        TimerKind kind;
+        int level;
+        int slot;
+
+        Node();
+    };
+
+    std::vector<Node> _nodes;
+    int _heads[LEVELS][SLOTS];
+    msec_t _current_tick;   // last tick already processed
+    msec_t _now;
+    size_t _count;
+
+    void link(int fd);
+    void unlink(int fd);
+    void cascade(int level);
+
+    TimerWheel(const TimerWheel&);
+    TimerWheel& operator=(const TimerWheel&);
+};
+
+#endif
@@ -0,0 +1,817 @@
+#include "Uring.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define MAX_TRACKED_URING_FDS (1 << 20)
+#define INITIAL_TRACKED_URING_FDS 1024
+
+// 6.3; the header may predate it. The first feature bit that implies
+// multishot recv (6.0) and provided buffer rings (5.19).
+#ifndef IORING_FEAT_REG_REG_RING
+# define IORING_FEAT_REG_REG_RING (1U << 13)
+#endif
+
+namespace {
+
+int uringSetup(unsigned entries, struct io_uring_params *params) {
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int uringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+	void *arg, size_t arg_size) {
+	return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size));
+}
+
+// Ring indexes are shared with the kernel: acquire what it produced,
+// release what we produced
+unsigned loadAcquire(const unsigned *p) {
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned *p, unsigned value) {
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+int uringRegister(int fd, unsigned opcode, void *arg, unsigned count) {
+	return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+// user_data: operation << 61 | generation << 32 | fd for an fd's poll,
+// accept or recv, a flag and the slot index for a send
+const uint64_t SEND_TAG = 1ULL << 63;
+const int OPERATION_SHIFT = 61;
+const uint32_t GENERATION_MASK = 0x1fffffff;
+
+uint64_t operationTag(int fd, int op, uint32_t generation) {
+	return (static_cast<uint64_t>(op) << OPERATION_SHIFT) | (static_cast<uint64_t>(generation) << 32)
+		| static_cast<uint32_t>(fd);
+}
+
+uint64_t sendTag(int fd, int slot) {
+	return SEND_TAG | (static_cast<uint64_t>(slot) << 32) | static_cast<uint32_t>(fd);
+}
+
+}
+
+UringManager::UringManager()
+	: _ring_fd(-1), _sq_map(MAP_FAILED), _sq_map_size(0), _cq_map(MAP_FAILED), _cq_map_size(0),
+	  _sqe_map(MAP_FAILED), _sqe_map_size(0), _sq_tail(0), _entries(NULL), _capacity(0),
+	  _completions(false), _buf_ring(NULL), _buf_ring_tail(NULL), _buf_tail(0)
+{
+	uint32_t features = 0;
+
+	std::memset(&_sq, 0, sizeof(_sq));
+	std::memset(&_cq, 0, sizeof(_cq));
+	std::memset(_recv_buffers, 0, sizeof(_recv_buffers));
+
+	if (!setup(features))
+	{
+		failed = true;
+		return ;
+	}
+
+	reserve(INITIAL_TRACKED_URING_FDS - 1);
+	_pending_fds.reserve(SQ_ENTRIES);
+
+	if (!(features & IORING_FEAT_REG_REG_RING))
+		Logger::info("io_uring: kernel before 6.3, readiness polls only");
+	else
+		_completions = setupBufferRing();
+}
+
+// Makes room for fd, doubling the table: it follows the highest fd bound,
+// not the descriptor limit. Completions carry the fd, never a pointer to
+// its entry, so entries may move.
+bool UringManager::reserve(int fd)
+{
+	if (static_cast<size_t>(fd) < _capacity)
+		return true;
+	if (fd >= MAX_TRACKED_URING_FDS)
+		return false;
+
+	size_t capacity = _capacity ? _capacity : INITIAL_TRACKED_URING_FDS;
+	while (capacity <= static_cast<size_t>(fd))
+		capacity *= 2;
+	if (capacity > MAX_TRACKED_URING_FDS)
+		capacity = MAX_TRACKED_URING_FDS;
+
+	FdEntry *entries = new FdEntry[capacity];
+	for (size_t i = 0; i < capacity; i++)
+	{
+		if (i < _capacity)
+		{
+			entries[i] = _entries[i];
+			continue;
+		}
+		entries[i].events = 0;
+		entries[i].op = OP_POLL;
+		entries[i].generation = 0;
+		entries[i].pending_sqe = -1;
+		entries[i].armed = false;
+		entries[i].on_read = NULL;
+		entries[i].on_write = NULL;
+		entries[i].on_error = NULL;
+		entries[i].on_io = NULL;
+		entries[i].user = NULL;
+	}
+	delete[] _entries;
+	_entries = entries;
+	_capacity = capacity;
+	Logger::debug("io_uring table grown to " + Utils::intToString(_capacity) + " fds");
+	return true;
+}
+
+bool UringManager::setup(uint32_t &features)
+{
+	struct io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+	params.cq_entries = CQ_ENTRIES;
+
+	_ring_fd = uringSetup(SQ_ENTRIES, &params);
+	if (_ring_fd == -1 && errno == EINVAL)
+	{
+		// Kernels before 5.19 do not know the optional flags
+		std::memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE;
+		params.cq_entries = CQ_ENTRIES;
+		_ring_fd = uringSetup(SQ_ENTRIES, &params);
+	}
+	if (_ring_fd == -1)
+	{
+		Logger::error("io_uring_setup failed");
+		return false;
+	}
+
+	// Waiting with a timeout needs EXT_ARG (5.11), silent removals need
+	// CQE_SKIP (5.17, which also implies multishot poll)
+	if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_CQE_SKIP))
+	{
+		Logger::error("io_uring: kernel too old (needs 5.17)");
+		return false;
+	}
+
+	_sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	_cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (_cq_map_size > _sq_map_size)
+			_sq_map_size = _cq_map_size;
+		_cq_map_size = 0;
+	}
+
+	_sq_map = mmap(NULL, _sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		_ring_fd, IORING_OFF_SQ_RING);
+	if (_sq_map == MAP_FAILED)
+	{
+		Logger::error("io_uring: failed to map the submission ring");
+		return false;
+	}
+	if (_cq_map_size)
+	{
+		_cq_map = mmap(NULL, _cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			_ring_fd, IORING_OFF_CQ_RING);
+		if (_cq_map == MAP_FAILED)
+		{
+			Logger::error("io_uring: failed to map the completion ring");
+			return false;
+		}
+	}
+	_sqe_map_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	_sqe_map = mmap(NULL, _sqe_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		_ring_fd, IORING_OFF_SQES);
+	if (_sqe_map == MAP_FAILED)
+	{
+		Logger::error("io_uring: failed to map the submission entries");
+		return false;
+	}
+
+	char *sq = static_cast<char *>(_sq_map);
+	char *cq = _cq_map_size ? static_cast<char *>(_cq_map) : sq;
+
+	_sq.head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+	_sq.tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+	_sq.mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+	_sq.entries = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+	_sq.array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+	_sq.sqes = static_cast<struct io_uring_sqe *>(_sqe_map);
+	_sq_tail = *_sq.tail;
+
+	_cq.head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+	_cq.tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+	_cq.mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+	_cq.cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+	// Slot i of the ring always points at sqe i
+	for (unsigned i = 0; i < params.sq_entries; i++)
+		_sq.array[i] = i;
+	features = params.features;
+
+	Logger::debug("io_uring ready (" + Utils::intToString(params.sq_entries) + " sq / "
+		+ Utils::intToString(params.cq_entries) + " cq entries)");
+	return true;
+}
+
+// Registers the ring recv picks its buffers from and fills it from the pool.
+// The ring itself only holds addresses: RECV_BUFFERS * 16 bytes.
+bool UringManager::setupBufferRing()
+{
+	size_t size = RECV_BUFFERS * sizeof(struct io_uring_buf);
+	void *ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring == MAP_FAILED)
+	{
+		Logger::error("io_uring: failed to map the buffer ring");
+		return false;
+	}
+
+	struct io_uring_buf_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+	reg.ring_entries = RECV_BUFFERS;
+	reg.bgid = RECV_GROUP;
+	if (uringRegister(_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+	{
+		Logger::warning("io_uring: cannot register a buffer ring, readiness polls only");
+		munmap(ring, size);
+		return false;
+	}
+
+	// Addressed as a plain array: in C++ the header's flexible array member
+	// does not start at offset 0
+	_buf_ring = static_cast<struct io_uring_buf *>(ring);
+	_buf_ring_tail = reinterpret_cast<uint16_t *>(static_cast<char *>(ring) + offsetof(struct io_uring_buf_ring, tail));
+	for (unsigned bid = 0; bid < RECV_BUFFERS; bid++)
+		_missing.push_back(static_cast<unsigned short>(bid));
+	refill();
+	Logger::debug("io_uring: multishot accept/recv, " + Utils::intToString(RECV_BUFFERS) + " recv buffers");
+	return true;
+}
+
+// Hands a pool segment to the kernel under buffer id bid; false (and bid
+// kept for refill) when the pool has none left
+bool UringManager::provide(unsigned short bid)
+{
+	BufferSegment *segment = _segments.get();
+	if (!segment)
+	{
+		_missing.push_back(bid);
+		return false;
+	}
+	_recv_buffers[bid] = segment;
+
+	// The tail is the first entry's resv field, only the others are set
+	struct io_uring_buf &buf = _buf_ring[_buf_tail & (RECV_BUFFERS - 1)];
+	buf.addr = reinterpret_cast<uint64_t>(segment->data);
+	buf.len = BufferSegment::SIZE;
+	buf.bid = bid;
+	__atomic_store_n(_buf_ring_tail, ++_buf_tail, __ATOMIC_RELEASE);
+	return true;
+}
+
+void UringManager::refill()
+{
+	while (!_missing.empty())
+	{
+		unsigned short bid = _missing.back();
+		_missing.pop_back();
+		if (!provide(bid))
+			return ;
+	}
+}
+
+// The segment a recv completion filled, replaced in the ring right away
+BufferSegment *UringManager::takeBuffer(const struct io_uring_cqe &cqe)
+{
+	unsigned short bid = static_cast<unsigned short>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+	BufferSegment *segment = _recv_buffers[bid];
+
+	_recv_buffers[bid] = NULL;
+	segment->next = NULL;
+	segment->start = 0;
+	segment->end = cqe.res > 0 ? static_cast<size_t>(cqe.res) : 0;
+	provide(bid);
+	return segment;
+}
+
+const char *UringManager::name() const throw()
+{
+	return "io_uring";
+}
+
+bool UringManager::isTracked(int fd) const throw()
+{
+	return fd >= 0 && static_cast<size_t>(fd) < _capacity && _entries[fd].events != 0;
+}
+
+bool UringManager::isTracked(int fd, int event) const throw()
+{
+	if (!isTracked(fd))
+		return false;
+	return (_entries[fd].events & event) == static_cast<uint32_t>(event);
+}
+
+int UringManager::getTrackedEvents(int fd) const throw()
+{
+	if (!isTracked(fd))
+		return 0;
+	return _entries[fd].events;
+}
+
+// Submits everything queued and, with min_complete, waits for completions.
+// Queued entries are no longer editable afterwards.
+bool UringManager::enter(unsigned min_complete, int timeout_ms) throw()
+{
+	unsigned to_submit = _sq_tail - loadAcquire(_sq.head);
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+
+	std::memset(&arg, 0, sizeof(arg));
+	if (min_complete && timeout_ms >= 0)
+	{
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+	}
+
+	storeRelease(_sq.tail, _sq_tail);
+	int ret = uringEnter(_ring_fd, to_submit, min_complete,
+		IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+	for (size_t i = 0; i < _pending_fds.size(); i++)
+		_entries[_pending_fds[i]].pending_sqe = -1;
+	_pending_fds.clear();
+
+	if (ret == -1 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+	{
+		Logger::error("io_uring_enter failed !");
+		return false;
+	}
+	return true;
+}
+
+struct io_uring_sqe *UringManager::getSqe() throw()
+{
+	if (_sq_tail - loadAcquire(_sq.head) >= *_sq.entries)
+	{
+		// Ring full: hand the batch to the kernel now instead of at the next wait
+		countControl();
+		enter(0, 0);
+		if (_sq_tail - loadAcquire(_sq.head) >= *_sq.entries)
+			return NULL;
+	}
+
+	struct io_uring_sqe *sqe = &_sq.sqes[_sq_tail & *_sq.mask];
+	std::memset(sqe, 0, sizeof(*sqe));
+	_sq_tail++;
+	return sqe;
+}
+
+// Queues a fresh poll for the entry's current mask
+bool UringManager::arm(int fd) throw()
+{
+	FdEntry &entry = _entries[fd];
+	struct io_uring_sqe *sqe = getSqe();
+
+	if (!sqe)
+	{
+		Logger::error("io_uring submission ring full, cannot arm fd " + Utils::intToString(fd));
+		return false;
+	}
+
+	entry.generation = (entry.generation + 1) & GENERATION_MASK;
+	if (entry.generation == 0)
+		entry.generation = 1;
+	sqe->fd = fd;
+	sqe->user_data = operationTag(fd, entry.op, entry.generation);
+	if (entry.op == OP_ACCEPT)
+	{
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	}
+	else if (entry.op == OP_RECV)
+	{
+		sqe->opcode = IORING_OP_RECV;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = RECV_GROUP;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+	}
+	else
+	{
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = entry.events & ~EVENT_EDGE;
+		sqe->len = (entry.events & EVENT_EDGE) ? IORING_POLL_ADD_MULTI : 0;
+	}
+
+	entry.armed = true;
+	entry.pending_sqe = static_cast<int>(sqe - _sq.sqes);
+	_pending_fds.push_back(fd);
+	return true;
+}
+
+// Drops the operation in flight. One still sitting in the ring becomes a
+// no-op, one already submitted gets a POLL_REMOVE (or an ASYNC_CANCEL for
+// an accept or recv, which closing the fd would not stop); its late
+// completions carry the old generation and are ignored either way.
+void UringManager::cancel(FdEntry &entry, int fd) throw()
+{
+	if (!entry.armed)
+		return;
+	entry.armed = false;
+
+	if (entry.pending_sqe != -1)
+	{
+		struct io_uring_sqe *sqe = &_sq.sqes[entry.pending_sqe];
+		std::memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_NOP;
+		sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+		entry.pending_sqe = -1;
+		return;
+	}
+
+	struct io_uring_sqe *sqe = getSqe();
+	if (!sqe)
+	{
+		Logger::error("io_uring submission ring full, cannot disarm fd " + Utils::intToString(fd));
+		return;
+	}
+	sqe->opcode = entry.op == OP_POLL ? IORING_OP_POLL_REMOVE : IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = operationTag(fd, entry.op, entry.generation);
+	sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+}
+
+// Applies a mask change: edited in place while the poll is still queued,
+// replaced otherwise. An accept or recv only has EVENT_READ to lose.
+void UringManager::rearm(FdEntry &entry, int fd) throw()
+{
+	if (entry.op != OP_POLL)
+	{
+		if (!(entry.events & EVENT_READ))
+			cancel(entry, fd);
+		return ;
+	}
+	if (entry.pending_sqe != -1)
+	{
+		struct io_uring_sqe *sqe = &_sq.sqes[entry.pending_sqe];
+		sqe->poll32_events = entry.events & ~EVENT_EDGE;
+		sqe->len = (entry.events & EVENT_EDGE) ? IORING_POLL_ADD_MULTI : 0;
+		return;
+	}
+	cancel(entry, fd);
+	arm(fd);
+}
+
+bool UringManager::bindToFd(int fd, uint32_t event, callback_t callback, void *user)
+{
+	if (fd < 0 || !reserve(fd))
+	{
+		Logger::error("fd " + Utils::intToString(fd) + " exceeds the io_uring table capacity");
+		return false;
+	}
+
+	FdEntry &entry = _entries[fd];
+
+	if (entry.events != 0 && entry.op != OP_POLL)
+	{
+		Logger::error("fd " + Utils::intToString(fd) + " is bound for completions, not for " + eventMaskToString(event));
+		return false;
+	}
+	if (entry.events == 0)
+		entry.op = OP_POLL;
+	if (entry.events != 0 && (entry.events & event) == event)
+	{
+		Logger::debug("fd " + Utils::intToString(fd) + " already bound for event " + eventMaskToString(event));
+		return true;
+	}
+
+	if (event & EVENT_READ)
+		entry.on_read = callback;
+	if (event & EVENT_WRITE)
+		entry.on_write = callback;
+	if (event & EVENT_ERROR)
+		entry.on_error = callback;
+	if (user)
+		entry.user = user;
+	entry.events |= event;
+
+	rearm(entry, fd);
+	if (!entry.armed)
+	{
+		entry.events &= ~event;
+		return false;
+	}
+	Logger::debug("Bound fd " + Utils::intToString(fd) + " for event " + eventMaskToString(event));
+	return true;
+}
+
+bool UringManager::unbindFd(int fd, int event) throw()
+{
+	if (fd < 0 || static_cast<size_t>(fd) >= _capacity)
+		return false;
+
+	FdEntry &entry = _entries[fd];
+
+	if (event == -1)
+	{
+		cancel(entry, fd);
+		entry.events = 0;
+		entry.on_read = NULL;
+		entry.on_write = NULL;
+		entry.on_error = NULL;
+		entry.on_io = NULL;
+		entry.user = NULL;
+		Logger::debug("Unbound all events for fd " + Utils::intToString(fd));
+		return true;
+	}
+	if (!isTracked(fd, event))
+	{
+		Logger::debug("fd " + Utils::intToString(fd) + " is not bound for event " + eventMaskToString(event));
+		return false;
+	}
+
+	entry.events &= ~event;
+	if (event & EVENT_READ)
+		entry.on_read = NULL;
+	if (event & EVENT_WRITE)
+		entry.on_write = NULL;
+	if (event & EVENT_ERROR)
+		entry.on_error = NULL;
+	if (entry.events == 0)
+		entry.on_io = NULL;
+	rearm(entry, fd);
+	Logger::debug("Unbound fd " + Utils::intToString(fd) + " for event " + eventMaskToString(event));
+	return true;
+}
+
+bool UringManager::supportsCompletions() const throw()
+{
+	return _completions;
+}
+
+bool UringManager::bindAccept(int fd, io_callback_t callback, void *user)
+{
+	return bindOperation(fd, OP_ACCEPT, callback, user);
+}
+
+bool UringManager::bindRecv(int fd, io_callback_t callback, void *user)
+{
+	return bindOperation(fd, OP_RECV, callback, user);
+}
+
+bool UringManager::bindOperation(int fd, Operation op, io_callback_t callback, void *user)
+{
+	if (!_completions)
+		return false;
+	if (fd < 0 || !reserve(fd))
+	{
+		Logger::error("fd " + Utils::intToString(fd) + " exceeds the io_uring table capacity");
+		return false;
+	}
+
+	FdEntry &entry = _entries[fd];
+
+	if (entry.events != 0)
+	{
+		if (entry.op == op)
+			return true;
+		Logger::error("fd " + Utils::intToString(fd) + " is already bound for another operation");
+		return false;
+	}
+
+	entry.op = op;
+	entry.events = EVENT_READ;
+	entry.on_io = callback;
+	entry.user = user;
+	if (!arm(fd))
+	{
+		entry.events = 0;
+		entry.on_io = NULL;
+		return false;
+	}
+	Logger::debug("Bound fd " + Utils::intToString(fd) + (op == OP_ACCEPT ? " for accept" : " for recv"));
+	return true;
+}
+
+bool UringManager::submitSend(int fd, const struct iovec *iov, int count, io_callback_t callback, void *user)
+{
+	if (!_completions || count <= 0 || count > MAX_SEND_SEGMENTS)
+		return false;
+
+	struct io_uring_sqe *sqe = getSqe();
+	if (!sqe)
+	{
+		Logger::error("io_uring submission ring full, cannot send to fd " + Utils::intToString(fd));
+		return false;
+	}
+
+	int index;
+	if (_free_send_slots.empty())
+	{
+		index = static_cast<int>(_send_slots.size());
+		_send_slots.push_back(new SendSlot);
+	}
+	else
+	{
+		index = _free_send_slots.back();
+		_free_send_slots.pop_back();
+	}
+
+	SendSlot &slot = *_send_slots[index];
+	std::memset(&slot.msg, 0, sizeof(slot.msg));
+	std::memcpy(slot.iov, iov, count * sizeof(*iov));
+	slot.msg.msg_iov = slot.iov;
+	slot.msg.msg_iovlen = count;
+	slot.fd = fd;
+	slot.callback = callback;
+	slot.user = user;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uint64_t>(&slot.msg);
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = sendTag(fd, index);
+	return true;
+}
+
+// Returns false for completions that are not a current operation: removals,
+// no-ops, operations replaced since. A buffer a stale recv took still goes
+// back to the pool.
+bool UringManager::dispatch(const struct io_uring_cqe &cqe, void *ptr) throw()
+{
+	if (cqe.user_data & SEND_TAG)
+	{
+		dispatchSend(cqe, ptr);
+		return true;
+	}
+
+	BufferSegment *segment = (cqe.flags & IORING_CQE_F_BUFFER) ? takeBuffer(cqe) : NULL;
+	int fd = static_cast<int>(cqe.user_data & 0xffffffffu);
+	int op = static_cast<int>(cqe.user_data >> OPERATION_SHIFT);
+	uint32_t generation = static_cast<uint32_t>(cqe.user_data >> 32) & GENERATION_MASK;
+
+	if (generation == 0 || fd < 0 || static_cast<size_t>(fd) >= _capacity || _entries[fd].events == 0
+		|| !_entries[fd].armed || _entries[fd].generation != generation)
+	{
+		if (segment)
+			_segments.put(segment);
+		// Accepted after the listen socket was unbound: nobody takes it
+		if (op == OP_ACCEPT && cqe.res >= 0)
+			close(cqe.res);
+		return false;
+	}
+
+	FdEntry &entry = _entries[fd];
+
+	if (!(cqe.flags & IORING_CQE_F_MORE))
+		entry.armed = false;
+
+	void *context = entry.user ? entry.user : ptr;
+
+	if (entry.op != OP_POLL)
+	{
+		dispatchIo(fd, cqe, segment, context);
+		return true;
+	}
+
+	// From here on the entry is indexed each time: a callback that binds a
+	// higher fd may move the table
+	if (cqe.res < 0)
+	{
+		Logger::error("io_uring poll failed for fd " + Utils::intToString(fd) + ": " + std::strerror(-cqe.res));
+		if (_entries[fd].events & EVENT_ERROR)
+			_entries[fd].on_error(fd, context);
+		return true;
+	}
+
+	uint32_t events = static_cast<uint32_t>(cqe.res);
+
+	// Re-check the mask before each callback: an earlier one may have
+	// unbound (or closed) the fd.
+	if ((events & EVENT_READ) && (_entries[fd].events & EVENT_READ))
+		_entries[fd].on_read(fd, context);
+	if ((events & EVENT_WRITE) && (_entries[fd].events & EVENT_WRITE))
+		_entries[fd].on_write(fd, context);
+	if ((events & EVENT_ERROR) && (_entries[fd].events & EVENT_ERROR))
+		_entries[fd].on_error(fd, context);
+
+	// One-shot poll (level-triggered) or a multishot one the kernel ended
+	if (_entries[fd].events != 0 && !_entries[fd].armed)
+		arm(fd);
+	return true;
+}
+
+// An accept or recv the kernel ended on its own (full completion queue) is
+// armed again. One that ran out of buffers waits for its turn if the ring
+// has been refilled since, and is reported otherwise: the pool is empty.
+void UringManager::dispatchIo(int fd, const struct io_uring_cqe &cqe, BufferSegment *segment, void *context) throw()
+{
+	Operation op = _entries[fd].op;
+
+	if (cqe.res == -ENOBUFS && op == OP_RECV && _missing.empty())
+	{
+		_buffer_waiters.push_back(fd);
+		return ;
+	}
+
+	_entries[fd].on_io(fd, cqe.res, segment, context);
+
+	if ((_entries[fd].events & EVENT_READ) && !_entries[fd].armed && _entries[fd].op == op
+		&& (op == OP_ACCEPT || cqe.res > 0))
+		arm(fd);
+}
+
+// Re-arms the recvs an empty ring ended, no more per pass than the ring
+// holds: armed all at once, thousands of them would race for the same
+// buffers and most would end with ENOBUFS again. An fd unbound or bound
+// anew since is skipped.
+void UringManager::rearmWaiters() throw()
+{
+	size_t count = std::min(_buffer_waiters.size(), static_cast<size_t>(RECV_BUFFERS));
+
+	for (size_t i = 0; i < count; i++)
+	{
+		int fd = _buffer_waiters[i];
+		FdEntry &entry = _entries[fd];
+		if ((entry.events & EVENT_READ) && entry.op == OP_RECV && !entry.armed)
+			arm(fd);
+	}
+	_buffer_waiters.erase(_buffer_waiters.begin(), _buffer_waiters.begin() + count);
+}
+
+// The slot is free again before the callback, which may send once more
+void UringManager::dispatchSend(const struct io_uring_cqe &cqe, void *ptr) throw()
+{
+	int index = static_cast<int>((cqe.user_data >> 32) & GENERATION_MASK);
+	SendSlot &slot = *_send_slots[index];
+	int fd = slot.fd;
+	io_callback_t callback = slot.callback;
+	void *context = slot.user ? slot.user : ptr;
+
+	_free_send_slots.push_back(index);
+	callback(fd, cqe.res, NULL, context);
+}
+
+int UringManager::watchForEvents(void *ptr, int timeout_ms) throw()
+{
+	unsigned head = *_cq.head;
+
+	if (!_missing.empty())
+		refill();
+	if (!_buffer_waiters.empty() && _missing.empty())
+		rearmWaiters();
+	unsigned tail = loadAcquire(_cq.tail);
+
+	// Completions left from a flush need no wait; queued submissions still
+	// have to go out before sleeping
+	if (head == tail || _sq_tail != loadAcquire(_sq.head))
+	{
+		countWait();
+		if (!enter(head == tail && timeout_ms != 0 ? 1 : 0, timeout_ms))
+			return -1;
+		tail = loadAcquire(_cq.tail);
+	}
+
+	int dispatched = 0;
+	while (head != tail)
+	{
+		struct io_uring_cqe cqe = _cq.cqes[head & *_cq.mask];
+		storeRelease(_cq.head, ++head);
+		if (dispatch(cqe, ptr))
+			dispatched++;
+	}
+	return dispatched;
+}
+
+UringManager::~UringManager()
+{
+	// Closing the ring cancels every poll still in flight
+	if (_sqe_map != MAP_FAILED)
+		munmap(_sqe_map, _sqe_map_size);
+	if (_cq_map != MAP_FAILED)
+		munmap(_cq_map, _cq_map_size);
+	if (_sq_map != MAP_FAILED)
+		munmap(_sq_map, _sq_map_size);
+	if (_ring_fd != -1)
+		close(_ring_fd);
+	// No recv can pick a buffer once the ring is closed
+	if (_buf_ring)
+		munmap(_buf_ring, RECV_BUFFERS * sizeof(struct io_uring_buf));
+	for (unsigned bid = 0; bid < RECV_BUFFERS; bid++)
+	{
+		if (_recv_buffers[bid])
+			_segments.put(_recv_buffers[bid]);
+	}
+	for (size_t i = 0; i < _send_slots.size(); i++)
+		delete _send_slots[i];
+	delete[] _entries;
+}
@@ -0,0 +1,162 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#include "EventManager.hpp"
+#include "ChainBuffer.hpp"
+
+// io_uring backend, driven through the raw syscalls (no liburing).
+//
+// Every bound fd has one IORING_OP_POLL_ADD in flight: multishot for
+// edge-triggered fds, one-shot and re-armed after each dispatch for
+// level-triggered ones (a fresh poll checks current readiness, which is
+// exactly level semantics). Arming, re-arming and removal are only queued in
+// the submission ring and reach the kernel with the next wait, in the same
+// io_uring_enter: changing what an fd is bound for costs no syscall of its
+// own, where epoll needs one epoll_ctl per change.
+//
+// From 6.3 on the backend also does the I/O itself (supportsCompletions):
+// listen sockets get a multishot accept, client sockets a multishot recv
+// that picks its buffers from a ring of pool segments registered with the
+// kernel, and sends are SENDMSG operations. The data moves without a
+// syscall of its own; results arrive with the next wait. A segment a recv
+// filled goes to the callback as is and a fresh one takes its place in the
+// ring.
+class UringManager : public EventManager
+{
+	private:
+
+		// What the fd's single operation in flight does
+		enum Operation
+		{
+			OP_POLL,
+			OP_ACCEPT,
+			OP_RECV
+		};
+
+		struct FdEntry
+		{
+			uint32_t events;
+			Operation op;
+			uint32_t generation;	// tags the poll in flight, completions of older ones are dropped
+			int pending_sqe;		// queued POLL_ADD not submitted yet, still editable; -1 otherwise
+			bool armed;				// a poll is queued or in flight
+			callback_t on_read;
+			callback_t on_write;
+			callback_t on_error;
+			io_callback_t on_io;	// OP_ACCEPT and OP_RECV
+			void *user;
+		};
+
+		static const int MAX_SEND_SEGMENTS = 32;
+
+		// Kept until the send completes: the kernel may read the header late
+		struct SendSlot
+		{
+			struct msghdr msg;
+			struct iovec iov[MAX_SEND_SEGMENTS];
+			int fd;
+			io_callback_t callback;
+			void *user;
+		};
+
+		struct SubmitRing
+		{
+			unsigned *head;
+			unsigned *tail;
+			unsigned *mask;
+			unsigned *entries;
+			unsigned *array;
+			struct io_uring_sqe *sqes;
+		};
+
+		struct CompleteRing
+		{
+			unsigned *head;
+			unsigned *tail;
+			unsigned *mask;
+			struct io_uring_cqe *cqes;
+		};
+
+		static const unsigned SQ_ENTRIES = 1024;
+		static const unsigned CQ_ENTRIES = 8192;
+		static const unsigned RECV_BUFFERS = 128;	// provided buffer ring, a power of two
+		static const unsigned short RECV_GROUP = 0;
+
+		int _ring_fd;
+		void *_sq_map;
+		size_t _sq_map_size;
+		void *_cq_map;
+		size_t _cq_map_size;
+		void *_sqe_map;
+		size_t _sqe_map_size;
+		SubmitRing _sq;
+		CompleteRing _cq;
+		unsigned _sq_tail;			// our tail, published to the kernel on enter
+
+		FdEntry *_entries;
+		size_t _capacity;
+		std::vector<int> _pending_fds;	// entries with a pending_sqe to reset once submitted
+
+		bool _completions;
+		struct io_uring_buf *_buf_ring;
+		uint16_t *_buf_ring_tail;		// shares the first entry's last bytes
+		uint16_t _buf_tail;				// our tail, published to the kernel at once
+		BufferSegment *_recv_buffers[RECV_BUFFERS];	// by buffer id
+		std::vector<unsigned short> _missing;	// buffer ids waiting for a segment from the pool
+		std::vector<int> _buffer_waiters;	// recvs ended by an empty ring, armed again in turn
+		SegmentPool _segments;
+		std::vector<SendSlot *> _send_slots;
+		std::vector<int> _free_send_slots;
+
+		bool setup(uint32_t &features);
+		bool setupBufferRing();
+		bool provide(unsigned short bid);
+		void refill();
+		void rearmWaiters() throw();
+		BufferSegment *takeBuffer(const struct io_uring_cqe &cqe);
+		bool bindOperation(int fd, Operation op, io_callback_t callback, void *user);
+		bool reserve(int fd);
+		bool enter(unsigned min_complete, int timeout_ms) throw();
+		struct io_uring_sqe *getSqe() throw();
+		bool arm(int fd) throw();
+		void cancel(FdEntry &entry, int fd) throw();
+		void rearm(FdEntry &entry, int fd) throw();
+		bool dispatch(const struct io_uring_cqe &cqe, void *ptr) throw();
+		void dispatchIo(int fd, const struct io_uring_cqe &cqe, BufferSegment *segment, void *context) throw();
+		void dispatchSend(const struct io_uring_cqe &cqe, void *ptr) throw();
+
+	public:
+
+		UringManager();
+
+		const char *name() const throw();
+
+		bool isTracked(int fd) const throw();
+
+		bool isTracked(int fd, int event) const throw();
+
+		int getTrackedEvents(int fd) const throw();
+
+		bool bindToFd(int fd, uint32_t event, callback_t callback, void *user = NULL);
+
+		bool unbindFd(int fd, int event) throw();
+
+		bool supportsCompletions() const throw();
+
+		bool bindAccept(int fd, io_callback_t callback, void *user = NULL);
+
+		bool bindRecv(int fd, io_callback_t callback, void *user = NULL);
+
+		bool submitSend(int fd, const struct iovec *iov, int count, io_callback_t callback, void *user = NULL);
+
+		int watchForEvents(void *ptr, int timeout_ms) throw();
+
+		~UringManager();
+};
+
+#endif
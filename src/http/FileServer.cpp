@@ -187,10 +187,10 @@ HTTPResponse FileServer::serveStaticFile(const std::string& filepath) {
     }
     
     HTTPResponse response(200);
-    response.setBody(content);
+    response.swapBody(content);
     response.setContentType(HTTPResponse::getContentTypeByExtension(filepath));
     
-    Logger::debug("Served file: " + filepath + " (" + Utils::intToString(content.length()) + " bytes)");
+    Logger::debug("Served file: " + filepath + " (" + Utils::intToString(response.getBody().length()) + " bytes)");
     return response;
 }
 
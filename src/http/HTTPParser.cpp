@@ -1,30 +1,71 @@
 #include "HTTPParser.hpp"
+#include "Scanner.hpp"
 #include "Utils.hpp"
 #include "Logger.hpp"
-#include <sstream>
-#include <cstdlib>
+#include "Config.hpp"
+#include <cstring>
 
-HTTPParser::HTTPParser() {
+HTTPParser::HTTPParser() : _input(NULL), _config(NULL) {
     reset();
 }
 
 HTTPParser::~HTTPParser() {
 }
 
+// Drops whatever is buffered, including bytes of a following request
 void HTTPParser::reset() {
     _state = PARSING_REQUEST_LINE;
-    _buffer.clear();
+    if (_input) {
+        _input->clear();
+    }
     _request = 0;
     _bytes_parsed = 0;
     _body_bytes_received = 0;
+    _chunk_state = CHUNK_SIZE;
+    _chunk_remaining = 0;
+    _cursor = 0;
+    _scanned = 0;
+    _detached = false;
+    _body_buffer_size = ServerConfig::DEFAULT_BODY_BUFFER_SIZE;
+    _max_body_size = ServerConfig::DEFAULT_MAX_BODY_SIZE;
+    _error_status = 400;
+}
+
+// The head of the request just answered is consumed now: its slices were
+// in use until then
+void HTTPParser::next() {
+    if (_cursor > 0) {
+        size_t head = _cursor;
+        _cursor = 0;
+        consume(head);
+    }
+    _state = PARSING_REQUEST_LINE;
+    _request = 0;
+    _bytes_parsed = 0;
+    _body_bytes_received = 0;
+    _chunk_state = CHUNK_SIZE;
+    _chunk_remaining = 0;
+    _scanned = 0;
+    _detached = false;
+    _body_buffer_size = ServerConfig::DEFAULT_BODY_BUFFER_SIZE;
+    _max_body_size = ServerConfig::DEFAULT_MAX_BODY_SIZE;
+    _error_status = 400;
+}
+
+void HTTPParser::setInput(ChainBuffer* input) {
+    _input = input;
+}
+
+void HTTPParser::setConfig(const Config* config) {
+    _config = config;
 }
 
-bool HTTPParser::parse(HTTPRequest& request, const std::string& data) {
-    return parse(request, data.c_str(), data.length());
+bool HTTPParser::hasBufferedData() const {
+    return _input && !_input->empty();
 }
 
-bool HTTPParser::parse(HTTPRequest& request, const char* data, size_t length) {
-    if (!data || length == 0) {
+bool HTTPParser::parse(HTTPRequest& request) {
+    if (!_input || _input->empty()) {
         return false;
     }
     
@@ -32,23 +73,27 @@ bool HTTPParser::parse(HTTPRequest& request, const char* data, size_t length) {
         _request = &request;
     }
     
-    _buffer.append(data, length);
-    _bytes_parsed += length;
-    
     // Debug: afficher l'état actuel
-    Logger::debug("Parser state: " + Utils::intToString(_state) + 
-                  ", buffer size: " + Utils::intToString(_buffer.length()));
+    if (Logger::isEnabled(DEBUG)) {
+        Logger::debug("Parser state: " + Utils::intToString(_state) + 
+                      ", buffer size: " + Utils::intToString(_input->size()));
+    }
     
+    const char* line;
+    size_t length;
     while (_state != PARSING_COMPLETE && _state != PARSING_ERROR) {
         switch (_state) {
             case PARSING_REQUEST_LINE:
-                if (hasCompleteLine()) {
-                    std::string line = getNextLine();
-                    if (!parseRequestLine(line)) {
+                if (nextLine(line, length)) {
+                    size_t offset;
+                    if (!headOffset(line, length, offset) || !parseRequestLine(line, length, offset)) {
                         setState(PARSING_ERROR);
                         return false;
                     }
+                    advanceHead(length + 2);
                     setState(PARSING_HEADERS);
+                } else if (_state == PARSING_ERROR) {
+                    return false;
                 } else {
                     Logger::debug("Need more data for request line");
                     return true;
@@ -56,21 +101,27 @@ bool HTTPParser::parse(HTTPRequest& request, const char* data, size_t length) {
                 break;
                 
             case PARSING_HEADERS:
-                while (hasCompleteLine()) {
-                    std::string line = getNextLine();
-                    
-                    if (line.empty()) {
+                while (nextLine(line, length)) {
+                    if (length == 0) {
+                        advanceHead(2);
+                        finishHead();
+                        setBodyLimits();
                         Logger::debug("Headers parsing complete, switching to body");
                         setState(PARSING_BODY);
                         break;
                     }
                     
-                    if (!parseHeader(line)) {
+                    size_t offset;
+                    if (!headOffset(line, length, offset) || !parseHeader(line, length, offset)) {
                         setState(PARSING_ERROR);
                         return false;
                     }
+                    advanceHead(length + 2);
                 }
                 
+                if (_state == PARSING_ERROR) {
+                    return false;
+                }
                 if (_state == PARSING_HEADERS) {
                     Logger::debug("Need more data for headers");
                     return true;
@@ -79,9 +130,14 @@ bool HTTPParser::parse(HTTPRequest& request, const char* data, size_t length) {
                 
             case PARSING_BODY:
                 if (!parseBody()) {
-                    Logger::debug("Need more data for body (have " + 
-                                Utils::intToString(_buffer.length()) + " bytes, need " + 
-                                Utils::intToString(_request->getContentLength()) + " bytes)");
+                    if (_state == PARSING_ERROR) {
+                        return false;
+                    }
+                    if (Logger::isEnabled(DEBUG)) {
+                        Logger::debug("Need more data for body (have " + 
+                                    Utils::intToString(_body_bytes_received) + " bytes, need " + 
+                                    Utils::intToString(_request->getContentLength()) + " bytes)");
+                    }
                     return true;
                 }
                 setState(PARSING_COMPLETE);
@@ -103,69 +159,97 @@ bool HTTPParser::parse(HTTPRequest& request, const char* data, size_t length) {
     return false;
 }
 
-bool HTTPParser::parseRequestLine(const std::string& line) {
-    std::vector<std::string> parts = Utils::split(line, ' ');
+// "METHOD SP URI SP VERSION", split where it lies in the read buffer; the
+// request keeps the URI as a slice of the head. Method and URI are scanned
+// as visible characters: the scan stops at the space after them, any other
+// stop is an invalid character.
+bool HTTPParser::parseRequestLine(const char* line, size_t length, size_t offset) {
+    const char* end = line + length;
+    const char* first_space = Scanner::skipVisible(line, end);
+    const char* uri = first_space + 1;
+    const char* second_space = first_space < end && *first_space == ' '
+        ? Scanner::skipVisible(uri, end) : end;
     
-    if (parts.size() != 3) {
-        Logger::debug("Invalid request line format: " + line);
+    if (second_space == end || *second_space != ' ') {
+        Logger::debug("Invalid request line format: " + std::string(line, length));
         return false;
     }
     
-    HTTPMethod method = stringToMethod(parts[0]);
+    HTTPMethod method = stringToMethod(line, first_space - line);
     if (method == METHOD_UNKNOWN) {
-        Logger::debug("Unknown HTTP method: " + parts[0]);
+        Logger::debug("Unknown HTTP method: " + std::string(line, first_space));
         return false;
     }
     
-    if (!isValidURI(parts[1])) {
-        Logger::debug("Invalid URI: " + parts[1]);
+    size_t uri_length = second_space - uri;
+    if (!isValidURI(uri, uri_length)) {
+        Logger::debug("Invalid URI: " + std::string(uri, uri_length));
         return false;
     }
     
-    HTTPVersion version = stringToVersion(parts[2]);
+    HTTPVersion version = stringToVersion(second_space + 1, end - second_space - 1);
     if (version == HTTP_UNKNOWN) {
-        Logger::debug("Unknown HTTP version: " + parts[2]);
+        Logger::debug("Unknown HTTP version: " + std::string(second_space + 1, end));
         return false;
     }
     
     _request->setMethod(method);
-    _request->setURI(parts[1]);
+    _request->setTarget(offset + (uri - line), uri_length);
     _request->setVersion(version);
     
-    Logger::debug("Parsed request line: " + parts[0] + " " + parts[1] + " " + parts[2]);
+    if (Logger::isEnabled(DEBUG)) {
+        Logger::debug("Parsed request line: " + std::string(line, length));
+    }
     return true;
 }
 
-bool HTTPParser::parseHeader(const std::string& line) {
-    size_t colon_pos = line.find(':');
-    if (colon_pos == std::string::npos) {
-        Logger::debug("Invalid header format: " + line);
+static bool isBlank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// The name is scanned as token characters up to the ':' (blanks around it
+// are tolerated); nextLine already rejected control characters in the value.
+bool HTTPParser::parseHeader(const char* line, size_t length, size_t offset) {
+    const char* end = line + length;
+    const char* name_begin = line;
+    while (name_begin < end && isBlank(*name_begin)) ++name_begin;
+    const char* name_end = Scanner::skipToken(name_begin, end);
+    const char* colon = name_end;
+    while (colon < end && isBlank(*colon)) ++colon;
+    
+    if (colon == end || *colon != ':') {
+        Logger::debug("Invalid header format: " + std::string(line, length));
         return false;
     }
-    
-    std::string name = Utils::trim(line.substr(0, colon_pos));
-    std::string value = Utils::trim(line.substr(colon_pos + 1));
-    
-    if (!isValidHeaderName(name)) {
-        Logger::debug("Invalid header name: " + name);
+    if (name_end == name_begin) {
+        Logger::debug("Invalid header name: " + std::string(line, colon));
         return false;
     }
     
-    _request->addHeader(name, value);
-    Logger::debug("Parsed header: " + name + " = " + value);
+    // Trimmed in place, the request records where name and value lie
+    const char* value_begin = colon + 1;
+    const char* value_end = end;
+    while (value_begin < value_end && isBlank(*value_begin)) ++value_begin;
+    while (value_end > value_begin && isBlank(value_end[-1])) --value_end;
+    
+    _request->addHeader(offset + (name_begin - line), name_end - name_begin,
+                        offset + (value_begin - line), value_end - value_begin);
+    if (Logger::isEnabled(DEBUG)) {
+        Logger::debug("Parsed header: " + std::string(name_begin, name_end) + " = " + std::string(value_begin, value_end));
+    }
     return true;
 }
 
+// Body bytes go from the read buffer into the request as they arrive, in
+// one copy, instead of waiting for the whole body to be buffered
 bool HTTPParser::parseBody() {
-    Logger::debug("parseBody called, expected length: " + Utils::intToString(_request->getContentLength()));
-    Logger::debug("Current buffer length: " + Utils::intToString(_buffer.length()));
-    
-    // For GET requests, no body expected
-    if (_request->getMethod() == METHOD_GET || _request->getMethod() == METHOD_DELETE) {
-        return true;
+    if (Logger::isEnabled(DEBUG)) {
+        Logger::debug("parseBody called, expected length: " + Utils::intToString(_request->getContentLength()));
+        Logger::debug("Current buffer length: " + Utils::intToString(_input->size()));
     }
     
-    // Check if we have Content-Length
+    // Check if we have Content-Length (any method: a GET body must still be
+    // consumed, or it would be parsed as the next pipelined request)
     size_t expected_length = _request->getContentLength();
     
     if (expected_length == 0 && !_request->isChunked()) {
@@ -177,44 +261,204 @@ bool HTTPParser::parseBody() {
         return parseChunkedBody();
     }
     
-    // Check if we have enough data for the body
-    if (_buffer.length() >= expected_length) {
-        std::string body = _buffer.substr(0, expected_length);
-        _buffer = _buffer.substr(expected_length);
-        _request->setBody(body);
-        Logger::debug("Parsed body: " + Utils::intToString(body.length()) + " bytes");
-        return true;
+    // Refused before a byte of it is stored, in memory or on disk
+    if (expected_length > _max_body_size) {
+        Logger::warning("Request body of " + Utils::intToString(expected_length) + " bytes exceeds client_max_body_size ("
+                        + Utils::intToString(_max_body_size) + ")");
+        setError(413);
+        return false;
     }
-    return false; // need more data
+    
+    // The length is known: a large body goes to its file from the first byte
+    if (_body_bytes_received == 0) {
+        if (expected_length > _body_buffer_size) {
+            if (!_request->spillBody()) {
+                setState(PARSING_ERROR);
+                return false;
+            }
+        } else {
+            _request->getBodyRef().reserve(expected_length < MAX_BODY_RESERVE ? expected_length : MAX_BODY_RESERVE);
+        }
+    }
+    while (_body_bytes_received < expected_length && !_input->empty()) {
+        size_t wanted = expected_length - _body_bytes_received;
+        size_t taken = _input->frontSize() < wanted ? _input->frontSize() : wanted;
+        if (!appendBody(_input->front(), taken)) {
+            return false;
+        }
+        consume(taken);
+        _body_bytes_received += taken;
+    }
+    if (_body_bytes_received < expected_length) {
+        return false; // need more data
+    }
+    if (!_request->flushBody()) {
+        setState(PARSING_ERROR);
+        return false;
+    }
+    if (Logger::isEnabled(DEBUG)) {
+        Logger::debug("Parsed body: " + Utils::intToString(_request->getBodyLength()) + " bytes"
+                      + (_request->hasBodyFile() ? " (temp file)" : ""));
+    }
+    return true;
+}
+
+// A chunked body is held in memory until it outgrows the buffer size, then
+// moved to its file; it is stopped as soon as it outgrows the maximum size
+bool HTTPParser::appendBody(const char* data, size_t length) {
+    if (_request->getBodyLength() + length > _max_body_size) {
+        Logger::warning("Chunked request body exceeds client_max_body_size (" + Utils::intToString(_max_body_size) + ")");
+        setError(413);
+        return false;
+    }
+    if (!_request->hasBodyFile() && _request->getBodyLength() + length > _body_buffer_size
+        && !_request->spillBody()) {
+        setState(PARSING_ERROR);
+        return false;
+    }
+    if (!_request->appendBody(data, length)) {
+        setState(PARSING_ERROR);
+        return false;
+    }
+    return true;
 }
 
-HTTPMethod HTTPParser::stringToMethod(const std::string& method) {
-    if (method == "GET") return METHOD_GET;
-    if (method == "POST") return METHOD_POST;
-    if (method == "DELETE") return METHOD_DELETE;
-    if (method == "PUT") return METHOD_PUT;
+// From the server block the request will be answered by, chosen as in
+// Server::generateHttpResponse
+void HTTPParser::setBodyLimits() {
+    const ServerConfig* server = _config ? _config->getServerByPort(_request->getPort()) : NULL;
+    if (server) {
+        _body_buffer_size = server->getClientBodyBufferSize();
+        _max_body_size = server->getClientMaxBodySize();
+    } else {
+        _body_buffer_size = ServerConfig::DEFAULT_BODY_BUFFER_SIZE;
+        _max_body_size = ServerConfig::DEFAULT_MAX_BODY_SIZE;
+    }
+}
+
+static bool equals(const char* data, size_t length, const char* literal) {
+    return length == strlen(literal) && memcmp(data, literal, length) == 0;
+}
+
+HTTPMethod HTTPParser::stringToMethod(const char* method, size_t length) {
+    if (equals(method, length, "GET")) return METHOD_GET;
+    if (equals(method, length, "POST")) return METHOD_POST;
+    if (equals(method, length, "DELETE")) return METHOD_DELETE;
+    if (equals(method, length, "PUT")) return METHOD_PUT;
     return METHOD_UNKNOWN;
 }
 
-HTTPVersion HTTPParser::stringToVersion(const std::string& version) {
-    if (version == "HTTP/1.0") return HTTP_1_0;
-    if (version == "HTTP/1.1") return HTTP_1_1;
+HTTPVersion HTTPParser::stringToVersion(const char* version, size_t length) {
+    if (equals(version, length, "HTTP/1.0")) return HTTP_1_0;
+    if (equals(version, length, "HTTP/1.1")) return HTTP_1_1;
     return HTTP_UNKNOWN;
 }
 
-std::string HTTPParser::getNextLine() {
-    size_t line_end = _buffer.find("\r\n");
-    if (line_end == std::string::npos) {
-        return "";
+// Points at the next CRLF-terminated line (CRLF excluded) where it lies in
+// the input, past the head bytes already parsed; the caller then advances
+// past length + 2. A line split across segments is gathered into the first
+// one. False when the line is not complete yet, or on error: a bare CR or
+// LF, another control character, or a line that cannot fit in a segment.
+// The line is scanned for control characters, which finds its end and
+// validates it in the same pass. The scan resumes where the previous call
+// stopped: a header arriving a few bytes per read is scanned once, not once
+// per read.
+bool HTTPParser::nextLine(const char*& line, size_t& length) {
+    if (_input->size() <= _cursor) {
+        return false;
+    }
+    size_t available = _input->frontSize();
+    if (_cursor + _scanned > available) {
+        _scanned = 0;   // the input was cleared behind our back
+    }
+    const char* begin = _input->front() + _cursor;
+    const char* end = _input->front() + available;
+    const char* stop = Scanner::findControl(begin + _scanned, end);
+    // Nothing found, or a CR whose LF is not there: the line may go on in
+    // the next segment
+    if (end - stop < 2 && available < _input->size()) {
+        _scanned = stop - begin;
+        available = _input->makeContiguous(_input->size());
+        begin = _input->front() + _cursor;
+        end = _input->front() + available;
+        stop = Scanner::findControl(begin + _scanned, end);
+    }
+    if (stop == end || (*stop == '\r' && stop + 1 == end)) {
+        _scanned = stop - begin;
+        if (available >= BufferSegment::SIZE) {
+            // The head does not fit in a segment: what is parsed of it moves
+            // into the request to make room for the line
+            if (_cursor > 0) {
+                detachHead();
+                return nextLine(line, length);
+            }
+            Logger::debug("Line longer than " + Utils::intToString(BufferSegment::SIZE) + " bytes");
+            setState(PARSING_ERROR);
+        }
+        return false;
     }
     
-    std::string line = _buffer.substr(0, line_end);
-    _buffer = _buffer.substr(line_end + 2);
-    return line;
+    if (*stop != '\r' || stop[1] != '\n') {
+        Logger::debug(*stop == '\n' || *stop == '\r' ? "Line not terminated by CRLF" : "Control character in line");
+        setState(PARSING_ERROR);
+        return false;
+    }
+    line = begin;
+    length = stop - begin;
+    return true;
+}
+
+// Offset of a head line in the request's head: in the input while the head
+// is held there, else after the part already copied into the request
+bool HTTPParser::headOffset(const char* line, size_t length, size_t& offset) {
+    if (_detached) {
+        offset = _request->appendHead(line, length);
+    } else {
+        _request->setHead(_input->front());
+        offset = _cursor;
+    }
+    if (offset + length > HTTPRequest::MAX_HEAD_SIZE) {
+        Logger::debug("Request head longer than " + Utils::intToString(HTTPRequest::MAX_HEAD_SIZE) + " bytes");
+        return false;
+    }
+    return true;
+}
+
+void HTTPParser::advanceHead(size_t length) {
+    if (_detached) {
+        consume(length);
+        return;
+    }
+    _cursor += length;
+    _scanned = 0;
+}
+
+void HTTPParser::detachHead() {
+    _request->setHead(_input->front());
+    _request->detachHead(_cursor);
+    _detached = true;
+    size_t head = _cursor;
+    _cursor = 0;
+    consume(head);
 }
 
-bool HTTPParser::hasCompleteLine() const {
-    return _buffer.find("\r\n") != std::string::npos;
+// A request without a body keeps its head in the input until next(); a body
+// is read from the input after the head, which must be consumed first
+void HTTPParser::finishHead() {
+    if (_detached) {
+        return;
+    }
+    if (_request->getContentLength() == 0 && !_request->isChunked()) {
+        _request->setHead(_input->front());
+        return;
+    }
+    detachHead();
+}
+
+void HTTPParser::consume(size_t length) {
+    _input->consume(length);
+    _bytes_parsed += length;
+    _scanned = 0;
 }
 
 ParserState HTTPParser::getState() const {
@@ -225,6 +469,15 @@ void HTTPParser::setState(ParserState state) {
     _state = state;
 }
 
+void HTTPParser::setError(int status) {
+    _error_status = status;
+    _state = PARSING_ERROR;
+}
+
+int HTTPParser::getErrorStatus() const {
+    return _error_status;
+}
+
 bool HTTPParser::isComplete() const {
     return _state == PARSING_COMPLETE;
 }
@@ -245,103 +498,109 @@ bool HTTPParser::isValidVersion(const std::string& version) {
     return version == "HTTP/1.0" || version == "HTTP/1.1";
 }
 
-bool HTTPParser::isValidURI(const std::string& uri) {
-    if (uri.empty() || uri[0] != '/') {
-        return false;
-    }
-    
-    // Basic URI validation
-    for (size_t i = 0; i < uri.length(); ++i) {
-        char c = uri[i];
-        if (c < 32 || c > 126) 
-        {
-            return false;
-        }
-    }
-    
-    return true;
+bool HTTPParser::isValidURI(const char* uri, size_t length) {
+    return length > 0 && uri[0] == '/' && Scanner::skipVisible(uri, uri + length) == uri + length;
 }
 
-bool HTTPParser::isValidHeaderName(const std::string& name) {
-    if (name.empty()) {
-        return false;
-    }
-    
-    for (size_t i = 0; i < name.length(); ++i) {
-        char c = name[i];
-        if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || 
-              (c >= '0' && c <= '9') || c == '-' || c == '_')) 
-        {
-            return false;
-        }
-    }
-    
-    return true;
+bool HTTPParser::isValidHeaderName(const char* name, size_t length) {
+    return length > 0 && Scanner::skipToken(name, name + length) == name + length;
 }
 
 
+// Chunk data is appended as it arrives, a chunk does not have to be
+// buffered whole. Trailer fields are read and ignored.
 bool HTTPParser::parseChunkedBody() {
-    std::string& body = _request->getBodyRef();
+    const char* line;
+    size_t length;
     
     while (true) {
-        // Cherche fin de la ligne de taille du chunk
-        size_t crlf_pos = _buffer.find("\r\n");
-        if (crlf_pos == std::string::npos) {
-            return false; // Besoin de plus de donnee
-        }
-        
-        // Parse taille du chunk en hexa
-        std::string size_line = _buffer.substr(0, crlf_pos);
-        
-        // Ignorer les extensions chunk (après ;)
-        size_t semicolon = size_line.find(';');
-        if (semicolon != std::string::npos) {
-            size_line = size_line.substr(0, semicolon);
-        }
-        
-        // Trim whitespace
-        size_line = Utils::trim(size_line);
-        
-        // Convert hexa -> decimal
-        size_t chunk_size;
-        char* endptr;
-        chunk_size = strtoul(size_line.c_str(), &endptr, 16);
-
-        if (*endptr != '\0') {
-            Logger::error("Invalid chunk size: '" + size_line + "'");
-            return false;
-        }
-        
-        Logger::debug("Chunk size: " + Utils::intToString(chunk_size) + " (0x" + size_line + ")");
-        
-        // Chunk taille 0 = fin
-        if (chunk_size == 0) {
-         
-            size_t trailer_end = _buffer.find("\r\n\r\n", crlf_pos);
-            if (trailer_end == std::string::npos) {
-                return false; // Besoin de la ligne vide finale
-            }
-            _buffer = _buffer.substr(trailer_end + 4);
-            _request->setChunkedComplete(true);
-            Logger::info("Chunked body complete: " + Utils::intToString(body.length()) + " bytes");
-            return true;
+        switch (_chunk_state) {
+            case CHUNK_SIZE:
+                if (!nextLine(line, length)) {
+                    return false; // Besoin de plus de donnee
+                }
+                if (!parseChunkSize(line, length, _chunk_remaining)) {
+                    Logger::error("Invalid chunk size: '" + std::string(line, length) + "'");
+                    setState(PARSING_ERROR);
+                    return false;
+                }
+                consume(length + 2);
+                if (Logger::isEnabled(DEBUG)) {
+                    Logger::debug("Chunk size: " + Utils::intToString(_chunk_remaining));
+                }
+                // Chunk taille 0 = fin
+                _chunk_state = _chunk_remaining > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+                break;
+                
+            case CHUNK_DATA:
+                while (_chunk_remaining > 0 && !_input->empty()) {
+                    size_t taken = _input->frontSize() < _chunk_remaining ? _input->frontSize() : _chunk_remaining;
+                    if (!appendBody(_input->front(), taken)) {
+                        return false;
+                    }
+                    consume(taken);
+                    _chunk_remaining -= taken;
+                }
+                if (_chunk_remaining > 0) {
+                    return false; // Besoin de plus de donnee
+                }
+                if (Logger::isEnabled(DEBUG)) {
+                    Logger::debug("Accumulated body: " + Utils::intToString(_request->getBodyLength()) + " bytes");
+                }
+                _chunk_state = CHUNK_DATA_END;
+                break;
+                
+            case CHUNK_DATA_END:
+                if (!nextLine(line, length)) {
+                    return false;
+                }
+                if (length != 0) {
+                    Logger::error("Chunk data longer than its size");
+                    setState(PARSING_ERROR);
+                    return false;
+                }
+                consume(2);
+                _chunk_state = CHUNK_SIZE;
+                break;
+                
+            case CHUNK_TRAILER:
+                if (!nextLine(line, length)) {
+                    return false; // Besoin de la ligne vide finale
+                }
+                consume(length + 2);
+                if (length == 0) {
+                    if (!_request->flushBody()) {
+                        setState(PARSING_ERROR);
+                        return false;
+                    }
+                    _request->setChunkedComplete(true);
+                    Logger::info("Chunked body complete: " + Utils::intToString(_request->getBodyLength()) + " bytes");
+                    return true;
+                }
+                break;
         }
-        
-        // verif assez de donnee pour ce chunck
-        size_t needed = crlf_pos + 2 + chunk_size + 2;
-        if (_buffer.length() < needed) {
-            Logger::debug("Not enough data for chunk. Need: " + Utils::intToString(needed) + 
-                         ", have: " + Utils::intToString(_buffer.length()));
-            return false; // Besoin de plus de donnee
+    }
+}
+
+// Hex size, optional whitespace, then nothing or ";extensions" (ignored)
+bool HTTPParser::parseChunkSize(const char* line, size_t length, size_t& size) {
+    size_t i = 0;
+    size_t digits = 0;
+    
+    size = 0;
+    while (i < length && isBlank(line[i])) ++i;
+    for (; i < length; ++i, ++digits) {
+        char c = line[i];
+        int value;
+        if (c >= '0' && c <= '9') value = c - '0';
+        else if (c >= 'a' && c <= 'f') value = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') value = c - 'A' + 10;
+        else break;
+        if (size > (static_cast<size_t>(-1) >> 4)) {
+            return false; // overflow
         }
-        
-        // Extraire les donnee du chunk
-        std::string chunk_data = _buffer.substr(crlf_pos + 2, chunk_size);
-        body += chunk_data;
-        
-        // Consommer ce chunk du buffer
-        _buffer = _buffer.substr(needed);
-        
-        Logger::debug("Accumulated body: " + Utils::intToString(body.length()) + " bytes");
+        size = size * 16 + value;
     }
+    while (i < length && isBlank(line[i])) ++i;
+    return digits > 0 && (i == length || line[i] == ';');
 }
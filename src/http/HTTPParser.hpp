@@ -2,8 +2,11 @@
 #define HTTPPARSER_HPP
 
 #include "HTTPRequest.hpp"
+#include "ChainBuffer.hpp"
 #include <string>
 
+class Config;
+
 enum ParserState {
     PARSING_REQUEST_LINE,
     PARSING_HEADERS,
@@ -12,47 +15,99 @@ enum ParserState {
     PARSING_ERROR
 };
 
+enum ChunkState {
+    CHUNK_SIZE,         // "<hex size>[;ext]" line
+    CHUNK_DATA,
+    CHUNK_DATA_END,     // CRLF after the data
+    CHUNK_TRAILER       // trailer fields up to the empty line
+};
+
+// Parses requests in place from the connection's read buffer: lines are
+// read where the socket put them, body bytes are copied once, straight into
+// the request. An incomplete line is not searched again from its start when
+// more bytes arrive.
+// The head (request line and headers) stays at the front of the input,
+// where the request's slices point, until next(): a request without a body
+// is parsed without copying or allocating. Before a body is read, or when
+// the head does not fit in one buffer segment, it is copied into the
+// request and consumed.
+// A body larger than the server's client_body_buffer_size is written to a
+// temp file as it arrives (see HTTPRequest::spillBody) instead of growing
+// in memory.
 class HTTPParser {
 private:
     ParserState _state;
-    std::string _buffer;
+    ChainBuffer* _input;        // not owned
     HTTPRequest* _request;
     size_t _bytes_parsed;
     size_t _body_bytes_received;
+    ChunkState _chunk_state;
+    size_t _chunk_remaining;
+    size_t _cursor;             // head bytes parsed, still held at the front of the input
+    size_t _scanned;            // bytes of the current line already searched for LF
+    bool _detached;             // the head was copied into the request
+    const Config* _config;      // snapshot the body buffer size is read from (not owned)
+    size_t _body_buffer_size;   // of the current request, set once its headers are parsed
+    size_t _max_body_size;      // client_max_body_size, idem
+    int _error_status;          // response status once in PARSING_ERROR
+
+    // The body is reserved from Content-Length up to this size: growing it by
+    // doubling would copy it again and fault in fresh pages at every step.
+    // Reserving only takes address space until the bytes actually arrive.
+    static const size_t MAX_BODY_RESERVE = 64 * 1024 * 1024;
 
 public:
     HTTPParser();
     ~HTTPParser();
+
+    // Buffer the socket reads into, set once for the parser's lifetime
+    void setInput(ChainBuffer* input);
+    // Snapshot the request is answered with, NULL for the defaults
+    void setConfig(const Config* config);
     
-    // Main parsing function
-    bool parse(HTTPRequest& request, const std::string& data);
-    bool parse(HTTPRequest& request, const char* data, size_t length);
+    // Main parsing function: parses what the input holds, false on error or
+    // when the input is empty
+    bool parse(HTTPRequest& request);
     
     // State management
     ParserState getState() const;
     void reset();
+    // Start the next request on the same connection, keeping the bytes
+    // already received past the end of the previous one (pipelining)
+    void next();
+    bool hasBufferedData() const;
     
     // Utils
     bool isComplete() const;
     bool hasError() const;
+    // 400, or 413 for a body over client_max_body_size
+    int getErrorStatus() const;
     size_t getBytesParsed() const;
 
 private:
-    bool parseRequestLine(const std::string& line);
-    bool parseHeader(const std::string& line);
+    bool parseRequestLine(const char* line, size_t length, size_t offset);
+    bool parseHeader(const char* line, size_t length, size_t offset);
     bool parseBody();
     bool parseChunkedBody();
+    bool parseChunkSize(const char* line, size_t length, size_t& size);
+    bool appendBody(const char* data, size_t length);
+    void setBodyLimits();
+    void setError(int status);
     
-    HTTPMethod stringToMethod(const std::string& method);
-    HTTPVersion stringToVersion(const std::string& version);
-    std::string getNextLine();
-    bool hasCompleteLine() const;
+    HTTPMethod stringToMethod(const char* method, size_t length);
+    HTTPVersion stringToVersion(const char* version, size_t length);
+    bool nextLine(const char*& line, size_t& length);
+    bool headOffset(const char* line, size_t length, size_t& offset);
+    void advanceHead(size_t length);
+    void detachHead();
+    void finishHead();
+    void consume(size_t length);
     void setState(ParserState state);
     
     bool isValidMethod(const std::string& method);
     bool isValidVersion(const std::string& version);
-    bool isValidURI(const std::string& uri);
-    bool isValidHeaderName(const std::string& name);
+    bool isValidURI(const char* uri, size_t length);
+    bool isValidHeaderName(const char* name, size_t length);
 };
 
 #endif
\ No newline at end of file
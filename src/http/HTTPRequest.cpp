@@ -1,23 +1,84 @@
 #include "HTTPRequest.hpp"
+#include "Logger.hpp"
 #include "Utils.hpp"
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <cstring>
+#include <strings.h>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Where spilled bodies are created
+static const char* const BODY_TEMP_DIR = "/tmp";
+
+// Canonical (lowercase) names, by HeaderId
+static const char* const KNOWN_HEADER_NAMES[HEADER_COUNT] = {
+    "host", "connection", "content-length", "content-type", "transfer-encoding",
+    "cookie", "user-agent", "accept", "accept-encoding", "accept-language",
+    "referer", "expect", "authorization", "if-modified-since", "range",
+    "origin", "cache-control", "upgrade"
+};
+
+// Perfect hash of the names above, computed offline: no two of them share a
+// slot of (first + last * 8 + length * 7) & 31, letters folded to lowercase.
+// A name landing on a slot still has to match it.
+static const HeaderId KNOWN_HEADER_SLOTS[32] = {
+    HEADER_UNKNOWN, HEADER_UNKNOWN, HEADER_ACCEPT_ENCODING, HEADER_TRANSFER_ENCODING,
+    HEADER_HOST, HEADER_CONTENT_LENGTH, HEADER_UNKNOWN, HEADER_UNKNOWN,
+    HEADER_IF_MODIFIED_SINCE, HEADER_ORIGIN, HEADER_UNKNOWN, HEADER_ACCEPT,
+    HEADER_AUTHORIZATION, HEADER_UNKNOWN, HEADER_UPGRADE, HEADER_EXPECT,
+    HEADER_UNKNOWN, HEADER_UNKNOWN, HEADER_ACCEPT_LANGUAGE, HEADER_REFERER,
+    HEADER_UNKNOWN, HEADER_COOKIE, HEADER_UNKNOWN, HEADER_UNKNOWN,
+    HEADER_UNKNOWN, HEADER_CONNECTION, HEADER_UNKNOWN, HEADER_USER_AGENT,
+    HEADER_UNKNOWN, HEADER_RANGE, HEADER_CACHE_CONTROL, HEADER_CONTENT_TYPE
+};
+
+HeaderId HTTPRequest::headerId(const char* name, size_t length) {
+    if (length == 0) {
+        return HEADER_UNKNOWN;
+    }
+    unsigned int first = static_cast<unsigned char>(name[0]) | 0x20;
+    unsigned int last = static_cast<unsigned char>(name[length - 1]) | 0x20;
+    HeaderId id = KNOWN_HEADER_SLOTS[(first + last * 8 + length * 7) & 31];
+    if (id != HEADER_UNKNOWN && strlen(KNOWN_HEADER_NAMES[id]) == length
+        && strncasecmp(name, KNOWN_HEADER_NAMES[id], length) == 0) {
+        return id;
+    }
+    return HEADER_UNKNOWN;
+}
 
-HTTPRequest::HTTPRequest() {
+HTTPRequest::HTTPRequest() : _body_fd(-1), _headers_ready(false) {
     clear();
 }
 
 HTTPRequest::~HTTPRequest() {
+    closeBodyFile();
 }
 
+// Strings keep their capacity: a connection answering many requests stops
+// allocating after the first ones
 void HTTPRequest::clear() {
     _method = METHOD_UNKNOWN;
-    _uri = "";
-    _query_string = "";
     _version = HTTP_UNKNOWN;
+    _head = NULL;
+    _head_storage.clear();
+    _path.offset = _path.length = 0;
+    _query.offset = _query.length = 0;
+    _known_present = 0;
+    _header_count = 0;
+    _more_headers.clear();
+    _port = DEFAULT_PORT;
+    _uri.clear();
+    _query_string.clear();
     _headers.clear();
+    _uri_ready = false;
+    _query_ready = false;
+    _headers_ready = false;
     _body = "";
+    closeBodyFile();
     _is_complete = false;
     _is_valid = false;
     _content_length = 0;
@@ -25,15 +86,44 @@ void HTTPRequest::clear() {
     _chunked_complete = false;
 }
 
+// The object outlives its connection (see ClientTable): small buffers keep
+// their capacity for the next one, a large head or body does not stay behind
+void HTTPRequest::release() {
+    clear();
+    if (_head_storage.capacity() > RETAINED_CAPACITY) {
+        std::string().swap(_head_storage);
+    }
+    if (_body.capacity() > RETAINED_CAPACITY) {
+        std::string().swap(_body);
+    }
+    if (_uri.capacity() > RETAINED_CAPACITY) {
+        std::string().swap(_uri);
+    }
+    if (_query_string.capacity() > RETAINED_CAPACITY) {
+        std::string().swap(_query_string);
+    }
+    if (_more_headers.capacity() * sizeof(HeaderSlice) > RETAINED_CAPACITY) {
+        std::vector<HeaderSlice>().swap(_more_headers);
+    }
+}
+
 HTTPMethod HTTPRequest::getMethod() const {
     return _method;
 }
 
 const std::string& HTTPRequest::getURI() const {
+    if (!_uri_ready) {
+        _uri = sliceToString(_path);
+        _uri_ready = true;
+    }
     return _uri;
 }
 
 const std::string& HTTPRequest::getQueryString() const {
+    if (!_query_ready) {
+        _query_string = sliceToString(_query);
+        _query_ready = true;
+    }
     return _query_string;
 }
 
@@ -45,7 +135,21 @@ const std::string& HTTPRequest::getBody() const {
     return _body;
 }
 
+// Names lowercased, the last of repeated headers wins
 const std::map<std::string, std::string>& HTTPRequest::getHeaders() const {
+    if (!_headers_ready) {
+        _headers.clear();
+        for (int id = 0; id < HEADER_COUNT; ++id) {
+            if (_known_present & (1u << id)) {
+                _headers[KNOWN_HEADER_NAMES[id]] = sliceToString(_known[id]);
+            }
+        }
+        for (size_t i = 0; i < _header_count; ++i) {
+            const HeaderSlice& header = headerAt(i);
+            _headers[toLowerCase(sliceToString(header.name))] = sliceToString(header.value);
+        }
+        _headers_ready = true;
+    }
     return _headers;
 }
 
@@ -54,17 +158,58 @@ size_t HTTPRequest::getContentLength() const {
 }
 
 std::string HTTPRequest::getHeader(const std::string& name) const {
-    std::string lower_name = toLowerCase(name);
-    std::map<std::string, std::string>::const_iterator it = _headers.find(lower_name);
-    if (it != _headers.end()) {
-        return it->second;
+    const char* value;
+    size_t length;
+    if (findHeader(name.c_str(), value, length)) {
+        return std::string(value, length);
     }
     return "";
 }
 
 bool HTTPRequest::hasHeader(const std::string& name) const {
-    std::string lower_name = toLowerCase(name);
-    return _headers.find(lower_name) != _headers.end();
+    const char* value;
+    size_t length;
+    return findHeader(name.c_str(), value, length);
+}
+
+bool HTTPRequest::findHeader(const char* name, const char*& value, size_t& length) const {
+    size_t name_length = strlen(name);
+    HeaderId id = headerId(name, name_length);
+    if (id != HEADER_UNKNOWN) {
+        return findHeader(id, value, length);
+    }
+    for (size_t i = _header_count; i > 0; --i) {
+        const HeaderSlice& header = headerAt(i - 1);
+        if (header.name.length == name_length
+            && strncasecmp(_head + header.name.offset, name, name_length) == 0) {
+            value = _head + header.value.offset;
+            length = header.value.length;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string HTTPRequest::getHeader(HeaderId id) const {
+    const char* value;
+    size_t length;
+    if (findHeader(id, value, length)) {
+        return std::string(value, length);
+    }
+    return "";
+}
+
+bool HTTPRequest::hasHeader(HeaderId id) const {
+    return id < HEADER_COUNT && (_known_present & (1u << id));
+}
+
+bool HTTPRequest::findHeader(HeaderId id, const char*& value, size_t& length) const {
+    if (!hasHeader(id)) {
+        return false;
+    }
+    value = _head + _known[id].offset;
+    length = _known[id].length;
+    return true;
 }
 
 bool HTTPRequest::isComplete() const {
@@ -75,24 +220,129 @@ bool HTTPRequest::isValid() const {
     return _is_valid;
 }
 
+// Parsed from Host when the header was added
 int HTTPRequest::getPort() const {
-    std::string host = getHeader("host");
+    return _port;
+}
+
+static bool isTokenBlank(char c) {
+    return c == ' ' || c == '\t';
+}
 
-    size_t colon_pos = host.find(':');
-    if (colon_pos != std::string::npos) {
-        return Utils::stringToInt(host.substr(colon_pos + 1));
+// HTTP/1.1 connections are persistent unless the client sends "close",
+// HTTP/1.0 ones only when it asks for "keep-alive". The token list is read
+// in place.
+bool HTTPRequest::isKeepAlive() const {
+    bool close = false;
+    bool keep_alive = false;
+    const char* value;
+    size_t length;
+    if (findHeader(HEADER_CONNECTION, value, length)) {
+        const char* end = value + length;
+        while (value < end) {
+            const char* comma = static_cast<const char*>(memchr(value, ',', end - value));
+            const char* token_end = comma ? comma : end;
+            const char* token = value;
+            while (token < token_end && isTokenBlank(*token)) ++token;
+            while (token_end > token && isTokenBlank(token_end[-1])) --token_end;
+            size_t token_length = token_end - token;
+            if (token_length == 5 && strncasecmp(token, "close", 5) == 0) {
+                close = true;
+            } else if (token_length == 10 && strncasecmp(token, "keep-alive", 10) == 0) {
+                keep_alive = true;
+            }
+            value = comma ? comma + 1 : end;
+        }
+    }
+    if (close) {
+        return false;
     }
-    return 8080;
+    return _version == HTTP_1_1 || keep_alive;
 }
 
 bool HTTPRequest::isChunked() const {
     return _is_chunked;
 }
 
+void HTTPRequest::setHead(const char* head) {
+    _head = head;
+}
+
+void HTTPRequest::detachHead(size_t length) {
+    _head_storage.assign(_head, length);
+    _head = _head_storage.data();
+}
+
+size_t HTTPRequest::appendHead(const char* data, size_t length) {
+    size_t offset = _head_storage.size();
+    _head_storage.append(data, length);
+    _head = _head_storage.data();
+    return offset;
+}
+
+// Request target: the path, then the query string after '?'
+void HTTPRequest::setTarget(size_t offset, size_t length) {
+    const char* target = _head + offset;
+    const char* question = static_cast<const char*>(memchr(target, '?', length));
+    size_t path_length = question ? question - target : length;
+
+    _path.offset = offset;
+    _path.length = path_length;
+    if (question) {
+        _query.offset = offset + path_length + 1;
+        _query.length = length - path_length - 1;
+    } else {
+        _query.offset = _query.length = 0;
+    }
+    _uri_ready = false;
+    _query_ready = false;
+}
+
+// A repeated well-known header replaces the previous value
+void HTTPRequest::addHeader(size_t name_offset, size_t name_length, size_t value_offset, size_t value_length) {
+    _headers_ready = false;
+    HeaderId id = headerId(_head + name_offset, name_length);
+    if (id == HEADER_UNKNOWN) {
+        HeaderSlice header;
+        header.name.offset = name_offset;
+        header.name.length = name_length;
+        header.value.offset = value_offset;
+        header.value.length = value_length;
+        if (_header_count < INLINE_HEADERS) {
+            _header_slices[_header_count] = header;
+        } else {
+            _more_headers.push_back(header);
+        }
+        ++_header_count;
+        return;
+    }
+
+    _known[id].offset = value_offset;
+    _known[id].length = value_length;
+    _known_present |= 1u << id;
+
+    // Update content length, chunked status and port when relevant headers are added
+    const char* value = _head + value_offset;
+    switch (id) {
+        case HEADER_CONTENT_LENGTH:
+            parseContentLength(value, value_length);
+            break;
+        case HEADER_TRANSFER_ENCODING:
+            checkIfChunked(value, value_length);
+            break;
+        case HEADER_HOST:
+            parsePort(value, value_length);
+            break;
+        default:
+            break;
+    }
+}
+
 void HTTPRequest::setMethod(HTTPMethod method) {
     _method = method;
 }
 
+// Owned strings, for a request not built by the parser
 void HTTPRequest::setURI(const std::string& uri) {
     // Parse URI and query string
     size_t query_pos = uri.find('?');
@@ -103,10 +353,13 @@ void HTTPRequest::setURI(const std::string& uri) {
         _uri = uri;
         _query_string = "";
     }
+    _uri_ready = true;
+    _query_ready = true;
 }
 
 void HTTPRequest::setQueryString(const std::string& query) {
     _query_string = query;
+    _query_ready = true;
 }
 
 void HTTPRequest::setVersion(HTTPVersion version) {
@@ -117,18 +370,6 @@ void HTTPRequest::setBody(const std::string& body) {
     _body = body;
 }
 
-void HTTPRequest::addHeader(const std::string& name, const std::string& value) {
-    std::string lower_name = toLowerCase(name);
-    _headers[lower_name] = Utils::trim(value);
-    
-    // Update content length and chunked status when relevant headers are added
-    if (lower_name == "content-length") {
-        parseContentLength();
-    } else if (lower_name == "transfer-encoding") {
-        checkIfChunked();
-    }
-}
-
 void HTTPRequest::setComplete(bool complete) {
     _is_complete = complete;
 }
@@ -154,20 +395,61 @@ std::string HTTPRequest::versionToString() const {
     }
 }
 
-void HTTPRequest::parseContentLength() {
-    std::string length_str = getHeader("content-length");
-    if (!length_str.empty()) {
-        std::stringstream ss(length_str);
-        ss >> _content_length;
-        if (ss.fail()) {
+const HeaderSlice& HTTPRequest::headerAt(size_t index) const {
+    return index < INLINE_HEADERS ? _header_slices[index] : _more_headers[index - INLINE_HEADERS];
+}
+
+std::string HTTPRequest::sliceToString(const HeadSlice& slice) const {
+    if (slice.length == 0) {
+        return std::string();
+    }
+    return std::string(_head + slice.offset, slice.length);
+}
+
+// Leading digits, as a stream extraction would read them; 0 when there are
+// none or the value overflows
+void HTTPRequest::parseContentLength(const char* value, size_t length) {
+    size_t content_length = 0;
+    size_t i = 0;
+    for (; i < length && value[i] >= '0' && value[i] <= '9'; ++i) {
+        size_t digit = value[i] - '0';
+        if (content_length > (static_cast<size_t>(-1) - digit) / 10) {
             _content_length = 0;
+            return;
         }
+        content_length = content_length * 10 + digit;
     }
+    _content_length = i > 0 ? content_length : 0;
 }
 
-void HTTPRequest::checkIfChunked() {
-    std::string transfer_encoding = getHeader("transfer-encoding");
-    _is_chunked = (toLowerCase(transfer_encoding) == "chunked");
+void HTTPRequest::checkIfChunked(const char* value, size_t length) {
+    _is_chunked = length == 7 && strncasecmp(value, "chunked", 7) == 0;
+}
+
+// "name[:port]", the name possibly a bracketed IPv6 address; DEFAULT_PORT
+// without a port, 0 when it is not a number
+void HTTPRequest::parsePort(const char* value, size_t length) {
+    const char* end = value + length;
+    const char* colon = NULL;
+    for (const char* p = end; p > value; --p) {
+        if (p[-1] == ':') {
+            colon = p - 1;
+            break;
+        }
+        if (p[-1] == ']') {
+            break;
+        }
+    }
+    if (!colon) {
+        _port = DEFAULT_PORT;
+        return;
+    }
+    int port = 0;
+    const char* p = colon + 1;
+    for (; p < end && *p >= '0' && *p <= '9' && port <= 65535; ++p) {
+        port = port * 10 + (*p - '0');
+    }
+    _port = p == end && p > colon + 1 && port <= 65535 ? port : 0;
 }
 
 std::string HTTPRequest::toLowerCase(const std::string& str) const {
@@ -180,6 +462,98 @@ std::string& HTTPRequest::getBodyRef() {
     return _body;
 }
 
+size_t HTTPRequest::getBodyLength() const {
+    return _body_file_size + _body.size();
+}
+
+bool HTTPRequest::hasBodyFile() const {
+    return _body_fd != -1;
+}
+
+int HTTPRequest::getBodyFd() const {
+    return _body_fd;
+}
+
+bool HTTPRequest::appendBody(const char* data, size_t length) {
+    if (_body_fd == -1 || _body.size() + length < BODY_WRITE_SIZE) {
+        _body.append(data, length);
+        return true;
+    }
+    if (!flushBody()) {
+        return false;
+    }
+    if (length >= BODY_WRITE_SIZE) {
+        return writeBody(data, length);
+    }
+    _body.append(data, length);
+    return true;
+}
+
+bool HTTPRequest::flushBody() {
+    if (_body_fd == -1 || _body.empty()) {
+        return true;
+    }
+    bool written = writeBody(_body.data(), _body.size());
+    _body.clear();
+    return written;
+}
+
+bool HTTPRequest::writeBody(const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(_body_fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Logger::error("Failed to write request body to temp file: " + std::string(strerror(errno)));
+            return false;
+        }
+        data += written;
+        length -= written;
+        _body_file_size += written;
+    }
+    return true;
+}
+
+// O_TMPFILE: the file has no name, it goes away with the descriptor. Where
+// the filesystem does not support it, a named file is unlinked right away.
+bool HTTPRequest::spillBody() {
+    if (_body_fd != -1) {
+        return true;
+    }
+    int fd = -1;
+#ifdef O_TMPFILE
+    fd = open(BODY_TEMP_DIR, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+    if (fd == -1) {
+        std::string path = std::string(BODY_TEMP_DIR) + "/webserv_body_XXXXXX";
+        fd = mkstemp(&path[0]);
+        if (fd != -1) {
+            unlink(path.c_str());
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+    if (fd == -1) {
+        Logger::error("Failed to create temp file for request body: " + std::string(strerror(errno)));
+        return false;
+    }
+    _body_fd = fd;
+    _body_file_size = 0;
+    if (!flushBody()) {
+        return false;
+    }
+    _body.reserve(BODY_WRITE_SIZE);
+    return true;
+}
+
+void HTTPRequest::closeBodyFile() {
+    if (_body_fd != -1) {
+        close(_body_fd);
+        _body_fd = -1;
+    }
+    _body_file_size = 0;
+}
+
 bool HTTPRequest::isChunkedComplete() const {
     return _chunked_complete;
 }
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 enum HTTPMethod {
     METHOD_GET,
@@ -18,24 +19,95 @@ enum HTTPVersion {
     HTTP_UNKNOWN
 };
 
+// Headers recognized while parsing, stored at a fixed index
+enum HeaderId {
+    HEADER_HOST,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_COOKIE,
+    HEADER_USER_AGENT,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_ACCEPT_LANGUAGE,
+    HEADER_REFERER,
+    HEADER_EXPECT,
+    HEADER_AUTHORIZATION,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_RANGE,
+    HEADER_ORIGIN,
+    HEADER_CACHE_CONTROL,
+    HEADER_UPGRADE,
+    HEADER_COUNT,
+    HEADER_UNKNOWN = HEADER_COUNT
+};
+
+// Bytes [offset, offset + length) of the request head
+struct HeadSlice {
+    unsigned short offset;
+    unsigned short length;
+};
+
+struct HeaderSlice {
+    HeadSlice name;
+    HeadSlice value;
+};
+
+// The request line and the headers are kept as slices of the head bytes,
+// where the parser found them: while the request has no body, in the
+// connection's read buffer itself. Strings are only built when a getter
+// asks for them, so parsing a typical GET allocates nothing.
+// Well-known headers are identified once, when parsed, and read back by id
+// in O(1); the others sit in a flat list searched by name.
+// A large body is not held in memory: once spilled, it is in an unlinked
+// temporary file, read through getBodyFd() and getBodyLength().
 class HTTPRequest {
+public:
+    // Slice offsets are 16-bit
+    static const size_t MAX_HEAD_SIZE = 65535;
+
 private:
+    static const size_t INLINE_HEADERS = 16;
+    static const int DEFAULT_PORT = 8080;
+    // Spilled bodies are written in blocks of this size, not chunk by chunk
+    static const size_t BODY_WRITE_SIZE = 64 * 1024;
+    // Storage kept by release() for the next connection, per string or list
+    static const size_t RETAINED_CAPACITY = 64 * 1024;
+
     HTTPMethod _method;
-    std::string _uri;
-    std::string _query_string;
     HTTPVersion _version;
-    std::map<std::string, std::string> _headers;
-    std::string _body;
+    const char* _head;              // bytes the slices point into (not owned while in the read buffer)
+    std::string _head_storage;      // the head once detached from the read buffer
+    HeadSlice _path;
+    HeadSlice _query;
+    HeadSlice _known[HEADER_COUNT];            // values of well-known headers, by id
+    unsigned int _known_present;               // one bit per HeaderId
+    HeaderSlice _header_slices[INLINE_HEADERS];    // other headers
+    std::vector<HeaderSlice> _more_headers;    // past INLINE_HEADERS
+    size_t _header_count;                      // other headers
+    int _port;                                 // from Host
+    std::string _body;              // the body, or once spilled the bytes not written to the file yet
+    int _body_fd;                   // temp file holding the body once spilled, -1 while in _body
+    size_t _body_file_size;         // bytes written to the file
     bool _is_complete;
     bool _is_valid;
     size_t _content_length;
     bool _is_chunked;
     bool _chunked_complete;
 
+    // Materialized on demand
+    mutable std::string _uri;
+    mutable std::string _query_string;
+    mutable std::map<std::string, std::string> _headers;
+    mutable bool _uri_ready;
+    mutable bool _query_ready;
+    mutable bool _headers_ready;
+
 public:
     HTTPRequest();
     ~HTTPRequest();
-    
+
     // Getters
     HTTPMethod getMethod() const;
     const std::string& getURI() const;
@@ -43,40 +115,77 @@ public:
     HTTPVersion getVersion() const;
     const std::string& getBody() const;
     std::string& getBodyRef();
+    // Bytes of body received, in memory or in the file
+    size_t getBodyLength() const;
+    bool hasBodyFile() const;
+    // The spilled body, -1 if it is in memory. Owned by the request.
+    int getBodyFd() const;
     const std::map<std::string, std::string>& getHeaders() const;
     size_t getContentLength() const;
     int getPort() const;
 
-    // Header operations
+    // Header operations (names are case-insensitive)
     std::string getHeader(const std::string& name) const;
     bool hasHeader(const std::string& name) const;
-    
+    // Points at the value of the last header called name, without copying it
+    bool findHeader(const char* name, const char*& value, size_t& length) const;
+    // Typed access to well-known headers
+    std::string getHeader(HeaderId id) const;
+    bool hasHeader(HeaderId id) const;
+    bool findHeader(HeaderId id, const char*& value, size_t& length) const;
+    // HEADER_UNKNOWN when the name is not a well-known header
+    static HeaderId headerId(const char* name, size_t length);
+
     // Status
     bool isComplete() const;
     bool isValid() const;
     bool isChunked() const;
     bool isChunkedComplete() const;
-    
-    // Setters (for parser)
+    bool isKeepAlive() const;
+
+    // Setters (for parser). Offsets are relative to the head set last.
+    void setHead(const char* head);
+    // Copies the first length bytes of the head into the request: the read
+    // buffer they came from can then be consumed
+    void detachHead(size_t length);
+    // Appends to a detached head, returns the offset of the bytes
+    size_t appendHead(const char* data, size_t length);
+    void setTarget(size_t offset, size_t length);
+    void addHeader(size_t name_offset, size_t name_length, size_t value_offset, size_t value_length);
     void setMethod(HTTPMethod method);
     void setURI(const std::string& uri);
     void setQueryString(const std::string& query);
     void setVersion(HTTPVersion version);
     void setBody(const std::string& body);
-    void addHeader(const std::string& name, const std::string& value);
+    // Appends to the body, in memory or to its file; false on a write error
+    bool appendBody(const char* data, size_t length);
+    // Moves the body to a temp file, appendBody() then writes there
+    bool spillBody();
+    // Writes what appendBody() still holds to the file, once the body is complete
+    bool flushBody();
     void setComplete(bool complete);
     void setValid(bool valid);
     void setChunkedComplete(bool complete);
-    
+
     // Utils
     std::string methodToString() const;
     std::string versionToString() const;
     void clear();
+    // clear(), then frees the storage that grew past RETAINED_CAPACITY
+    void release();
 
 private:
-    void parseContentLength();
-    void checkIfChunked();
+    const HeaderSlice& headerAt(size_t index) const;
+    std::string sliceToString(const HeadSlice& slice) const;
+    void parseContentLength(const char* value, size_t length);
+    void checkIfChunked(const char* value, size_t length);
+    void parsePort(const char* value, size_t length);
+    void closeBodyFile();
+    bool writeBody(const char* data, size_t length);
     std::string toLowerCase(const std::string& str) const;
+
+    HTTPRequest(const HTTPRequest&);
+    HTTPRequest& operator=(const HTTPRequest&);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -31,6 +31,11 @@ void HTTPResponse::setBody(const std::string& body) {
     setContentLength(_body.length());
 }
 
+void HTTPResponse::swapBody(std::string& body) {
+    _body.swap(body);
+    setContentLength(_body.length());
+}
+
 void HTTPResponse::addHeader(const std::string& name, const std::string& value) {
     std::string lower_name = Utils::toLowerCase(name);
     
@@ -64,6 +69,10 @@ const std::string& HTTPResponse::getBody() const {
     return _body;
 }
 
+std::string& HTTPResponse::getBodyRef() {
+    return _body;
+}
+
 std::string HTTPResponse::getHeader(const std::string& name) const {
     std::string lower_name = Utils::toLowerCase(name);
     std::map<std::string, std::string>::const_iterator it = _headers.find(lower_name);
@@ -74,21 +83,22 @@ std::string HTTPResponse::getHeader(const std::string& name) const {
 }
 
 std::string HTTPResponse::toString() const {
-    std::string response;
+    return headToString() + _body;
+}
+
+std::string HTTPResponse::headToString() const {
+    std::string head;
     
     // Status line
-    response += "HTTP/1.1 " + Utils::intToString(_status_code) + " " + _status_message + CRLF;
+    head += "HTTP/1.1 " + Utils::intToString(_status_code) + " " + _status_message + CRLF;
     
     // Headers
-    response += headerToString();
+    head += headerToString();
     
     // Empty line before body
-    response += CRLF;
-    
-    // Body
-    response += _body;
+    head += CRLF;
     
-    return response;
+    return head;
 }
 
 void HTTPResponse::setContentType(const std::string& contentType) {
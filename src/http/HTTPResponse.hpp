@@ -21,6 +21,8 @@ public:
     void setStatusCode(int code);
     void setStatusMessage(const std::string& message);
     void setBody(const std::string& body);
+    // Takes the contents of body (swapped, not copied)
+    void swapBody(std::string& body);
     void addHeader(const std::string& name, const std::string& value);
     void setHeader(const std::string& name, const std::string& value);
     
@@ -31,10 +33,13 @@ public:
     int getStatusCode() const;
     const std::string& getStatusMessage() const;
     const std::string& getBody() const;
+    std::string& getBodyRef();
     std::string getHeader(const std::string& name) const;
     
     // Response building
     std::string toString() const;
+    // Status line, headers and the empty line, without the body
+    std::string headToString() const;
     void setContentType(const std::string& contentType);
     void setContentLength(size_t length);
     void setConnection(const std::string& connection);
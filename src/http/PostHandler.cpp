@@ -3,10 +3,50 @@
 #include "Utils.hpp"
 #include <fstream>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sstream>
 #include <algorithm>
+#include <cstring>
+#include <cerrno>
 #include "String.hpp"
 
+// The request body as one block of memory: the body string, or the temp
+// file it was received into, mapped read-only. The file's pages are read in
+// as they are scanned and stay in the page cache, not on the heap.
+class BodyView {
+private:
+    void* _mapping;
+    const char* _data;
+    size_t _size;
+    bool _valid;
+
+    BodyView(const BodyView&);
+    BodyView& operator=(const BodyView&);
+
+public:
+    BodyView(const HTTPRequest& request)
+        : _mapping(MAP_FAILED), _data(request.getBody().data()), _size(request.getBodyLength()), _valid(true) {
+        if (request.hasBodyFile() && _size > 0) {
+            _mapping = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, request.getBodyFd(), 0);
+            _valid = _mapping != MAP_FAILED;
+            _data = _valid ? static_cast<const char*>(_mapping) : NULL;
+            if (!_valid) {
+                Logger::error("Failed to map request body file: " + std::string(strerror(errno)));
+            }
+        }
+    }
+
+    ~BodyView() {
+        if (_mapping != MAP_FAILED) {
+            munmap(_mapping, _size);
+        }
+    }
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool isValid() const { return _valid; }
+};
+
 
 HTTPResponse PostHandler::handlePost(const HTTPRequest& request, const ServerConfig& config) {
     // Find matching location
@@ -29,7 +69,7 @@ HTTPResponse PostHandler::handlePost(const HTTPRequest& request, const ServerCon
     }
     
     // Determine content type and handle accordingly
-    std::string contentType = request.getHeader("content-type");
+    std::string contentType = request.getHeader(HEADER_CONTENT_TYPE);
     
     if (contentType.find("multipart/form-data") != std::string::npos) {
         return handleFileUpload(request, *location, config);
@@ -50,7 +90,7 @@ HTTPResponse PostHandler::handleFileUpload(const HTTPRequest& request, const Loc
         return createUploadErrorResponse("Invalid upload request");
     }
     
-    std::string contentType = request.getHeader("content-type");
+    std::string contentType = request.getHeader(HEADER_CONTENT_TYPE);
     Logger::debug("Content-Type: " + contentType);
     std::string boundary = extractBoundary(contentType);
     
@@ -59,8 +99,12 @@ HTTPResponse PostHandler::handleFileUpload(const HTTPRequest& request, const Loc
         return createUploadErrorResponse("No boundary in multipart data");
     }
     
-    // Parse multipart form data
-    std::map<std::string, FormField> fields = parseMultipartFormData(request.getBody(), boundary);
+    // Parse multipart form data, fields point into the body
+    BodyView body(request);
+    if (!body.isValid()) {
+        return HTTPResponse(500);
+    }
+    std::map<std::string, FormField> fields = parseMultipartFormData(body.data(), body.size(), boundary);
     
     std::vector<std::string> uploadedFiles;
     
@@ -131,7 +175,11 @@ HTTPResponse PostHandler::handleFileUpload(const HTTPRequest& request, const Loc
 
 HTTPResponse PostHandler::handleFormData(const HTTPRequest& request, const LocationConfig& location) {
     (void)location;
-    std::map<std::string, std::string> formData = parseUrlEncodedData(request.getBody());
+    BodyView body(request);
+    if (!body.isValid()) {
+        return HTTPResponse(500);
+    }
+    std::map<std::string, std::string> formData = parseUrlEncodedData(std::string(body.data(), body.size()));
     
     // Create response showing received form data
     std::ostringstream html;
@@ -153,23 +201,26 @@ HTTPResponse PostHandler::handleFormData(const HTTPRequest& request, const Locat
     return response;
 }
 
-std::map<std::string, FormField> PostHandler::parseMultipartFormData(const std::string& body, const std::string& boundary) {
-    Logger::debug("Parsing multipart data, body length: " + Utils::intToString(body.length()));
+std::map<std::string, FormField> PostHandler::parseMultipartFormData(const char* body, size_t length, const std::string& boundary) {
+    Logger::debug("Parsing multipart data, body length: " + Utils::intToString(length));
     Logger::debug("Using boundary: " + boundary);
 
     //debugMultipartBody(body, boundary);
 
     std::map<std::string, FormField> fields;
-    std::vector<std::string> parts = splitByBoundary(body, boundary);
+    std::vector<BodyPart> parts = splitByBoundary(body, length, boundary);
     Logger::debug("Found " + Utils::intToString(parts.size()) + " parts");
         
     for (size_t i = 0; i < parts.size(); ++i) {
-        if (parts[i].empty()) continue;
+        if (parts[i].second == 0) continue;
         
-        Logger::debug("=== PROCESSING PART " + Utils::intToString(i) + " ===");
-        Logger::debug("Part " + Utils::intToString(i) + " preview: " + parts[i].substr(0, 300));
+        if (Logger::isEnabled(DEBUG)) {
+            Logger::debug("=== PROCESSING PART " + Utils::intToString(i) + " ===");
+            Logger::debug("Part " + Utils::intToString(i) + " preview: "
+                          + std::string(parts[i].first, std::min(parts[i].second, static_cast<size_t>(300))));
+        }
         
-        FormField field = parseFormField(parts[i]);
+        FormField field = parseFormField(parts[i].first, parts[i].second);
         if (!field.name.empty()) {
             Logger::debug("=== FIELD FOUND ===");
             Logger::debug("Name: '" + field.name + "'");
@@ -225,10 +276,14 @@ bool PostHandler::saveUploadedFile(const FormField& field, const std::string& up
         return false;
     }
     
-    file.write(field.value.c_str(), field.value.length());
+    file.write(field.data, field.size);
     file.close();
+    if (file.fail()) {
+        Logger::error("Failed to write file: " + fullPath);
+        return false;
+    }
     
-    Logger::debug("Saved uploaded file: " + fullPath + " (" + Utils::intToString(field.value.length()) + " bytes)");
+    Logger::debug("Saved uploaded file: " + fullPath + " (" + Utils::intToString(field.size) + " bytes)");
     return true;
 }
 
@@ -278,7 +333,7 @@ bool PostHandler::isAllowedFileType(const std::string& filename) {
 }
 
 size_t PostHandler::getFileSize(const FormField& field) {
-    return field.value.length();
+    return field.size;
 }
 
 std::string PostHandler::extractBoundary(const std::string& contentType) {
@@ -297,43 +352,41 @@ std::string PostHandler::extractBoundary(const std::string& contentType) {
     return boundary;
 }
 
-std::vector<std::string> PostHandler::splitByBoundary(const std::string& body, const std::string& boundary) {
-    std::vector<std::string> parts;
+std::vector<BodyPart> PostHandler::splitByBoundary(const char* body, size_t length, const std::string& boundary) {
+    std::vector<BodyPart> parts;
     std::string fullBoundary = "--" + boundary;
     
     Logger::debug("Splitting with boundary: " + fullBoundary);
     
     // Trouver toutes les positions des boundaries
     std::vector<size_t> boundaryPositions;
-    size_t pos = 0;
-    while ((pos = body.find(fullBoundary, pos)) != std::string::npos) {
-        boundaryPositions.push_back(pos);
-        pos += fullBoundary.length();
+    const char* end = body + length;
+    const char* found = body;
+    while ((found = static_cast<const char*>(memmem(found, end - found, fullBoundary.data(), fullBoundary.length())))) {
+        boundaryPositions.push_back(found - body);
+        found += fullBoundary.length();
     }
     
     Logger::debug("Found " + Utils::intToString(boundaryPositions.size()) + " boundaries");
     
     // Extraire les parties entre les boundaries
-    for (size_t i = 0; i < boundaryPositions.size() - 1; ++i) {
+    for (size_t i = 0; i + 1 < boundaryPositions.size(); ++i) {
         size_t start = boundaryPositions[i] + fullBoundary.length();
-        size_t end = boundaryPositions[i + 1];
+        size_t stop = boundaryPositions[i + 1];
         
         // Ignorer les CRLF après le boundary
-        while (start < end && (body[start] == '\r' || body[start] == '\n')) {
+        while (start < stop && (body[start] == '\r' || body[start] == '\n')) {
             start++;
         }
         
         // Ignorer les CRLF avant le prochain boundary
-        while (end > start && (body[end - 1] == '\r' || body[end - 1] == '\n')) {
-            end--;
+        while (stop > start && (body[stop - 1] == '\r' || body[stop - 1] == '\n')) {
+            stop--;
         }
         
-        if (start < end) {
-            std::string part = body.substr(start, end - start);
-            if (!part.empty()) {
-                Logger::debug("Part " + Utils::intToString(i) + " length: " + Utils::intToString(part.length()));
-                parts.push_back(part);
-            }
+        if (start < stop) {
+            Logger::debug("Part " + Utils::intToString(i) + " length: " + Utils::intToString(stop - start));
+            parts.push_back(BodyPart(body + start, stop - start));
         }
     }
     
@@ -341,21 +394,26 @@ std::vector<std::string> PostHandler::splitByBoundary(const std::string& body, c
 }
 
 
-FormField PostHandler::parseFormField(const std::string& fieldData) {
+// Only the part's headers are copied; the contents stay where they are in
+// the body, copied into value for plain (non-file) fields
+FormField PostHandler::parseFormField(const char* fieldData, size_t length) {
 
     Logger::debug("=== PARSING FIELD ===");
-    Logger::debug("Part content (first 200 chars): " + fieldData.substr(0, 200));
+    if (Logger::isEnabled(DEBUG)) {
+        Logger::debug("Part content (first 200 chars): " + std::string(fieldData, std::min(length, static_cast<size_t>(200))));
+    }
     
     FormField field;
     
     // Find the double CRLF that separates headers from data
-    size_t header_end = fieldData.find("\r\n\r\n");
-    if (header_end == std::string::npos) {
+    const char* separator = static_cast<const char*>(memmem(fieldData, length, "\r\n\r\n", 4));
+    if (!separator) {
         return field;
     }
     
-    std::string headers = fieldData.substr(0, header_end);
-    std::string data = fieldData.substr(header_end + 4);
+    std::string headers(fieldData, separator);
+    field.data = separator + 4;
+    field.size = fieldData + length - field.data;
     
     // Parse Content-Disposition header
     size_t disp_pos = headers.find("Content-Disposition:");
@@ -399,7 +457,9 @@ FormField PostHandler::parseFormField(const std::string& fieldData) {
         field.contentType = Utils::trim(type_line);
     }
     
-    field.value = data;
+    if (!field.isFile) {
+        field.value.assign(field.data, field.size);
+    }
 
     Logger::debug("Parsed field name: '" + field.name + "'");
     Logger::debug("====================");
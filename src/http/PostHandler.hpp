@@ -3,6 +3,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include "HTTPRequest.hpp"
 #include "HTTPResponse.hpp"
 #include "ServerConfig.hpp"
@@ -10,14 +11,19 @@
 struct FormField 
 {
     std::string name;
-    std::string value;
+    std::string value;          // copied for plain fields only
     std::string contentType;
     std::string filename;
+    const char* data;           // contents, in place in the request body
+    size_t size;
     bool isFile;
     
-    FormField() : isFile(false) {}
+    FormField() : data(NULL), size(0), isFile(false) {}
 };
 
+// A part of the body between two boundaries
+typedef std::pair<const char*, size_t> BodyPart;
+
 class PostHandler 
 {
 public:
@@ -28,7 +34,7 @@ public:
     
 private:
     // Form parsing
-    static std::map<std::string, FormField> parseMultipartFormData(const std::string& body, const std::string& boundary);
+    static std::map<std::string, FormField> parseMultipartFormData(const char* body, size_t length, const std::string& boundary);
     static std::map<std::string, std::string> parseUrlEncodedData(const std::string& body);
     
     // File operations
@@ -39,8 +45,8 @@ private:
     
     // Boundary parsing
     static std::string extractBoundary(const std::string& contentType);
-    static std::vector<std::string> splitByBoundary(const std::string& body, const std::string& boundary);
-    static FormField parseFormField(const std::string& fieldData);
+    static std::vector<BodyPart> splitByBoundary(const char* body, size_t length, const std::string& boundary);
+    static FormField parseFormField(const char* fieldData, size_t length);
     
     // Response generation
     static HTTPResponse createUploadSuccessResponse(const std::vector<std::string>& uploadedFiles);
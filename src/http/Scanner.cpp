@@ -0,0 +1,229 @@
+#include "Scanner.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define SCANNER_X86 1
+#endif
+
+// Scalar kernels
+
+static bool isControl(unsigned char c) {
+    return (c < 0x20 && c != '\t') || c == 0x7f;
+}
+
+static bool isVisible(unsigned char c) {
+    return c > 0x20 && c < 0x7f;
+}
+
+static bool isToken(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+}
+
+static const char* findControlScalar(const char* p, const char* end) {
+    while (p < end && !isControl(*p)) ++p;
+    return p;
+}
+
+static const char* skipVisibleScalar(const char* p, const char* end) {
+    while (p < end && isVisible(*p)) ++p;
+    return p;
+}
+
+static const char* skipTokenScalar(const char* p, const char* end) {
+    while (p < end && isToken(*p)) ++p;
+    return p;
+}
+
+#ifdef SCANNER_X86
+
+// Vector kernels: a mask of the bytes outside the class, the first set bit
+// is the answer. The tail shorter than a vector goes through the scalar loop.
+// Signed compares are used for ranges: bytes >= 0x80 are negative, so never
+// inside a printable range.
+
+// SSE2
+
+__attribute__((target("sse2")))
+static const char* findControlSSE2(const char* p, const char* end) {
+    const __m128i below_space = _mm_set1_epi8(0x1f);
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i del = _mm_set1_epi8(0x7f);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(v, below_space), v);
+        control = _mm_andnot_si128(_mm_cmpeq_epi8(v, tab), control);
+        control = _mm_or_si128(control, _mm_cmpeq_epi8(v, del));
+        int mask = _mm_movemask_epi8(control);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return findControlScalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static const char* skipVisibleSSE2(const char* p, const char* end) {
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i visible = _mm_and_si128(_mm_cmpgt_epi8(v, space), _mm_cmplt_epi8(v, del));
+        int mask = ~_mm_movemask_epi8(visible) & 0xffff;
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return skipVisibleScalar(p, end);
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline __m128i inRange128(__m128i v, char low, char high) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(low - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(high + 1)));
+}
+
+__attribute__((target("sse2")))
+static const char* skipTokenSSE2(const char* p, const char* end) {
+    const __m128i dash = _mm_set1_epi8('-');
+    const __m128i underscore = _mm_set1_epi8('_');
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i token = _mm_or_si128(inRange128(v, 'a', 'z'), inRange128(v, 'A', 'Z'));
+        token = _mm_or_si128(token, inRange128(v, '0', '9'));
+        token = _mm_or_si128(token, _mm_or_si128(_mm_cmpeq_epi8(v, dash), _mm_cmpeq_epi8(v, underscore)));
+        int mask = ~_mm_movemask_epi8(token) & 0xffff;
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return skipTokenScalar(p, end);
+}
+
+// AVX2: built with the target attribute only, the binary still runs on CPUs
+// without it
+
+__attribute__((target("avx2")))
+static const char* findControlAVX2(const char* p, const char* end) {
+    const __m256i below_space = _mm256_set1_epi8(0x1f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(v, below_space), v);
+        control = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), control);
+        control = _mm256_or_si256(control, _mm256_cmpeq_epi8(v, del));
+        unsigned int mask = _mm256_movemask_epi8(control);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return findControlSSE2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* skipVisibleAVX2(const char* p, const char* end) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i visible = _mm256_and_si256(_mm256_cmpgt_epi8(v, space), _mm256_cmpgt_epi8(del, v));
+        unsigned int mask = ~static_cast<unsigned int>(_mm256_movemask_epi8(visible));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return skipVisibleSSE2(p, end);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i inRange256(__m256i v, char low, char high) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(low - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), v));
+}
+
+__attribute__((target("avx2")))
+static const char* skipTokenAVX2(const char* p, const char* end) {
+    const __m256i dash = _mm256_set1_epi8('-');
+    const __m256i underscore = _mm256_set1_epi8('_');
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i token = _mm256_or_si256(inRange256(v, 'a', 'z'), inRange256(v, 'A', 'Z'));
+        token = _mm256_or_si256(token, inRange256(v, '0', '9'));
+        token = _mm256_or_si256(token, _mm256_or_si256(_mm256_cmpeq_epi8(v, dash), _mm256_cmpeq_epi8(v, underscore)));
+        unsigned int mask = ~static_cast<unsigned int>(_mm256_movemask_epi8(token));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return skipTokenSSE2(p, end);
+}
+
+#endif
+
+ScanLevel Scanner::detect() {
+#ifdef SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SCAN_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SCAN_SSE2;
+    }
+#endif
+    return SCAN_SCALAR;
+}
+
+ScanLevel Scanner::_supported = Scanner::detect();
+ScanLevel Scanner::_level = SCAN_SCALAR;
+Scanner::Kernel Scanner::_find_control = findControlScalar;
+Scanner::Kernel Scanner::_skip_visible = skipVisibleScalar;
+Scanner::Kernel Scanner::_skip_token = skipTokenScalar;
+
+// Picks the kernels before main() runs, at static initialization
+static struct ScannerInit {
+    ScannerInit() { Scanner::setLevel(SCAN_AVX2); }
+} scanner_init;
+
+void Scanner::setLevel(ScanLevel level) {
+    if (level > _supported) {
+        level = _supported;
+    }
+    _level = level;
+    _find_control = findControlScalar;
+    _skip_visible = skipVisibleScalar;
+    _skip_token = skipTokenScalar;
+#ifdef SCANNER_X86
+    if (level == SCAN_SSE2) {
+        _find_control = findControlSSE2;
+        _skip_visible = skipVisibleSSE2;
+        _skip_token = skipTokenSSE2;
+    } else if (level == SCAN_AVX2) {
+        _find_control = findControlAVX2;
+        _skip_visible = skipVisibleAVX2;
+        _skip_token = skipTokenAVX2;
+    }
+#endif
+}
+
+ScanLevel Scanner::level() {
+    return _level;
+}
+
+const char* Scanner::levelName(ScanLevel level) {
+    switch (level) {
+        case SCAN_SSE2: return "sse2";
+        case SCAN_AVX2: return "avx2";
+        default:        return "scalar";
+    }
+}
+
+const char* Scanner::findControl(const char* begin, const char* end) {
+    return _find_control(begin, end);
+}
+
+const char* Scanner::skipVisible(const char* begin, const char* end) {
+    return _skip_visible(begin, end);
+}
+
+const char* Scanner::skipToken(const char* begin, const char* end) {
+    return _skip_token(begin, end);
+}
@@ -0,0 +1,46 @@
+#ifndef SCANNER_HPP
+#define SCANNER_HPP
+
+#include <cstddef>
+
+enum ScanLevel {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+};
+
+// Byte-class scans of the HTTP parser, 16 (SSE2) or 32 (AVX2) bytes at a
+// time. The kernels are picked once at startup from what the CPU supports,
+// the scalar ones are the reference and the fallback. Each returns the
+// first byte of [begin, end) outside its class, end if there is none.
+class Scanner {
+public:
+    // Control characters (< 0x20 except HT, and DEL): CR and LF end a line,
+    // any other one is invalid in a request head
+    static const char* findControl(const char* begin, const char* end);
+    // Visible ASCII (0x21-0x7E): the method and the request target, up to
+    // the space after them
+    static const char* skipVisible(const char* begin, const char* end);
+    // Header name characters (letters, digits, '-' and '_'), up to the ':'
+    static const char* skipToken(const char* begin, const char* end);
+
+    static ScanLevel level();
+    // For benchmarks: capped at what the CPU supports
+    static void setLevel(ScanLevel level);
+    static const char* levelName(ScanLevel level);
+
+private:
+    typedef const char* (*Kernel)(const char*, const char*);
+
+    static ScanLevel _supported;
+    static ScanLevel _level;
+    static Kernel _find_control;
+    static Kernel _skip_visible;
+    static Kernel _skip_token;
+
+    static ScanLevel detect();
+
+    Scanner();
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include "Logger.hpp"
 #include "Config.hpp"
 #include "Server.hpp"
+#include "Master.hpp"
 #include "Utils.hpp"
 
 int main(int argc, char **argv)
@@ -18,56 +19,56 @@ int main(int argc, char **argv)
     }
     
     std::string configFile = argv[1];
-    Config config;
+    // Reference counted snapshot, replaced on SIGHUP (see Master)
+    Config* config = new Config();
     
-    if (config.parseNginx(configFile)){
-        Logger::info("Detected NGINX configuration format");
-        if (!config.parseNginx(configFile)){
-            Logger::error("Failed to parse NGINX configuration file");
-            return 1;
-        }
+    // Same entry point as the SIGHUP reload, so both parse the file alike
+    if (!config->parseFile(configFile))
+    {
+        Logger::error("Failed to parse configuration file");
+        config->release();
+        return 1;
     }
     
-    if (!config.isValid())
+    if (!config->isValid())
     {
         Logger::error("Configuration validation failed");
+        config->release();
         return 1;
     }
     
     Logger::info("Configuration parsed successfully");
-    Logger::info("Found " + Utils::intToString(config.getServerCount()) + " server(s)");
+    Logger::info("Found " + Utils::intToString(config->getServerCount()) + " server(s)");
     
-    // Setup signal handlers
+    // Setup signal handlers. SIGHUP, SIGQUIT, SIGUSR1 and SIGUSR2 are taken with
+    // sigwaitinfo once running; the handler only keeps them from killing
+    // the process during startup
     signal(SIGINT, Server::signalHandler);
     signal(SIGTERM, Server::signalHandler);
+    signal(SIGHUP, Server::signalHandler);
+    signal(SIGQUIT, Server::signalHandler);
+    signal(SIGUSR1, Server::signalHandler);
+    signal(SIGUSR2, Server::signalHandler);
     signal(SIGPIPE, SIG_IGN);
     
-    // Create and start server
-    Server server;
-    Server::setSignalInstance(&server);
+    // Create and start the event loops
+    Master master;
+    master.setArguments(argv);
     
-    if (!server.init(&config))
+    bool started = master.init(config);
+    config->release();
+    if (!started)
     {
         Logger::error("Failed to initialize server");
-        Server::setSignalInstance(NULL);
-        return 1;
-    }
-    
-    if (!server.start())
-    {
-        Logger::error("Failed to start server");
-        Server::setSignalInstance(NULL);
         return 1;
     }
     
     // Logger::setLevel(DEBUG);
     Logger::setLevel(INFO);
     
-    server.run();
-    
-    server.stop();
+    master.run();
     
-    Server::setSignalInstance(NULL);
+    master.stop();
     
     Logger::info("Webserv shutdown complete");
     
@@ -1,5 +1,6 @@
 #include "Logger.hpp"
 #include "Color.hpp"
+#include <sstream>
 
 LogLevel Logger::_level = INFO;
 
@@ -7,11 +8,20 @@ void Logger::setLevel(LogLevel level) {
     _level = level;
 }
 
+bool Logger::isEnabled(LogLevel level) {
+    return _level <= level;
+}
+
 void Logger::debug(const std::string& message) {
     if (_level <= DEBUG)
         log(DEBUG, message);
 }
 
+void Logger::debug(const char* message) {
+    if (_level <= DEBUG)
+        log(DEBUG, message);
+}
+
 void Logger::info(const std::string& message) {
     if (_level <= INFO)
         log(INFO, message);
@@ -42,25 +52,29 @@ void Logger::log(LogLevel level, const std::string& message, int fd) {
         case ERROR:   levelColor = Colors::RED; break;
     }
     
-    std::cout << Colors::GRAY << "[" << getCurrentTime() << "] " 
-              << levelColor << "[" << levelToString(level) << "] "
-              << Colors::WHITE;
+    // Build the whole line first: one write per line keeps output from
+    // several worker threads from interleaving
+    std::ostringstream line;
+    line << Colors::GRAY << "[" << getCurrentTime() << "] " 
+         << levelColor << "[" << levelToString(level) << "] "
+         << Colors::WHITE;
 
     if (fd >= 0) {
-        std::cout << Colors::MAGENTA << "[" << fd << "] " << Colors::WHITE;
+        line << Colors::MAGENTA << "[" << fd << "] " << Colors::WHITE;
     }
 
-    std::cout << message << TextFormat::RESET << std::endl;
+    line << message << TextFormat::RESET << "\n";
+    std::cout << line.str() << std::flush;
 }
 
 std::string Logger::getCurrentTime() {
     time_t now = time(0);
-    char* timeStr = ctime(&now);
-    std::string result(timeStr);
-    // Remove newline
-    if (!result.empty() && result[result.length()-1] == '\n')
-        result.erase(result.length()-1);
-    return result;
+    struct tm tm_now;
+    char buffer[64];
+    // Same layout as ctime(), without its shared static buffer
+    localtime_r(&now, &tm_now);
+    strftime(buffer, sizeof(buffer), "%a %b %e %H:%M:%S %Y", &tm_now);
+    return std::string(buffer);
 }
 
 std::string Logger::levelToString(LogLevel level) {
@@ -20,7 +20,11 @@ private:
     
 public:
     static void setLevel(LogLevel level);
+    // For hot paths: skip building a message that would not be written
+    static bool isEnabled(LogLevel level);
     static void debug(const std::string& message);
+    // No string is built for a literal when debug is off
+    static void debug(const char* message);
     static void info(const std::string& message);
     static void info(const std::string& message, int fd);
     static void warning(const std::string& message);
@@ -178,13 +178,11 @@ class String : public std::string
         if (empty()) return false;
 
         size_t start = 0;
-        bool hasSign = false;
         bool hasDigit = false;
         bool hasDecimal = false;
         bool hasExponent = false;
 
         if (at(0) == '+' || at(0) == '-') {
-            hasSign = true;
             start = 1;
             if (size() == 1) return false;
         }
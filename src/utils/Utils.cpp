@@ -89,14 +89,18 @@ int Utils::stringToInt(const std::string& str) {
 
 std::string Utils::getCurrentTimestamp() {
     time_t now = time(0);
+    struct tm tm_now;
     char buffer[100];
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    localtime_r(&now, &tm_now);
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm_now);
     return std::string(buffer);
 }
 
 std::string Utils::formatHttpDate(time_t timestamp) {
+    struct tm tm_gmt;
     char buffer[100];
-    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&timestamp));
+    gmtime_r(&timestamp, &tm_gmt);
+    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm_gmt);
     return std::string(buffer);
 }
 
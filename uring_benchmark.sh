@@ -0,0 +1,94 @@
+#!/bin/bash
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+YELLOW='\033[1;33m'
+NC='\033[0m'
+
+PORT=8080
+HOST="127.0.0.1"
+URL_PATH="/"
+CONNECTIONS=${1:-50}
+REQUESTS=${2:-50000}
+CLOSE_REQUESTS=${3:-10000}
+
+# Lance le serveur lui-meme, une fois avec epoll et une fois avec io_uring:
+# la latence vient de roundtrip_bench, les appels systeme de la ligne
+# "loop stats" que le worker ecrit a l'arret (wait + ctl + accept + recv +
+# send par requete; close et setsockopt sont les memes des deux cotes)
+CONFIG_FILE=$(mktemp)
+LOG_FILE=$(mktemp)
+BENCH_FILE=$(mktemp)
+trap 'rm -f "$CONFIG_FILE" "$LOG_FILE" "$BENCH_FILE"' EXIT
+
+if [ ! -x ./webserv ] || [ ! -x ./roundtrip_bench ]; then
+    echo -e "${RED}✗ ./webserv or ./roundtrip_bench not found, run make && make roundtrip_bench first${NC}"
+    exit 1
+fi
+if [ -n "$(pgrep -x webserv)" ]; then
+    echo -e "${RED}✗ webserv is already running, stop it first${NC}"
+    exit 1
+fi
+
+# $1: epoll/io_uring
+write_config() {
+    cat > "$CONFIG_FILE" <<EOF
+events {
+    backend $1;
+}
+
+server {
+    listen $PORT;
+    host $HOST;
+
+    location / {
+        root ./static;
+        index index.html;
+        methods GET;
+    }
+}
+EOF
+}
+
+# $1: backend, $2: connexions, $3: requetes, $4: keepalive/close
+run_test() {
+    local backend=$1
+    write_config "$backend"
+
+    ./webserv "$CONFIG_FILE" > "$LOG_FILE" 2>&1 &
+    local pid=$!
+    sleep 0.5
+    ./roundtrip_bench $2 $3 $PORT "$URL_PATH" $4 > "$BENCH_FILE"
+    kill -INT $pid
+    wait $pid
+
+    local stats=$(sed 's/\x1b\[[0-9;]*m//g' "$LOG_FILE" | grep 'loop stats' | tail -1)
+    if [ -z "$stats" ]; then
+        echo -e "${RED}✗ no loop stats from the server (see its log)${NC}"
+        return
+    fi
+    if ! grep -q completions "$LOG_FILE" && [ "$backend" = io_uring ]; then
+        echo -e "${YELLOW}  io_uring without completions (kernel before 6.3): readiness polls${NC}"
+    fi
+    echo "$stats" | awk -v l="$backend" -v b="$(tail -1 "$BENCH_FILE")" '{
+        for (i = 1; i <= NF; ++i) { split($i, kv, "="); v[kv[1]] = kv[2] }
+        r = v["requests"] ? v["requests"] : 1
+        s = v["wait"] + v["ctl"] + v["accept"] + v["recv"] + v["send"]
+        printf "%-8s requests %6d  syscalls %7d  (%.2f/request)  %s\n", l, v["requests"], s, s / r, b
+    }'
+}
+
+echo -e "${YELLOW}=== Webserv io_uring Benchmark ===${NC}"
+echo "Target: http://$HOST:$PORT$URL_PATH"
+echo ""
+
+echo -e "${YELLOW}[1/2] $REQUESTS GETs over $CONNECTIONS keep-alive connections${NC}"
+run_test epoll $CONNECTIONS $REQUESTS keepalive
+run_test io_uring $CONNECTIONS $REQUESTS keepalive
+
+echo -e "${YELLOW}[2/2] $CLOSE_REQUESTS GETs, one connection each, $CONNECTIONS at a time${NC}"
+run_test epoll $CONNECTIONS $CLOSE_REQUESTS close
+run_test io_uring $CONNECTIONS $CLOSE_REQUESTS close
+
+echo ""
+echo -e "${GREEN}=== Benchmark completed ===${NC}"